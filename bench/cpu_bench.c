@@ -0,0 +1,159 @@
+/*
+*   TotalJustice
+*/
+
+/// Measures how many instructions per second cpu_tick() can interpret.
+/// Build with the Makefile bench-cpu target, which builds this once per dispatcher, addressing path, decode cache and N / Z flags,
+/// plus once with -DBENCH_JIT=1, which runs the recompiler through cpu_step() instead.
+/// Usage: t-nes-bench-cpu [rom] [instructions]
+/// If no rom is passed, a small built-in rom is used so that every run is comparable.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../nes/nes.h"
+
+#ifndef CPU_DISPATCH_THREADED
+    #define CPU_DISPATCH_THREADED 0
+#endif
+
+#ifndef CPU_ADDRESSING_RUNTIME
+    #define CPU_ADDRESSING_RUNTIME 0
+#endif
+
+#ifndef CPU_DECODE_CACHE
+    #define CPU_DECODE_CACHE 1
+#endif
+
+#ifndef CPU_LAZY_NZ
+    #define CPU_LAZY_NZ 1
+#endif
+
+#ifndef BENCH_JIT
+    #define BENCH_JIT 0
+#endif
+
+#define BENCH_INSTRUCTIONS 50000000ULL
+
+/// The deadline each cpu_step() is given with the jit, about a scanline, same as nes_run() would.
+#define BENCH_JIT_SLICE 114
+
+/// Reset vector points at 0xC000, which is the start of the 16KiB prg-rom.
+/// The loop does a mix of alu, zero page rw, stack and branch ops.
+static const uint8_t bench_prg[] =
+{
+    0xA2, 0x00,         /// C000: LDX #$00
+    0xA0, 0x10,         /// C002: LDY #$10
+    0x18,               /// C004: CLC
+    0xA9, 0x01,         /// C005: LDA #$01
+    0x65, 0x10,         /// C007: ADC $10
+    0x85, 0x10,         /// C009: STA $10
+    0x95, 0x20,         /// C00B: STA $20,X
+    0x29, 0x7F,         /// C00D: AND #$7F
+    0xC9, 0x40,         /// C00F: CMP #$40
+    0xE8,               /// C011: INX
+    0xD0, 0xF0,         /// C012: BNE $C004
+    0x20, 0x1A, 0xC0,   /// C014: JSR $C01A
+    0x4C, 0x00, 0xC0,   /// C017: JMP $C000
+    0x48,               /// C01A: PHA
+    0x88,               /// C01B: DEY
+    0xD0, 0xFD,         /// C01C: BNE $C01B
+    0x68,               /// C01E: PLA
+    0x60,               /// C01F: RTS
+};
+
+static int write_bench_rom(char *path)
+{
+    int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to create bench rom %s\n", path);
+        return -1;
+    }
+
+    static uint8_t rom[16 + 0x4000];
+    memset(rom, 0xEA, sizeof(rom));
+    memcpy(rom, "NES\x1A\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 16);
+    memcpy(rom + 16, bench_prg, sizeof(bench_prg));
+
+    /// reset vector.
+    rom[16 + 0x3FFC] = 0x00;
+    rom[16 + 0x3FFD] = 0xC0;
+
+    ssize_t ret = write(fd, rom, sizeof(rom));
+    close(fd);
+
+    return ret == sizeof(rom) ? 0 : -1;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    char tmp_path[] = "/tmp/t-nes-bench-XXXXXX";
+    const char *path = argc > 1 ? argv[1] : tmp_path;
+    uint64_t instructions = argc > 2 ? strtoull(argv[2], NULL, 0) : BENCH_INSTRUCTIONS;
+
+    if (argc <= 1 && write_bench_rom(tmp_path) != 0)
+    {
+        return -1;
+    }
+
+    nes_t *nes = nes_init();
+
+    if (nes_loadrom(nes, path) != 0)
+    {
+        return -1;
+    }
+
+    const cpu_t *cpu = &nes->cpu;
+
+    #if BENCH_JIT
+    if (cpu_set_jit(nes, true) != 0)
+    {
+        return -1;
+    }
+
+    /// a block runs a whole number of instructions, so this can go a few past.
+    double start = now();
+    while (cpu->debug.count < instructions)
+    {
+        cpu_step(nes, cpu->cycle_total + BENCH_JIT_SLICE);
+    }
+    double elapsed = now() - start;
+    #else
+    double start = now();
+    for (uint64_t i = 0; i < instructions; i++)
+    {
+        cpu_tick(nes);
+    }
+    double elapsed = now() - start;
+    #endif
+
+    printf("jit: %s\n", BENCH_JIT ? "on" : "off");
+    printf("dispatch: %s\n", CPU_DISPATCH_THREADED ? "threaded" : "table");
+    printf("addressing: %s\n", CPU_ADDRESSING_RUNTIME ? "runtime" : "specialised");
+    printf("decode cache: %s\n", CPU_DECODE_CACHE ? "on" : "off");
+    printf("nz flags: %s\n", CPU_LAZY_NZ ? "lazy" : "eager");
+    printf("instructions: %lu cycles: %lu\n", cpu->debug.count, cpu->cycle_total);
+    printf("time: %.3fs\n", elapsed);
+    printf("instructions/sec: %.2fM\n", cpu->debug.count / elapsed / 1e6);
+
+    nes_exit(nes);
+
+    if (argc <= 1)
+    {
+        unlink(tmp_path);
+    }
+
+    return 0;
+}
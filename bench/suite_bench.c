@@ -0,0 +1,427 @@
+/*
+*   TotalJustice
+*/
+
+/// Runs a set of tiny generated roms, each hammering one part of the cpu / bus, through nes_run()
+/// for a fixed number of emulated cycles, and reports emulated MHz and ns per instruction.
+/// Build and run with the Makefile bench target.
+/// Usage: t-nes-bench-suite [-c cycles] [-r repeats] [-j] [-o json]
+///
+/// -j runs with the recompiler. -o writes the results as json as well.
+/// Each workload runs repeats times from power up and the fastest is kept, idle loop skipping is
+/// off so every cycle is actually run.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../nes/nes.h"
+
+#define BENCH_CYCLES 100000000ULL
+#define BENCH_REPEATS 5
+
+/// NTSC cpu clock, to show how many times faster than a real console it runs.
+#define BENCH_NES_MHZ 1.789773
+
+/// Every workload starts at 0xC000 (the 16KiB prg-rom is mirrored there), nmi / irq point at an RTI
+/// at this offset into the prg, ie 0xFFF0.
+#define BENCH_RTI_ADDR 0x3FF0
+
+typedef struct
+{
+    const char *name;
+    const uint8_t *prg;
+    uint32_t size;
+} workload_t;
+
+static const uint8_t alu_prg[] =
+{
+    0xA9, 0x00,         /// C000: LDA #$00
+    0xA2, 0x00,         /// C002: LDX #$00
+    0xA0, 0x00,         /// C004: LDY #$00
+    0x18,               /// C006: CLC
+    0x69, 0x37,         /// C007: ADC #$37
+    0x49, 0x5A,         /// C009: EOR #$5A
+    0x0A,               /// C00B: ASL A
+    0x2A,               /// C00C: ROL A
+    0x38,               /// C00D: SEC
+    0xE9, 0x11,         /// C00E: SBC #$11
+    0x29, 0xF7,         /// C010: AND #$F7
+    0x09, 0x21,         /// C012: ORA #$21
+    0x4A,               /// C014: LSR A
+    0x6A,               /// C015: ROR A
+    0xAA,               /// C016: TAX
+    0xE8,               /// C017: INX
+    0x8A,               /// C018: TXA
+    0xC8,               /// C019: INY
+    0xC9, 0x80,         /// C01A: CMP #$80
+    0x4C, 0x06, 0xC0,   /// C01C: JMP $C006
+};
+
+static const uint8_t memory_prg[] =
+{
+    0xA9, 0x00,         /// C000: LDA #$00
+    0x85, 0x10,         /// C002: STA $10
+    0x85, 0x12,         /// C004: STA $12
+    0xA9, 0x02,         /// C006: LDA #$02
+    0x85, 0x11,         /// C008: STA $11      ($10) = $0200
+    0xA9, 0x03,         /// C00A: LDA #$03
+    0x85, 0x13,         /// C00C: STA $13      ($12) = $0300
+    0xA0, 0x00,         /// C00E: LDY #$00
+    0xA2, 0x00,         /// C010: LDX #$00
+    0xB1, 0x10,         /// C012: LDA ($10),Y
+    0x65, 0x30,         /// C014: ADC $30
+    0x91, 0x12,         /// C016: STA ($12),Y
+    0x85, 0x30,         /// C018: STA $30
+    0x98,               /// C01A: TYA
+    0x29, 0x3F,         /// C01B: AND #$3F
+    0xAA,               /// C01D: TAX
+    0xB5, 0x40,         /// C01E: LDA $40,X
+    0x75, 0x80,         /// C020: ADC $80,X
+    0x95, 0x40,         /// C022: STA $40,X
+    0xC8,               /// C024: INY
+    0xD0, 0xEB,         /// C025: BNE $C012
+    0xA5, 0x11,         /// C027: LDA $11
+    0x49, 0x01,         /// C029: EOR #$01     read from $0200 / $0300 in turn
+    0x85, 0x11,         /// C02B: STA $11
+    0x4C, 0x12, 0xC0,   /// C02D: JMP $C012
+};
+
+static const uint8_t branch_prg[] =
+{
+    0xA2, 0x00,         /// C000: LDX #$00
+    0xA0, 0x00,         /// C002: LDY #$00
+    0x8A,               /// C004: TXA
+    0x29, 0x01,         /// C005: AND #$01
+    0xF0, 0x02,         /// C007: BEQ $C00B
+    0xC8,               /// C009: INY
+    0xC8,               /// C00A: INY
+    0x8A,               /// C00B: TXA
+    0x29, 0x02,         /// C00C: AND #$02
+    0xD0, 0x01,         /// C00E: BNE $C011
+    0x88,               /// C010: DEY
+    0x8A,               /// C011: TXA
+    0xC9, 0x80,         /// C012: CMP #$80
+    0xB0, 0x01,         /// C014: BCS $C017
+    0xC8,               /// C016: INY
+    0x98,               /// C017: TYA
+    0x30, 0x01,         /// C018: BMI $C01B
+    0xE8,               /// C01A: INX
+    0x8A,               /// C01B: TXA
+    0x4A,               /// C01C: LSR A
+    0x90, 0x00,         /// C01D: BCC $C01F
+    0x70, 0x00,         /// C01F: BVS $C021
+    0xE8,               /// C021: INX
+    0xD0, 0xE0,         /// C022: BNE $C004
+    0x4C, 0x04, 0xC0,   /// C024: JMP $C004
+};
+
+static const uint8_t recursion_prg[] =
+{
+    0xA2, 0xFF,         /// C000: LDX #$FF
+    0x9A,               /// C002: TXS
+    0xA2, 0x20,         /// C003: LDX #$20     32 deep
+    0x20, 0x0B, 0xC0,   /// C005: JSR $C00B
+    0x4C, 0x03, 0xC0,   /// C008: JMP $C003
+    0x48,               /// C00B: PHA
+    0xCA,               /// C00C: DEX
+    0xF0, 0x03,         /// C00D: BEQ $C012
+    0x20, 0x0B, 0xC0,   /// C00F: JSR $C00B
+    0x68,               /// C012: PLA
+    0x60,               /// C013: RTS
+};
+
+static const uint8_t ppu_prg[] =
+{
+    0xA9, 0x00,         /// C000: LDA #$00
+    0x8D, 0x00, 0x20,   /// C002: STA $2000    nmi off
+    0x8D, 0x01, 0x20,   /// C005: STA $2001
+    0xAD, 0x02, 0x20,   /// C008: LDA $2002
+    0xA9, 0x20,         /// C00B: LDA #$20
+    0x8D, 0x06, 0x20,   /// C00D: STA $2006
+    0xA9, 0x00,         /// C010: LDA #$00
+    0x8D, 0x06, 0x20,   /// C012: STA $2006
+    0x8E, 0x07, 0x20,   /// C015: STX $2007
+    0xAD, 0x07, 0x20,   /// C018: LDA $2007
+    0x8D, 0x05, 0x20,   /// C01B: STA $2005
+    0x8D, 0x05, 0x20,   /// C01E: STA $2005
+    0x8C, 0x03, 0x20,   /// C021: STY $2003
+    0x8E, 0x04, 0x20,   /// C024: STX $2004
+    0xE8,               /// C027: INX
+    0xC8,               /// C028: INY
+    0x4C, 0x08, 0xC0,   /// C029: JMP $C008
+};
+
+static const uint8_t oam_dma_prg[] =
+{
+    0xA2, 0x00,         /// C000: LDX #$00
+    0x8A,               /// C002: TXA
+    0x9D, 0x00, 0x02,   /// C003: STA $0200,X
+    0xE8,               /// C006: INX
+    0xD0, 0xF9,         /// C007: BNE $C002
+    0xA9, 0x00,         /// C009: LDA #$00
+    0x8D, 0x03, 0x20,   /// C00B: STA $2003
+    0xA9, 0x02,         /// C00E: LDA #$02
+    0x8D, 0x14, 0x40,   /// C010: STA $4014
+    0xEE, 0x00, 0x02,   /// C013: INC $0200
+    0x4C, 0x09, 0xC0,   /// C016: JMP $C009
+};
+
+static const workload_t workloads[] =
+{
+    { "alu", alu_prg, sizeof(alu_prg) },
+    { "memory", memory_prg, sizeof(memory_prg) },
+    { "branch", branch_prg, sizeof(branch_prg) },
+    { "recursion", recursion_prg, sizeof(recursion_prg) },
+    { "ppu", ppu_prg, sizeof(ppu_prg) },
+    { "oam_dma", oam_dma_prg, sizeof(oam_dma_prg) },
+};
+
+#define WORKLOAD_COUNT (sizeof(workloads) / sizeof(workloads[0]))
+
+typedef struct
+{
+    uint64_t cycles;
+    uint64_t instructions;
+    double seconds;
+} result_t;
+
+static int write_rom(char *path, const workload_t *workload)
+{
+    int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to create bench rom %s\n", path);
+        return -1;
+    }
+
+    static uint8_t rom[16 + 0x4000];
+    memset(rom, 0xEA, sizeof(rom));
+    memcpy(rom, "NES\x1A\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 16);
+    memcpy(rom + 16, workload->prg, workload->size);
+
+    uint8_t *prg = rom + 16;
+    prg[BENCH_RTI_ADDR] = 0x40;
+
+    /// nmi, reset, irq.
+    prg[0x3FFA] = BENCH_RTI_ADDR & 0xFF;
+    prg[0x3FFB] = 0xC0 | (BENCH_RTI_ADDR >> 8);
+    prg[0x3FFC] = 0x00;
+    prg[0x3FFD] = 0xC0;
+    prg[0x3FFE] = BENCH_RTI_ADDR & 0xFF;
+    prg[0x3FFF] = 0xC0 | (BENCH_RTI_ADDR >> 8);
+
+    ssize_t ret = write(fd, rom, sizeof(rom));
+    close(fd);
+
+    return ret == sizeof(rom) ? 0 : -1;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// Runs from the state saved at power up, until cycles.
+static int run_workload(nes_t *nes, const void *state, size_t state_size, uint64_t cycles, result_t *result)
+{
+    if (nes_state_load(nes, state, state_size) != 0)
+    {
+        return -1;
+    }
+
+    const cpu_t *cpu = &nes->cpu;
+    const uint64_t instructions = cpu->debug.count;
+
+    const double start = now();
+    while (cpu->cycle_total < cycles)
+    {
+        if (nes_run(nes) != 0)
+        {
+            return -1;
+        }
+    }
+    result->seconds = now() - start;
+    result->cycles = cpu->cycle_total;
+    result->instructions = cpu->debug.count - instructions;
+
+    return 0;
+}
+
+/// Each repeat starts from power up, loaded from a save state so the rom is only loaded once.
+static int bench_workload(const workload_t *workload, uint64_t cycles, uint32_t repeats, bool jit, result_t *best)
+{
+    char path[] = "/tmp/t-nes-bench-XXXXXX";
+    if (write_rom(path, workload) != 0)
+    {
+        return -1;
+    }
+
+    nes_t *nes = nes_init();
+    const int loaded = nes ? nes_loadrom(nes, path) : -1;
+    unlink(path);
+    if (loaded != 0)
+    {
+        if (nes)
+        {
+            nes_exit(nes);
+        }
+        return -1;
+    }
+
+    cpu_set_idle_skip(nes, false);
+    if (jit && cpu_set_jit(nes, true) != 0)
+    {
+        nes_exit(nes);
+        return -1;
+    }
+
+    const size_t state_size = nes_state_size();
+    void *state = malloc(state_size);
+    if (!state || nes_state_save(nes, state, state_size) != 0)
+    {
+        free(state);
+        nes_exit(nes);
+        return -1;
+    }
+
+    int ret = 0;
+    for (uint32_t r = 0; r < repeats; r++)
+    {
+        result_t result;
+        if (run_workload(nes, state, state_size, cycles, &result) != 0)
+        {
+            ret = -1;
+            break;
+        }
+
+        if (r == 0 || result.seconds < best->seconds)
+        {
+            *best = result;
+        }
+    }
+
+    free(state);
+    nes_exit(nes);
+    return ret;
+}
+
+static double mhz(const result_t *result)
+{
+    return result->cycles / result->seconds / 1e6;
+}
+
+static double ns_per_instruction(const result_t *result)
+{
+    return result->seconds * 1e9 / result->instructions;
+}
+
+static int write_json(FILE *fp, const result_t *results, uint64_t cycles, uint32_t repeats, bool jit)
+{
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"cycles\": %lu,\n", cycles);
+    fprintf(fp, "  \"repeats\": %u,\n", repeats);
+    fprintf(fp, "  \"jit\": %s,\n", jit ? "true" : "false");
+    fprintf(fp, "  \"results\": [\n");
+
+    for (uint32_t i = 0; i < WORKLOAD_COUNT; i++)
+    {
+        const result_t *r = &results[i];
+        fprintf(fp, "    { \"name\": \"%s\", \"cycles\": %lu, \"instructions\": %lu, \"seconds\": %.6f, \"mhz\": %.3f, \"ns_per_instruction\": %.3f }%s\n",
+            workloads[i].name, r->cycles, r->instructions, r->seconds, mhz(r), ns_per_instruction(r),
+            i + 1 < WORKLOAD_COUNT ? "," : "");
+    }
+
+    fprintf(fp, "  ]\n");
+    fprintf(fp, "}\n");
+
+    if (ferror(fp))
+    {
+        fprintf(stderr, "Failed to write bench results\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t cycles = BENCH_CYCLES;
+    uint32_t repeats = BENCH_REPEATS;
+    bool jit = false;
+    const char *json_path = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        {
+            cycles = strtoull(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+        {
+            repeats = strtoul(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "-j") == 0)
+        {
+            jit = true;
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            json_path = argv[++i];
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-c cycles] [-r repeats] [-j] [-o json]\n", argv[0]);
+            return -1;
+        }
+    }
+
+    if (!repeats)
+    {
+        repeats = 1;
+    }
+
+    printf("jit: %s cycles: %lu repeats: %u\n", jit ? "on" : "off", cycles, repeats);
+
+    result_t results[WORKLOAD_COUNT];
+
+    for (uint32_t i = 0; i < WORKLOAD_COUNT; i++)
+    {
+        if (bench_workload(&workloads[i], cycles, repeats, jit, &results[i]) != 0)
+        {
+            fprintf(stderr, "%s failed\n", workloads[i].name);
+            return -1;
+        }
+    }
+
+    /// after the runs, as loading a rom prints its info.
+    printf("\n%-10s %12s %10s %10s %8s %9s\n", "workload", "instructions", "time", "MHz", "x nes", "ns/ins");
+    for (uint32_t i = 0; i < WORKLOAD_COUNT; i++)
+    {
+        const result_t *r = &results[i];
+        printf("%-10s %12lu %9.3fs %10.2f %8.1f %9.2f\n", workloads[i].name, r->instructions, r->seconds,
+            mhz(r), mhz(r) / BENCH_NES_MHZ, ns_per_instruction(r));
+    }
+
+    if (json_path)
+    {
+        FILE *fp = fopen(json_path, "w");
+        if (!fp)
+        {
+            fprintf(stderr, "Failed to open %s\n", json_path);
+            return -1;
+        }
+
+        const int ret = write_json(fp, results, cycles, repeats, jit);
+        fclose(fp);
+        return ret;
+    }
+
+    return 0;
+}
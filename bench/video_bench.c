@@ -0,0 +1,93 @@
+/*
+*   TotalJustice
+*/
+
+/// Times converting a frame to each host pixel format, and prints a hash of each so a
+/// build with -DVIDEO_SIMD=0 can be checked against the default one.
+/// Build and run with the Makefile bench-video target.
+/// Usage: t-nes-bench-video [frames]
+///
+/// The frame is random colours with every emphasis combination, so nothing is cached in the tables' favour.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../nes/video.h"
+
+#define BENCH_FRAMES 20000
+
+static const char *format_names[VideoFormat_Count] =
+{
+    [VideoFormat_RGBA8888] = "rgba8888",
+    [VideoFormat_BGRA8888] = "bgra8888",
+    [VideoFormat_RGB565] = "rgb565",
+};
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t fnv1a(const uint8_t *data, size_t size)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ data[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+int main(int argc, char **argv)
+{
+    const uint32_t frames = argc > 1 ? strtoul(argv[1], NULL, 0) : BENCH_FRAMES;
+
+    ppu_t *ppu = malloc(sizeof(ppu_t));
+    video_t *video = malloc(sizeof(video_t));
+    uint8_t *pixels = malloc(PPU_SCREEN_WIDTH * PPU_SCREEN_HEIGHT * 4);
+    if (!ppu || !video || !pixels || !frames)
+    {
+        fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+        return -1;
+    }
+
+    ppu_init(ppu);
+    video_init(video);
+
+    uint32_t seed = 0x12345678;
+    for (uint16_t y = 0; y < PPU_SCREEN_HEIGHT; y++)
+    {
+        ppu->emphasis[y] = y & 7;
+        for (uint16_t x = 0; x < PPU_SCREEN_WIDTH; x++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            ppu->framebuffer[y][x] = (seed >> 24) & 0x3F;
+        }
+    }
+
+    printf("%-10s %12s %18s\n", "format", "us/frame", "hash");
+    for (uint8_t format = 0; format < VideoFormat_Count; format++)
+    {
+        const uint32_t pitch = PPU_SCREEN_WIDTH * video_bytes_per_pixel(format);
+
+        const double start = now();
+        for (uint32_t i = 0; i < frames; i++)
+        {
+            video_convert(video, ppu, format, pixels, pitch);
+        }
+        const double elapsed = now() - start;
+
+        printf("%-10s %12.2f %18lX\n", format_names[format], elapsed * 1e6 / frames,
+            fnv1a(pixels, pitch * PPU_SCREEN_HEIGHT));
+    }
+
+    free(ppu);
+    free(video);
+    free(pixels);
+    return 0;
+}
@@ -0,0 +1,266 @@
+/*
+*   TotalJustice
+*/
+
+/// Runs a rom alongside a reference log, checking the cpu state before every instruction.
+/// Usage: t-nes-difftest <rom> <log> [-n] [-j]
+///
+/// The log is nestest.log, or anything in the same format (ie t-nes-tracefmt output).
+/// Only PC, A, X, Y, P, SP and CYC are compared, the disassembly / ppu columns are ignored.
+/// -n starts at nestest's automation entry point (PC=0xC000, CYC=7) rather than the reset vector.
+/// -j runs with the recompiler, a block runs many instructions at once, so the log lines
+/// inside of it are skipped and only the state at block boundaries is compared.
+///
+/// Each log line is parsed into integers as it is read and compared against the registers,
+/// nothing is formatted unless it diverges. It stops at the first difference and prints the
+/// lines leading up to it.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nes/nes.h"
+#include "nes/cpu_opcodes.h"
+
+#define CONTEXT_LINES 8
+#define LINE_SIZE 256
+
+/// The register columns start here in nestest.log.
+#define LOG_REGS_COLUMN 48
+
+#define OPCODE_IMPLEMENTED_ENTRY(code, mode, ins) [code] = true,
+
+static const bool opcode_implemented[0x100] =
+{
+    CPU_OPCODE_LIST(OPCODE_IMPLEMENTED_ENTRY)
+};
+
+typedef struct
+{
+    uint16_t PC;
+    uint8_t A;
+    uint8_t X;
+    uint8_t Y;
+    uint8_t P;
+    uint8_t SP;
+    uint64_t cycle;
+} log_state_t;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int hex_digit(char c)
+{
+    switch (c)
+    {
+        case '0' ... '9': return c - '0';
+        case 'A' ... 'F': return c - 'A' + 10;
+        case 'a' ... 'f': return c - 'a' + 10;
+        default: return -1;
+    }
+}
+
+static bool parse_hex(const char *s, uint8_t digits, uint16_t *out)
+{
+    uint16_t v = 0;
+    for (uint8_t i = 0; i < digits; i++)
+    {
+        const int d = hex_digit(s[i]);
+        if (d < 0)
+        {
+            return false;
+        }
+        v = (v << 4) | d;
+    }
+    *out = v;
+    return true;
+}
+
+/// Finds "<key>" at or after s and parses the hex byte after it.
+static bool parse_field8(const char *s, const char *key, uint8_t *out)
+{
+    const char *p = strstr(s, key);
+    uint16_t v = 0;
+    if (!p || !parse_hex(p + strlen(key), 2, &v))
+    {
+        return false;
+    }
+    *out = v;
+    return true;
+}
+
+static bool parse_line(const char *line, log_state_t *out)
+{
+    uint16_t pc = 0;
+    if (!parse_hex(line, 4, &pc))
+    {
+        return false;
+    }
+    out->PC = pc;
+
+    /// the disassembly can't contain "A:", but start at the register columns anyway.
+    const char *regs = strlen(line) > LOG_REGS_COLUMN ? line + LOG_REGS_COLUMN : line;
+    if (!parse_field8(regs, "A:", &out->A) || !parse_field8(regs, "X:", &out->X) ||
+        !parse_field8(regs, "Y:", &out->Y) || !parse_field8(regs, "P:", &out->P) ||
+        !parse_field8(regs, "SP:", &out->SP))
+    {
+        return false;
+    }
+
+    const char *cyc = strstr(regs, "CYC:");
+    if (!cyc)
+    {
+        return false;
+    }
+    out->cycle = strtoull(cyc + 4, NULL, 10);
+
+    return true;
+}
+
+static void print_divergence(const nes_t *nes, char context[CONTEXT_LINES][LINE_SIZE], uint64_t line_number, const log_state_t *want)
+{
+    const cpu_t *cpu = &nes->cpu;
+
+    printf("diverged at line %lu\n", line_number);
+
+    /// context is a ring, the diverging line is the newest entry.
+    const uint64_t first = line_number > CONTEXT_LINES ? line_number - CONTEXT_LINES + 1 : 1;
+    for (uint64_t i = first; i <= line_number; i++)
+    {
+        printf("%c %6lu: %s", i == line_number ? '>' : ' ', i, context[i % CONTEXT_LINES]);
+    }
+
+    printf("  got: PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%lu\n",
+        cpu->reg.PC, cpu->reg.A, cpu->reg.X, cpu->reg.Y, cpu->reg.P, cpu->reg.SP, cpu->cycle_total);
+
+    printf("  differs:");
+    if (cpu->reg.PC != want->PC) { printf(" PC"); }
+    if (cpu->reg.A != want->A) { printf(" A"); }
+    if (cpu->reg.X != want->X) { printf(" X"); }
+    if (cpu->reg.Y != want->Y) { printf(" Y"); }
+    if (cpu->reg.P != want->P) { printf(" P"); }
+    if (cpu->reg.SP != want->SP) { printf(" SP"); }
+    if (cpu->cycle_total != want->cycle) { printf(" CYC"); }
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s <rom> <log> [-n] [-j]\n", argv[0]);
+        return -1;
+    }
+
+    bool nestest_auto = false;
+    bool jit = false;
+    for (int i = 3; i < argc; i++)
+    {
+        nestest_auto |= strcmp(argv[i], "-n") == 0;
+        jit |= strcmp(argv[i], "-j") == 0;
+    }
+
+    FILE *fp = fopen(argv[2], "r");
+    if (!fp)
+    {
+        fprintf(stderr, "Failed to open log: %s\n", argv[2]);
+        return -1;
+    }
+
+    nes_t *nes = nes_init();
+    if (!nes || nes_loadrom(nes, argv[1]) != 0)
+    {
+        fclose(fp);
+        if (nes)
+        {
+            nes_exit(nes);
+        }
+        return -1;
+    }
+
+    if (nestest_auto)
+    {
+        cpu_nestest_auto(nes);
+    }
+
+    /// every instruction is checked, so don't skip any.
+    cpu_set_idle_skip(nes, false);
+
+    if (jit && cpu_set_jit(nes, true) != 0)
+    {
+        fclose(fp);
+        nes_exit(nes);
+        return -1;
+    }
+
+    char context[CONTEXT_LINES][LINE_SIZE];
+    uint64_t line_number = 0;
+    int ret = 0;
+
+    const double start = now();
+    while (fgets(context[(line_number + 1) % CONTEXT_LINES], LINE_SIZE, fp))
+    {
+        line_number++;
+        const char *line = context[line_number % CONTEXT_LINES];
+
+        log_state_t want;
+        if (!parse_line(line, &want))
+        {
+            fprintf(stderr, "Bad log line %lu: %s", line_number, line);
+            ret = -1;
+            break;
+        }
+
+        const cpu_t *cpu = &nes->cpu;
+
+        /// ran as part of the last block.
+        if (jit && want.cycle < cpu->cycle_total)
+        {
+            continue;
+        }
+
+        if (cpu->reg.PC != want.PC || cpu->reg.A != want.A || cpu->reg.X != want.X ||
+            cpu->reg.Y != want.Y || cpu->reg.P != want.P || cpu->reg.SP != want.SP ||
+            cpu->cycle_total != want.cycle)
+        {
+            print_divergence(nes, context, line_number, &want);
+            ret = 1;
+            break;
+        }
+
+        /// the state matches, but the cpu can't go any further.
+        const uint8_t opcode = cpu->read_pages[cpu->reg.PC >> 8] ? cpu->read_pages[cpu->reg.PC >> 8][cpu->reg.PC & 0xFF] : 0;
+        if (!opcode_implemented[opcode])
+        {
+            printf("stopped at line %lu, opcode 0x%02X is not implemented\n", line_number, opcode);
+            printf("> %6lu: %s", line_number, line);
+            ret = 1;
+            break;
+        }
+
+        if (nes_step(nes) != 0)
+        {
+            ret = -1;
+            break;
+        }
+    }
+    const double elapsed = now() - start;
+
+    if (ret == 0)
+    {
+        printf("all %lu lines match\n", line_number);
+    }
+    printf("time: %.3fms\n", elapsed * 1000.0);
+
+    nes_exit(nes);
+    fclose(fp);
+
+    return ret;
+}
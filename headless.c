@@ -0,0 +1,291 @@
+/*
+*   TotalJustice
+*/
+
+/// Runs the emulator without the ui, as fast as it can go.
+/// Usage: t-nes-headless <rom> [frames] [input script|movie|-] [trace]
+/// See nes/input_script.h for the input script format, and nes/movie.h for movies (.tnm / .fm2).
+/// Set T_NES_RECORD=<path> to record the input of the run to a movie.
+/// Set T_NES_SCREENSHOT=<path> to write the last frame there as a ppm, see nes/video.h.
+/// If a trace file is given, a binary cpu trace is written to it, see t-nes-tracefmt.
+/// Set T_NES_JIT=1 to run with the recompiler, see nes/jit.h.
+/// Set T_NES_PROFILE=<csv> to write the profiling counters there once done, see nes/profile.h,
+/// this needs a build with them in (t-nes-headless-profile).
+/// Set T_NES_GUESTPROF=<path> to profile the guest code (see nes/guestprof.h), folded stacks for a
+/// flamegraph are written to <path> and cycles per pc to <path>.pcs.csv.
+/// T_NES_LABELS=<file> names the routines, from ld65 -Ln.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nes/nes.h"
+#include "nes/input_script.h"
+#include "nes/movie.h"
+#include "nes/video.h"
+#include "nes/trace.h"
+#include "nes/guestprof.h"
+
+#define DEFAULT_FRAMES 600
+
+static int write_guestprof(const guestprof_t *gp, const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+    {
+        fprintf(stderr, "Failed to open guest profile: %s\n", path);
+        return -1;
+    }
+    int ret = guestprof_write_folded(gp, fp);
+    fclose(fp);
+
+    char pcs_path[4096];
+    snprintf(pcs_path, sizeof(pcs_path), "%s.pcs.csv", path);
+    fp = fopen(pcs_path, "w");
+    if (!fp)
+    {
+        fprintf(stderr, "Failed to open guest profile: %s\n", pcs_path);
+        return -1;
+    }
+    ret |= guestprof_write_pcs(gp, fp);
+    fclose(fp);
+
+    return ret;
+}
+
+static int write_screenshot(const ppu_t *ppu, const char *path)
+{
+    video_t *video = malloc(sizeof(video_t));
+    uint8_t *pixels = malloc(PPU_SCREEN_WIDTH * PPU_SCREEN_HEIGHT * 4);
+    if (!video || !pixels)
+    {
+        fprintf(stderr, "Failed to alloc screenshot\n");
+        free(video);
+        free(pixels);
+        return -1;
+    }
+
+    video_init(video);
+    video_convert(video, ppu, VideoFormat_RGBA8888, pixels, PPU_SCREEN_WIDTH * 4);
+
+    /// ppm is rgb, the alpha is dropped.
+    for (uint32_t i = 0; i < PPU_SCREEN_WIDTH * PPU_SCREEN_HEIGHT; i++)
+    {
+        memmove(&pixels[i * 3], &pixels[i * 4], 3);
+    }
+
+    int ret = -1;
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "Failed to open screenshot: %s\n", path);
+    }
+    else
+    {
+        fprintf(fp, "P6\n%u %u\n255\n", PPU_SCREEN_WIDTH, PPU_SCREEN_HEIGHT);
+        ret = fwrite(pixels, 3, PPU_SCREEN_WIDTH * PPU_SCREEN_HEIGHT, fp) == PPU_SCREEN_WIDTH * PPU_SCREEN_HEIGHT ? 0 : -1;
+        if (fclose(fp) != 0 || ret != 0)
+        {
+            fprintf(stderr, "Failed to write screenshot: %s\n", path);
+            ret = -1;
+        }
+    }
+
+    free(video);
+    free(pixels);
+    return ret;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <rom> [frames] [input script|movie|-] [trace]\n", argv[0]);
+        return -1;
+    }
+
+    const uint32_t frames = argc > 2 ? strtoul(argv[2], NULL, 0) : DEFAULT_FRAMES;
+
+    input_script_t script = {0};
+    movie_t movie = {0};
+    const bool playback = argc > 3 && movie_path(argv[3]);
+    if (playback)
+    {
+        if (movie_load(&movie, argv[3]) != 0)
+        {
+            return -1;
+        }
+    }
+    else if (argc > 3 && strcmp(argv[3], "-") != 0 && input_script_load(&script, argv[3]) != 0)
+    {
+        return -1;
+    }
+
+    movie_t record;
+    movie_init(&record);
+    const char *record_path = getenv("T_NES_RECORD");
+
+    nes_t *nes = nes_init();
+    if (!nes)
+    {
+        return -1;
+    }
+
+    if (nes_loadrom(nes, argv[1]) != 0 || movie_check_rom(&movie, nes) != 0)
+    {
+        nes_exit(nes);
+        return -1;
+    }
+
+    const char *jit = getenv("T_NES_JIT");
+    if (jit && strcmp(jit, "1") == 0 && cpu_set_jit(nes, true) != 0)
+    {
+        nes_exit(nes);
+        return -1;
+    }
+
+    profile_t profile;
+    const char *profile_path = getenv("T_NES_PROFILE");
+    if (profile_path)
+    {
+        profile_reset(&profile);
+        if (nes_set_profile(nes, &profile) != 0)
+        {
+            nes_exit(nes);
+            return -1;
+        }
+    }
+
+    guestprof_t guestprof;
+    const char *guestprof_path = getenv("T_NES_GUESTPROF");
+    if (guestprof_path)
+    {
+        const char *labels = getenv("T_NES_LABELS");
+        if (guestprof_start(&guestprof) != 0 || (labels && guestprof_load_labels(&guestprof, labels) != 0))
+        {
+            nes_exit(nes);
+            return -1;
+        }
+        cpu_set_guestprof(nes, &guestprof);
+    }
+
+    trace_t trace;
+    const bool tracing = argc > 4;
+    if (tracing)
+    {
+        if (trace_start(&trace, argv[4], TRACE_DEFAULT_CAPACITY) != 0)
+        {
+            nes_exit(nes);
+            return -1;
+        }
+        cpu_set_trace(nes, &trace);
+    }
+
+    /// how many actually ran, a run that fails stops short.
+    uint32_t frames_run = 0;
+    int ret = 0;
+
+    const double start = now();
+    for (uint32_t frame = 0; frame < frames; frame++)
+    {
+        uint8_t commands = 0;
+        if (playback)
+        {
+            commands = movie_apply(&movie, nes, frame);
+        }
+        else
+        {
+            input_script_apply(&script, nes, frame);
+        }
+
+        if (record_path && movie_record(&record, nes, commands) != 0)
+        {
+            ret = -1;
+            break;
+        }
+
+        if (nes_run(nes) != 0)
+        {
+            fprintf(stderr, "stopped at frame %u\n", frame);
+            ret = -1;
+            break;
+        }
+        frames_run++;
+    }
+    const double elapsed = now() - start;
+
+    if (tracing)
+    {
+        cpu_set_trace(nes, NULL);
+        trace_stop(&trace);
+    }
+
+    if (profile_path)
+    {
+        nes_set_profile(nes, NULL);
+
+        FILE *fp = fopen(profile_path, "w");
+        if (!fp)
+        {
+            fprintf(stderr, "Failed to open profile: %s\n", profile_path);
+            ret = -1;
+        }
+        else
+        {
+            if (profile_write_csv(&profile, fp) != 0)
+            {
+                ret = -1;
+            }
+            fclose(fp);
+        }
+    }
+
+    if (guestprof_path)
+    {
+        cpu_set_guestprof(nes, NULL);
+        if (write_guestprof(&guestprof, guestprof_path) != 0)
+        {
+            ret = -1;
+        }
+        guestprof_stop(&guestprof);
+    }
+
+    if (record_path)
+    {
+        if (movie_save(&record, record_path) != 0)
+        {
+            ret = -1;
+        }
+    }
+
+    const char *screenshot_path = getenv("T_NES_SCREENSHOT");
+    if (screenshot_path)
+    {
+        if (write_screenshot(&nes->ppu, screenshot_path) != 0)
+        {
+            ret = -1;
+        }
+    }
+
+    const cpu_t *cpu = &nes->cpu;
+    printf("frames: %u time: %.3fs fps: %.2f\n", frames_run, elapsed, frames_run / elapsed);
+    printf("PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%lu count:%lu\n",
+        cpu->reg.PC, cpu->reg.A, cpu->reg.X, cpu->reg.Y, cpu->reg.P, cpu->reg.SP, cpu->cycle_total, cpu->debug.count);
+
+    nes_exit(nes);
+    input_script_free(&script);
+    movie_free(&movie);
+    movie_free(&record);
+
+    return ret;
+}
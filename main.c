@@ -12,16 +12,16 @@ int main(int argc, char **argv)
 {
     printf("t-nes start\n");
 
-    nes_init();
+    nes_t *nes = nes_init();
 
     if (argc > 1)
     {
-        nes_loadrom(argv[1]);
+        nes_loadrom(nes, argv[1]);
     }
 
-    ui();
+    ui(nes);
 
-    nes_exit();
+    nes_exit(nes);
     
     return 0;
 }
\ No newline at end of file
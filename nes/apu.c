@@ -6,56 +6,19 @@
 
 #include "apu.h"
 
-static apu_t *apu = NULL;
-
-const apu_t *apu_init()
-{
-    assert(apu == NULL);
-    if (apu)
-    {
-        fprintf(stderr, "apu already initialised\n");
-        return NULL;
-    }
-
-    apu = malloc(sizeof(apu_t));
-    assert(apu);
-    if (!apu)
-    {
-        fprintf(stderr, "Failed to alloc apu\n");
-        return NULL;
-    }
-    
-    return apu;
-}
-
-void apu_exit()
+int apu_init(apu_t *apu)
 {
-    assert(apu);
-    if (!apu)
-    {
-        fprintf(stderr, "apu not initialised\n");
-        return;
-    }
-
-    free(apu);
-    apu = NULL;
+    memset(apu, 0, sizeof(apu_t));
+    return 0;
 }
 
-int apu_reset()
+int apu_reset(apu_t *apu)
 {
-    assert(apu);
-    if (!apu)
-    {
-        fprintf(stderr, "apu not initialised\n");
-        return -1;
-    }
-
     memset(apu, 0, sizeof(apu_t));
-
     return 0;
 }
 
-uint8_t apu_read_register(uint16_t addr)
+uint8_t apu_read_register(apu_t *apu, uint16_t addr)
 {
     switch (addr)
     {
@@ -108,7 +71,7 @@ uint8_t apu_read_register(uint16_t addr)
     }
 }
 
-void apu_write_register(uint16_t addr, uint8_t v)
+void apu_write_register(apu_t *apu, uint16_t addr, uint8_t v)
 {
     switch (addr)
     {
@@ -161,7 +124,15 @@ void apu_write_register(uint16_t addr, uint8_t v)
     }
 }
 
-int apu_tick()
+int apu_tick(apu_t *apu)
 {
     return 0;
+}
+
+void apu_catch_up(apu_t *apu, uint64_t cpu_cycle)
+{
+    if (apu->cycle_total < cpu_cycle)
+    {
+        apu->cycle_total = cpu_cycle;
+    }
 }
\ No newline at end of file
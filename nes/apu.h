@@ -234,18 +234,23 @@ typedef struct
 typedef struct
 {
     apu_registers_t reg;
+
+    uint64_t cycle_total; /// in cpu cycles.
 } apu_t;
 
 
-const apu_t *apu_init();
-void apu_exit();
+int apu_init(apu_t *apu);
+int apu_reset(apu_t *apu);
 
-int apu_reset();
+uint8_t apu_read_register(apu_t *apu, uint16_t addr);
+void apu_write_register(apu_t *apu, uint16_t addr, uint8_t v);
 
-uint8_t apu_read_register(uint16_t addr);
-void apu_write_register(uint16_t addr, uint8_t v);
+int apu_tick(apu_t *apu);
 
-int apu_tick();
+/// Run the apu until it has caught up to the cpu.
+/// Called when the cpu touches an apu register and at the end of each frame.
+/// The apu has no clocked state yet (channels / frame counter), so this only advances cycle_total.
+void apu_catch_up(apu_t *apu, uint64_t cpu_cycle);
 
 #ifdef __cplusplus
 }
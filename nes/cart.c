@@ -4,72 +4,40 @@
 #include <string.h>
 #include <assert.h>
 
+#include "nes.h"
 #include "cart.h"
 #include "mapper.h"
 #include "util.h"
 
-static cart_t *cart = NULL;
-
 #define HEADER_ID "NES"
 #define HEADER_SIZE sizeof(rom_header_t)
 #define ROM_SIZE_MAX _1MiB
 
-void cart_eject();
-
-const cart_t *cart_init()
+int cart_init(nes_t *nes)
 {
-    assert(cart == NULL);
-    if (cart)
-    {
-        fprintf(stderr, "Cart already initialised\n");
-        return NULL;
-    }
-
-    cart = malloc(sizeof(cart_t));
-    assert(cart);
-    if (!cart)
-    {
-        fprintf(stderr, "Failed to alloc cart\n");
-        return NULL;
-    }
-
-    return cart;
+    memset(&nes->cart, 0, sizeof(cart_t));
+    return 0;
 }
 
-void cart_exit()
+void cart_exit(nes_t *nes)
 {
-    assert(cart);
-    if (!cart)
+    if (nes->cart.loaded == true)
     {
-        fprintf(stderr, "Cart not initialised\n");
-        return;
+        cart_eject(nes);
     }
-
-    if (cart->loaded == true)
-    {
-        cart_eject();
-    }
-
-    free(cart);
-    cart = NULL;
 }
 
-int cart_reset()
+int cart_reset(nes_t *nes)
 {
     /// currently only the mapper in the cart needs to be reset.
     /// I call this in the cart function because the mapper was also set in the cart function.
     /// so it makes sense to also reset it here.
-    return mapper_reset();
+    return mapper_reset(nes);
 }
 
-void cart_eject()
+void cart_eject(nes_t *nes)
 {
-    assert(cart);
-    if (!cart)
-    {
-        fprintf(stderr, "Cart not initialised\n");
-        return;
-    }
+    cart_t *cart = &nes->cart;
 
     assert(cart->loaded);
     if (cart->loaded == true)
@@ -85,14 +53,9 @@ void cart_eject()
     }
 }
 
-int cart_load(const char *path)
+int cart_load(nes_t *nes, const char *path)
 {
-    assert(cart);
-    if (!cart)
-    {
-        fprintf(stderr, "Cart not initialised\n");
-        return -1;
-    }
+    cart_t *cart = &nes->cart;
 
     assert(path);
     if (!path)
@@ -104,11 +67,10 @@ int cart_load(const char *path)
     /// if a previous rom was loaded, remove it.
     if (cart->loaded == true)
     {
-        cart_eject();
+        cart_eject(nes);
     }
 
     FILE *fp = fopen(path, "rb");
-    assert(fp);
     if (!fp)
     {
         fprintf(stderr, "Failed to open rom: %s\n", path);
@@ -146,7 +108,6 @@ int cart_load(const char *path)
 
     /// check if the header is valid.
     bool is_ines = strncmp(header.id, HEADER_ID, 3) == 0;
-    assert(is_ines);
     if (is_ines == false)
     {
         fprintf(stderr, "Not a iNES rom WANT: %s GOT:%s ROM:%s\n", HEADER_ID, header.id, path);
@@ -154,16 +115,17 @@ int cart_load(const char *path)
     }
 
     /// TODO: parse header.
-    printf("\n#### ROM-INFO ####\n");
+    /// to stderr, so it stays out of the tools' results.
+    fprintf(stderr, "\n#### ROM-INFO ####\n");
     {
-        printf("program rom size: %u\n", header.prg_rom_size * _16KB);
-        printf("pattern rom size: %u\n", header.chr_rom_size * _8KB);
-        printf("hw_nametable_type: %u\n", header.flags6.hw_nametable_type);
-        printf("has battery: %s\n", bool_str(header.flags6.battery));
-        printf("has trainer: %s\n", bool_str(header.flags6.trainer));
-        printf("mapper number: %u\n", header.flags6.mapper_number);
+        fprintf(stderr, "program rom size: %u\n", header.prg_rom_size * _16KB);
+        fprintf(stderr, "pattern rom size: %u\n", header.chr_rom_size * _8KB);
+        fprintf(stderr, "hw_nametable_type: %u\n", header.flags6.hw_nametable_type);
+        fprintf(stderr, "has battery: %s\n", bool_str(header.flags6.battery));
+        fprintf(stderr, "has trainer: %s\n", bool_str(header.flags6.trainer));
+        fprintf(stderr, "mapper number: %u\n", header.flags6.mapper_number);
     }
-    printf("#### ROM-END ####\n\n");
+    fprintf(stderr, "#### ROM-END ####\n\n");
 
     /// update rom size now that we have read the header.
     rom_size -= HEADER_SIZE;
@@ -185,8 +147,28 @@ int cart_load(const char *path)
 
     fclose(fp);
 
-    mapper_is_avaliable(header.flags6.mapper_number);
-    
+    if (mapper_is_avaliable(header.flags6.mapper_number) == false)
+    {
+        fprintf(stderr, "mapper %u is not supported %s\n", header.flags6.mapper_number, path);
+        free(rom_data);
+        return -1;
+    }
+
+    /// skip the trainer if there is one, the mapper only wants prg / chr.
+    const uint32_t trainer_size = header.flags6.trainer ? sizeof(trainer_area_t) : 0;
+    if (mapper_set(nes, &header, rom_data + trainer_size, rom_size - trainer_size) != 0)
+    {
+        fprintf(stderr, "Failed to set mapper %s\n", path);
+        free(rom_data);
+        return -1;
+    }
+
+    /// loading over a loaded cart, the mapper has already moved over to the new rom.
+    if (cart->loaded == true)
+    {
+        cart_eject(nes);
+    }
+
     memcpy(&cart->header, &header, HEADER_SIZE);
     cart->rom = rom_data;
     cart->size = rom_size;
@@ -201,8 +183,3 @@ int cart_load(const char *path)
     fclose(fp);
     return -1;
 }
-
-uint8_t cart_read(uint16_t addr)
-{
-    return cart->rom[addr];
-}
\ No newline at end of file
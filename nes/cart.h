@@ -7,6 +7,9 @@ extern "C" {
 #include <stdint.h>
 #include <stdbool.h>
 
+/// Defined in nes.h, every component lives inside of it.
+typedef struct nes nes_t;
+
 typedef enum
 {
     HeaderType_None,
@@ -235,15 +238,13 @@ typedef struct
 } cart_t;
 
 
-const cart_t *cart_init();
-void cart_exit();
-
-int cart_reset();
+int cart_init(nes_t *nes);
+void cart_exit(nes_t *nes);
 
-void cart_eject();
-int cart_load(const char *path);
+int cart_reset(nes_t *nes);
 
-uint8_t cart_read(uint16_t addr);
+void cart_eject(nes_t *nes);
+int cart_load(nes_t *nes, const char *path);
 
 #ifdef __cplusplus
 }
@@ -1,88 +1,247 @@
 #include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
+#include "nes.h"
 #include "cpu.h"
 #include "apu.h"
 #include "ppu.h"
 #include "cart.h"
+#include "mapper.h"
+#include "joypad.h"
 #include "util.h"
+#include "cpu_opcodes.h"
+#include "trace.h"
+#include "guestprof.h"
+#include "jit.h"
 
-static cpu_t *cpu = NULL;
+/// The cpu always lives inside of a nes_t, so the rest of the console can be found from it.
+/// This is only needed on the io path, everything else only touches the cpu.
+static inline nes_t *cpu_nes(cpu_t *cpu)
+{
+    return (nes_t *)((uint8_t *)cpu - offsetof(nes_t, cpu));
+}
+
+_Static_assert(offsetof(cpu_t, jit) + sizeof(jit_t *) <= NES_CACHE_LINE, "cpu_t's hot fields should fit in a cache line");
 
-static inline void tick(uint8_t c)
+static inline void tick(cpu_t *cpu, uint8_t c)
 {
     assert(c > 0);
     cpu->cycle += c;
     cpu->cycle_total += c;
 }
 
-static inline uint8_t read8(uint16_t addr)
+/// Build with -DCPU_LAZY_NZ=0 to write N / Z into reg.P on every op that sets them.
+/// Otherwise only the result is stored (cpu->nz), and N / Z are worked out when something
+/// reads them, which is just the branches and pushing P. Most results are never looked at.
+#ifndef CPU_LAZY_NZ
+    #define CPU_LAZY_NZ 1
+#endif
+
+#if CPU_LAZY_NZ
+static inline void set_nz(cpu_t *cpu, uint8_t r)
 {
-    tick(1);
-    switch (addr)
-    {    
-        case CPUMemMap_ST_Ram ... CPUMemMap_ED_Ram:
-            return cpu->internal_ram[addr];
-        
-        case CPUMemMap_ST_RamMirror ... CPUMemMap_ED_RamMirror:
-            return cpu->internal_ram[addr - (CPUMemMap_ST_RamMirror * (addr % CPUMemMap_ST_RamMirror))];
-        
-        /// ppu reg
-        case CPUMemMap_ST_PPUReg ... CPUMemMap_ED_PPUReg:
-            return ppu_read_register(addr);
+    cpu->nz = r;
+}
+
+/// Z and N from different values, ie BIT.
+static inline void set_z_n(cpu_t *cpu, bool z, uint8_t n)
+{
+    cpu->nz = (z ? 0 : 1) | ((n & BIT7) << 1);
+}
+
+static inline bool flag_Z(const cpu_t *cpu)
+{
+    return (cpu->nz & 0xFF) == 0;
+}
+
+static inline bool flag_N(const cpu_t *cpu)
+{
+    return (cpu->nz & 0x180) != 0;
+}
+
+/// reg.P with N / Z filled in.
+static inline uint8_t get_P(const cpu_t *cpu)
+{
+    return (cpu->reg.P & ~(BIT7 | BIT1)) | (flag_N(cpu) ? BIT7 : 0) | (flag_Z(cpu) ? BIT1 : 0);
+}
+
+/// reg.P -> nz, after P is written (PLP / RTI), or by anything outside of cpu_run().
+static inline void nz_load(cpu_t *cpu)
+{
+    cpu->nz = ((cpu->reg.P & BIT7) << 1) | (~cpu->reg.P & BIT1);
+}
+
+/// nz -> reg.P, before anything outside of cpu_run() can see it.
+static inline void nz_store(cpu_t *cpu)
+{
+    cpu->reg.P = get_P(cpu);
+}
+#else
+static inline void set_nz(cpu_t *cpu, uint8_t r)
+{
+    cpu->reg.status_flag.Z = r == 0;
+    cpu->reg.status_flag.N = RBIT7(r) == 1;
+}
+
+static inline void set_z_n(cpu_t *cpu, bool z, uint8_t n)
+{
+    cpu->reg.status_flag.Z = z;
+    cpu->reg.status_flag.N = RBIT7(n);
+}
+
+static inline bool flag_Z(const cpu_t *cpu)
+{
+    return cpu->reg.status_flag.Z;
+}
+
+static inline bool flag_N(const cpu_t *cpu)
+{
+    return cpu->reg.status_flag.N;
+}
+
+static inline uint8_t get_P(const cpu_t *cpu)
+{
+    return cpu->reg.P;
+}
+
+static inline void nz_load(cpu_t *cpu) {}
+static inline void nz_store(cpu_t *cpu) {}
+#endif
+
+/// Internal ram is mirrored 4 times, so a page of it is decoded / protected at all 4 addresses at once.
+#define RAM_MIRRORS 4
+
+static uint8_t page_aliases(uint8_t page, uint8_t aliases[RAM_MIRRORS])
+{
+    if (page <= (CPUMemMap_ED_RamMirror >> 8))
+    {
+        for (uint8_t i = 0; i < RAM_MIRRORS; i++)
+        {
+            aliases[i] = (page & 0x07) + (i * 0x08);
+        }
+        return RAM_MIRRORS;
+    }
+
+    aliases[0] = page;
+    return 1;
+}
+
+/// Drops everything decoded from this page and puts its memory back in the page table.
+static void release_decoded(cpu_t *cpu, uint8_t page)
+{
+    uint8_t aliases[RAM_MIRRORS];
+    const uint8_t count = page_aliases(page, aliases);
+
+    cpu_decoded_page_t *decoded = cpu->decoded_pages[page];
+    for (uint8_t i = 0; i < count; i++)
+    {
+        const uint8_t alias = aliases[i];
+        cpu->decoded_pages[alias] = NULL;
+        if (cpu->code_pages[alias])
+        {
+            cpu->write_pages[alias] = cpu->code_pages[alias];
+            cpu->code_pages[alias] = NULL;
+        }
+    }
+
+    if (decoded)
+    {
+        decoded->next_free = cpu->decoded_free;
+        cpu->decoded_free = decoded;
+    }
+
+    /// the last idle loop seen could be gone, or anything after a state load.
+    cpu->idle.pc = 0;
+
+    #if CPU_JIT
+    if (cpu->jit)
+    {
+        for (uint8_t i = 0; i < count; i++)
+        {
+            jit_invalidate_page(cpu->jit, aliases[i]);
+        }
+    }
+    #endif
+}
+
+/// A write to memory that has decoded code in it.
+/// Only the instructions that could include this byte are dropped, the page stays protected.
+static void code_write(cpu_t *cpu, uint16_t addr, uint8_t v)
+{
+    cpu->code_pages[addr >> 8][addr & 0xFF] = v;
+
+    cpu_decoded_page_t *decoded = cpu->decoded_pages[addr >> 8];
+    if (decoded)
+    {
+        /// instructions are at most 3 bytes, and ones that cross a page are never decoded.
+        for (int i = addr & 0xFF; i >= 0 && i >= (addr & 0xFF) - 2; i--)
+        {
+            decoded->entries[i].handler = NULL;
+        }
+    }
+}
 
+/// Anything that isn't plain memory in the page table ends up here.
+/// This is only ppu / apu / io registers and whatever the mapper wants to handle itself.
+static uint8_t read8_io(cpu_t *cpu, uint16_t addr)
+{
+    nes_t *nes = cpu_nes(cpu);
+
+    switch (addr)
+    {
         /// ppu reg mirrored...alot
-        case CPUMemMap_ST_PPURegMirror ... CPUMemMap_ED_PPURegMirror:
-            return ppu_read_register(addr - (0x8 * ((addr - CPUMemMap_ST_PPUReg) % 0x8)));
+        case CPUMemMap_ST_PPUReg ... CPUMemMap_ED_PPURegMirror:
+            PROFILE_CALL(nes, ProfileSubsystem_PPU, ppu_catch_up(&nes->ppu, cpu->cycle_total));
+            return ppu_read_register(&nes->ppu, CPUMemMap_ST_PPUReg | (addr & 0x7));
 
         /// sound / joypad / io
         case 0x4000 ... 0x401F:
+            PROFILE_CALL(nes, ProfileSubsystem_PPU, ppu_catch_up(&nes->ppu, cpu->cycle_total));
+            PROFILE_CALL(nes, ProfileSubsystem_APU, apu_catch_up(&nes->apu, cpu->cycle_total));
             switch (addr)
             {
-                case CPURegMemMap_SQ1_VOL:      return apu_read_register(addr);
-                case CPURegMemMap_SQ1_SWEEP:    return apu_read_register(addr);
-                case CPURegMemMap_SQ1_LO:       return apu_read_register(addr);
-                case CPURegMemMap_SQ1_HI:       return apu_read_register(addr);
-                case CPURegMemMap_SQ2_VOL:      return apu_read_register(addr);
-                case CPURegMemMap_SQ2_SWEEP:    return apu_read_register(addr);
-                case CPURegMemMap_SQ2_LO:       return apu_read_register(addr);
-                case CPURegMemMap_SQ2_HI:       return apu_read_register(addr);
-                case CPURegMemMap_TRI_LINEAR:   return apu_read_register(addr);
-                case CPURegMemMap_unused0:      return apu_read_register(addr);
-                case CPURegMemMap_TRI_LO:       return apu_read_register(addr);
-                case CPURegMemMap_TRI_HI:       return apu_read_register(addr);
-                case CPURegMemMap_NOISE_VOL:    return apu_read_register(addr);
-                case CPURegMemMap_unused1:      return apu_read_register(addr);
-                case CPURegMemMap_NOISE_LO:     return apu_read_register(addr);
-                case CPURegMemMap_NOISE_HI:     return apu_read_register(addr);
-                case CPURegMemMap_DMC_FREQ:     return apu_read_register(addr);
-                case CPURegMemMap_DMC_RAW:      return apu_read_register(addr);
-                case CPURegMemMap_DMC_START:    return apu_read_register(addr);
-                case CPURegMemMap_DMC_LEN:      return apu_read_register(addr);
-                case CPURegMemMap_OAMDMA:       return ppu_read_register(addr);
-                case CPURegMemMap_SND_CHN:      return apu_read_register(addr);
-                case CPURegMemMap_JOY1:         return 0; /// joy1
-                case CPURegMemMap_JOY2:         return 0; /// joy2
+                case CPURegMemMap_SQ1_VOL:      return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_SQ1_SWEEP:    return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_SQ1_LO:       return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_SQ1_HI:       return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_SQ2_VOL:      return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_SQ2_SWEEP:    return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_SQ2_LO:       return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_SQ2_HI:       return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_TRI_LINEAR:   return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_unused0:      return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_TRI_LO:       return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_TRI_HI:       return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_NOISE_VOL:    return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_unused1:      return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_NOISE_LO:     return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_NOISE_HI:     return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_DMC_FREQ:     return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_DMC_RAW:      return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_DMC_START:    return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_DMC_LEN:      return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_OAMDMA:       return ppu_read_register(&nes->ppu, addr);
+                case CPURegMemMap_SND_CHN:      return apu_read_register(&nes->apu, addr);
+                case CPURegMemMap_JOY1:         return joypad_read(&nes->joypad, 0);
+                case CPURegMemMap_JOY2:         return joypad_read(&nes->joypad, 1);
                 default:
                     fprintf(stderr, "READING UNSUED MEM MAPPED REGISTERS 0x%04X\n", addr);
                     assert(0);
+                    return 0;
             }
 
-        /// cart prg-ram OR prg-rom
-        //case 0x6000 ... 0x7FFF:
-            //return cart_read(addr - 0x6000);
-
-        /// first 16kb of cart mem.
-        case 0x8000 ... 0xBFFF:
-            return cart_read(addr - 0x8000);
-
-        /// last 16kb of cart mem OR mirror of first 16kb cart mem if cart is 16kb.
-        case 0xC000 ... 0xFFFF:
-            return cart_read(addr - 0xC000);
+        /// cart prg-ram, prg-rom or mapper registers that the mapper didn't put in the page table.
+        case 0x4020 ... 0xFFFF:
+        {
+            uint8_t v = 0;
+            PROFILE_CALL(nes, ProfileSubsystem_Mapper, v = mapper_read(nes, addr));
+            return v;
+        }
 
         default:
             fprintf(stderr, "UNKOWN READ MEM ADDRESS 0x%X\n", addr);
@@ -91,72 +250,102 @@ static inline uint8_t read8(uint16_t addr)
     }
 }
 
-static inline uint16_t read16(uint16_t addr)
+/// Cycles the cpu is stalled for by oam dma, a read and a write per byte plus one to get in step.
+/// One more if it starts on an odd cycle.
+#define OAM_DMA_CYCLES 513
+
+/// $4014, copies the page to oam while the cpu waits.
+static void oam_dma(cpu_t *cpu, uint8_t page)
 {
-    return (read8(addr)) | (read8(addr + 1) << 8); 
+    nes_t *nes = cpu_nes(cpu);
+
+    const uint8_t *data = cpu->read_pages[page];
+    uint8_t buf[0x100];
+    if (!data)
+    {
+        for (uint32_t i = 0; i < sizeof(buf); i++)
+        {
+            buf[i] = read8_io(cpu, (page << 8) | i);
+        }
+        data = buf;
+    }
+
+    ppu_write_register(&nes->ppu, CPURegMemMap_OAMDMA, page);
+    ppu_oam_dma(&nes->ppu, data);
+
+    const uint32_t stall = OAM_DMA_CYCLES + (cpu->cycle_total & 1);
+    cpu->cycle += stall;
+    cpu->cycle_total += stall;
+
+    /// the stall can go past the deadline / the next ppu event, so stop the run (and any jit block) here.
+    cpu->cycle_deadline = cpu->cycle_total;
 }
 
-static inline void write8(uint16_t addr, uint8_t v)
+static void write8_io(cpu_t *cpu, uint16_t addr, uint8_t v)
 {
-    tick(1);
-    switch (addr)
+    nes_t *nes = cpu_nes(cpu);
+
+    /// memory with decoded code in it, see decode().
+    if (cpu->code_pages[addr >> 8])
     {
-        case CPUMemMap_ST_Ram ... CPUMemMap_ED_Ram:
-            cpu->internal_ram[addr] = v;
-            break;
-        
-        case CPUMemMap_ST_RamMirror ... CPUMemMap_ED_RamMirror:
-            cpu->internal_ram[addr - (CPUMemMap_ST_RamMirror * (addr % CPUMemMap_ST_RamMirror))] = v;
-            break;
-        
-        /// ppu reg
-        case CPUMemMap_ST_PPUReg ... CPUMemMap_ED_PPUReg:
-            ppu_write_register(addr, v);
-            break;
+        code_write(cpu, addr, v);
+        return;
+    }
 
+    switch (addr)
+    {
         /// ppu reg mirrored...alot
-        case CPUMemMap_ST_PPURegMirror ... CPUMemMap_ED_PPURegMirror:
-            ppu_write_register(addr - (0x8 * ((addr - CPUMemMap_ST_PPUReg) % 0x8)), v);
+        case CPUMemMap_ST_PPUReg ... CPUMemMap_ED_PPURegMirror:
+            PROFILE_CALL(nes, ProfileSubsystem_PPU, ppu_catch_up(&nes->ppu, cpu->cycle_total));
+            ppu_write_register(&nes->ppu, CPUMemMap_ST_PPUReg | (addr & 0x7), v);
+
+            /// enabling nmi in vblank fires straight away, so stop the current run here.
+            if (ppu_nmi_pending(&nes->ppu))
+            {
+                cpu->cycle_deadline = cpu->cycle_total;
+            }
             break;
 
         /// sound / joypad / io
         case 0x4000 ... 0x401F:
+            PROFILE_CALL(nes, ProfileSubsystem_PPU, ppu_catch_up(&nes->ppu, cpu->cycle_total));
+            PROFILE_CALL(nes, ProfileSubsystem_APU, apu_catch_up(&nes->apu, cpu->cycle_total));
             switch (addr)
             {
-                case CPURegMemMap_SQ1_VOL:      apu_write_register(addr, v);    break;
-                case CPURegMemMap_SQ1_SWEEP:    apu_write_register(addr, v);    break;
-                case CPURegMemMap_SQ1_LO:       apu_write_register(addr, v);    break;
-                case CPURegMemMap_SQ1_HI:       apu_write_register(addr, v);    break;
-                case CPURegMemMap_SQ2_VOL:      apu_write_register(addr, v);    break;
-                case CPURegMemMap_SQ2_SWEEP:    apu_write_register(addr, v);    break;
-                case CPURegMemMap_SQ2_LO:       apu_write_register(addr, v);    break;
-                case CPURegMemMap_SQ2_HI:       apu_write_register(addr, v);    break;
-                case CPURegMemMap_TRI_LINEAR:   apu_write_register(addr, v);    break;
-                case CPURegMemMap_unused0:      apu_write_register(addr, v);    break;
-                case CPURegMemMap_TRI_LO:       apu_write_register(addr, v);    break;
-                case CPURegMemMap_TRI_HI:       apu_write_register(addr, v);    break;
-                case CPURegMemMap_NOISE_VOL:    apu_write_register(addr, v);    break;
-                case CPURegMemMap_unused1:      apu_write_register(addr, v);    break;
-                case CPURegMemMap_NOISE_LO:     apu_write_register(addr, v);    break;
-                case CPURegMemMap_NOISE_HI:     apu_write_register(addr, v);    break;
-                case CPURegMemMap_DMC_FREQ:     apu_write_register(addr, v);    break;
-                case CPURegMemMap_DMC_RAW:      apu_write_register(addr, v);    break;
-                case CPURegMemMap_DMC_START:    apu_write_register(addr, v);    break;
-                case CPURegMemMap_DMC_LEN:      apu_write_register(addr, v);    break;
-                case CPURegMemMap_OAMDMA:       ppu_write_register(addr, v);    break;
-                case CPURegMemMap_SND_CHN:      apu_write_register(addr, v);    break;
-                case CPURegMemMap_JOY1:         assert(0); break; /// joystick strobe.
-                case CPURegMemMap_JOY2:         apu_write_register(addr, v);    break;
+                case CPURegMemMap_SQ1_VOL:      apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_SQ1_SWEEP:    apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_SQ1_LO:       apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_SQ1_HI:       apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_SQ2_VOL:      apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_SQ2_SWEEP:    apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_SQ2_LO:       apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_SQ2_HI:       apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_TRI_LINEAR:   apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_unused0:      apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_TRI_LO:       apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_TRI_HI:       apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_NOISE_VOL:    apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_unused1:      apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_NOISE_LO:     apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_NOISE_HI:     apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_DMC_FREQ:     apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_DMC_RAW:      apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_DMC_START:    apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_DMC_LEN:      apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_OAMDMA:       oam_dma(cpu, v);    break;
+                case CPURegMemMap_SND_CHN:      apu_write_register(&nes->apu, addr, v);    break;
+                case CPURegMemMap_JOY1:         joypad_write(&nes->joypad, v); break; /// joystick strobe.
+                case CPURegMemMap_JOY2:         apu_write_register(&nes->apu, addr, v);    break;
                 default:
                     fprintf(stderr, "READING UNSUED MEM MAPPED REGISTERS 0x%04X\n", addr);
                     assert(0);
                     break;
             }
+            break;
 
-        /// cart READ ONLY
-        case 0x6000 ... 0xFFFF:
-            fprintf(stderr, "Trying to write to ROM cart: 0x%X\n", addr);
-            assert(0);
+        /// cart prg-ram or mapper registers, writes here are how the mapper switches banks.
+        case 0x4020 ... 0xFFFF:
+            PROFILE_CALL(nes, ProfileSubsystem_Mapper, mapper_write(nes, addr, v));
             break;
 
         default:
@@ -166,62 +355,114 @@ static inline void write8(uint16_t addr, uint8_t v)
     }
 }
 
-static inline void write16(uint16_t addr, uint16_t v)
+/// The common case (ram / prg-rom) is a single load from the page table.
+/// Only pages with no entry go through the io handlers.
+#if NES_PROFILE
+static inline void profile_bus(cpu_t *cpu, uint16_t addr, bool write)
 {
-    /// LSB first then MSB.
-    write8(addr, v & 0xFF);
-    write8(addr + 1, v >> 8);
+    profile_t *profile = cpu_nes(cpu)->profile;
+    if (profile)
+    {
+        (write ? profile->writes : profile->reads)[profile_region(addr)]++;
+    }
 }
+#endif
 
-const cpu_t *cpu_init()
+static inline uint8_t read8(cpu_t *cpu, uint16_t addr)
 {
-    assert(cpu == NULL);
-    if (cpu)
+    tick(cpu, 1);
+    #if NES_PROFILE
+    profile_bus(cpu, addr, false);
+    #endif
+    const uint8_t *page = cpu->read_pages[addr >> 8];
+    if (page)
     {
-        fprintf(stderr, "cpu already initialised\n");
-        return NULL;
+        return page[addr & 0xFF];
     }
+    return read8_io(cpu, addr);
+}
+
+static inline uint16_t read16(cpu_t *cpu, uint16_t addr)
+{
+    return (read8(cpu, addr)) | (read8(cpu, addr + 1) << 8); 
+}
 
-    cpu = malloc(sizeof(cpu_t));
-    assert(cpu);
-    if (!cpu)
+static inline void write8(cpu_t *cpu, uint16_t addr, uint8_t v)
+{
+    tick(cpu, 1);
+    #if NES_PROFILE
+    profile_bus(cpu, addr, true);
+    #endif
+    uint8_t *page = cpu->write_pages[addr >> 8];
+    if (page)
     {
-        fprintf(stderr, "Failed to alloc cpu\n");
-        return NULL;
+        page[addr & 0xFF] = v;
+        return;
     }
+    write8_io(cpu, addr, v);
+}
+
+uint8_t cpu_read8_io(cpu_t *cpu, uint16_t addr)
+{
+    return read8_io(cpu, addr);
+}
+
+void cpu_write8_io(cpu_t *cpu, uint16_t addr, uint8_t v)
+{
+    write8_io(cpu, addr, v);
+}
 
-    return cpu;
+static inline void write16(cpu_t *cpu, uint16_t addr, uint16_t v)
+{
+    /// LSB first then MSB.
+    write8(cpu, addr, v & 0xFF);
+    write8(cpu, addr + 1, v >> 8);
 }
 
-void cpu_exit()
+int cpu_init(nes_t *nes)
 {
-    assert(cpu);
-    if (!cpu)
+    cpu_t *cpu = &nes->cpu;
+
+    memset(cpu, 0, sizeof(cpu_t));
+
+    cpu->idle.enabled = true;
+
+    /// 2KiB of ram, mirrored 4 times up to 0x1FFF.
+    for (uint16_t addr = CPUMemMap_ST_Ram; addr < CPUMemMap_ED_RamMirror; addr += CPUMemMap_ST_RamMirror)
     {
-        fprintf(stderr, "cpu not initialised\n");
-        return;
+        cpu_map_pages(nes, addr, sizeof(cpu->internal_ram), cpu->internal_ram, true);
     }
 
-    free(cpu);
-    cpu = NULL;
+    return 0;
 }
 
-int cpu_reset()
+void cpu_exit(nes_t *nes)
 {
-    assert(cpu);
-    if (!cpu)
+    cpu_t *cpu = &nes->cpu;
+
+    cpu_set_jit(nes, false);
+    cpu_invalidate_decoded(nes);
+
+    while (cpu->decoded_free)
     {
-        fprintf(stderr, "cpu not initialised\n");
-        return -1;
+        cpu_decoded_page_t *next = cpu->decoded_free->next_free;
+        free(cpu->decoded_free);
+        cpu->decoded_free = next;
     }
+}
+
+int cpu_reset(nes_t *nes)
+{
+    cpu_t *cpu = &nes->cpu;
 
     /// TODO: check what other valus need to be set upon reset.
     cpu->reg.status_flag.I = true;
     cpu->reg.status_flag.U = true;
+    nz_load(cpu);
 
     /// Set registers.
     cpu->reg.SP -= 3;
-    cpu->reg.PC = read16(0xFFFC);
+    cpu->reg.PC = read16(cpu, 0xFFFC);
 
     /// misc.
     cpu->oprand = 0;
@@ -232,136 +473,336 @@ int cpu_reset()
     return 0;
 }
 
-int cpu_power_up()
+int cpu_power_up(nes_t *nes)
 {
-    assert(cpu);
-    if (!cpu)
-    {
-        fprintf(stderr, "cpu not initialised\n");
-        return -1;
-    }
+    cpu_t *cpu = &nes->cpu;
 
     /// Set status flags.
     cpu->reg.status_flag.I = true;
     cpu->reg.status_flag.D = false;
     cpu->reg.status_flag.U = true;
+    nz_load(cpu);
 
     /// Set registers.
     cpu->reg.A = false;
     cpu->reg.X = false;
     cpu->reg.Y = false;
     cpu->reg.SP = 0xFD;
-    cpu->reg.PC = read16(0xFFFC);
+    cpu->reg.PC = read16(cpu, 0xFFFC);
 
     /// misc.
     cpu->oprand = 0;
     cpu->opcode = 0;
     cpu->cycle = 0;
+    cpu->cycle_total = 0;
+    cpu->cycle_deadline = 0;
     cpu->debug.count = 0;
 
-    #if 0
-    /// This is for nestest auto.
-    cpu->reg.status_flag.D = true;
-    cpu->cycle = 7;
+    return 0;
+}
+
+void cpu_nestest_auto(nes_t *nes)
+{
+    cpu_t *cpu = &nes->cpu;
+
+    /// nestest.log starts at the automation entry point, after the 7 cycle reset sequence.
     cpu->reg.PC = 0xC000;
-    #endif
+    cpu->cycle = 7;
+    cpu->cycle_total = 7;
+}
 
-    return 0;
+void cpu_reset_cycle(nes_t *nes)
+{
+    nes->cpu.cycle = 0;
 }
 
-void cpu_reset_cycle()
+void cpu_map_pages(nes_t *nes, uint16_t addr, uint32_t size, uint8_t *mem, bool writable)
 {
-    cpu->cycle = 0;
+    assert((addr & 0xFF) == 0 && (size & 0xFF) == 0);
+    assert(addr + size <= 0x10000);
+
+    cpu_t *cpu = &nes->cpu;
+
+    for (uint32_t offset = 0; offset < size; offset += CPU_PAGE_SIZE)
+    {
+        const uint8_t page = (addr + offset) >> 8;
+
+        /// mapped again as it already is (a remap after a state load), what was decoded from it still holds.
+        /// A writable page with decoded code has its memory in code_pages rather than write_pages.
+        uint8_t *const write = writable ? mem + offset : NULL;
+        if (cpu->read_pages[page] == mem + offset && (cpu->code_pages[page] ? cpu->code_pages[page] : cpu->write_pages[page]) == write)
+        {
+            continue;
+        }
+
+        release_decoded(cpu, page);
+        cpu->read_pages[page] = mem + offset;
+        cpu->write_pages[page] = write;
+    }
+}
+
+void cpu_unmap_pages(nes_t *nes, uint16_t addr, uint32_t size)
+{
+    assert((addr & 0xFF) == 0 && (size & 0xFF) == 0);
+    assert(addr + size <= 0x10000);
+
+    cpu_t *cpu = &nes->cpu;
+
+    for (uint32_t offset = 0; offset < size; offset += CPU_PAGE_SIZE)
+    {
+        const uint8_t page = (addr + offset) >> 8;
+        release_decoded(cpu, page);
+        cpu->read_pages[page] = NULL;
+        cpu->write_pages[page] = NULL;
+    }
 }
 
-static inline void page_cross(uint16_t a, uint16_t b)
+void cpu_invalidate_decoded(nes_t *nes)
 {
-    if ((a & 0x0F00) != (b & 0x0F00)) tick(1);
+    for (uint32_t page = 0; page < CPU_PAGE_COUNT; page++)
+    {
+        release_decoded(&nes->cpu, page);
+    }
+}
+
+void cpu_invalidate_writable_decoded(nes_t *nes)
+{
+    cpu_t *cpu = &nes->cpu;
+
+    /// only writable pages with decoded code are in code_pages.
+    for (uint32_t page = 0; page < CPU_PAGE_COUNT; page++)
+    {
+        if (cpu->code_pages[page])
+        {
+            release_decoded(cpu, page);
+        }
+    }
+
+    /// the last idle loop seen is from before the load.
+    cpu->idle.pc = 0;
+}
+
+static inline void page_cross(cpu_t *cpu, uint16_t a, uint16_t b)
+{
+    if ((a & 0x0F00) != (b & 0x0F00)) tick(cpu, 1);
 }
 
 /// https://youtu.be/fWqBmmPQP40?t=556
 /// http://archive.6502.org/books/mcs6500_family_hardware_manual.pdf
-static inline void addressing(AddrType type)
+/// Each addressing mode is its own function so that the opcode handlers can call
+/// the mode directly, letting the operand fetch inline into the op.
+
+/// The oprand is either reg A or not needed.
+static inline void addr_Acc(cpu_t *cpu)
+{
+    tick(cpu, 1);
+}
+
+static inline void addr_Imp(cpu_t *cpu)
+{
+}
+
+static inline void addr_Rel(cpu_t *cpu)
+{
+    cpu->oprand = cpu->reg.PC++;
+}
+
+static inline void addr_Imm(cpu_t *cpu)
+{
+    cpu->oprand = cpu->reg.PC++;
+}
+
+static inline void addr_Abs(cpu_t *cpu)
+{
+    cpu->oprand = read16(cpu, cpu->reg.PC);
+    cpu->reg.PC += 2;
+}
+
+/// Extra clock cycle if page crossed.
+static inline void addr_AbsX(cpu_t *cpu)
+{
+    page_cross(cpu, cpu->reg.PC, cpu->reg.PC + cpu->reg.X);
+    cpu->oprand = read16(cpu, cpu->reg.PC) + cpu->reg.X;
+    cpu->reg.PC += 2;
+}
+
+static inline void addr_AbsY(cpu_t *cpu)
+{
+    page_cross(cpu, cpu->reg.PC, cpu->reg.PC + cpu->reg.Y);
+    cpu->oprand = read16(cpu, cpu->reg.PC) + cpu->reg.Y;
+    cpu->reg.PC += 2;
+}
+
+/// Zero page can only pull values between 0x00 - 0xFF.
+/// if the value is 0xFF >, then it wraps around.
+/// 2 + 0xFF = 0x01.
+/// The easy way to do this is to just cast the return value as a uint8_t.
+/// this will handle everything automatically.
+/// another way is to do % 256.
+/// that's probably(?) slower than a cast, and less obvious to me.
+static inline void addr_ZP(cpu_t *cpu)
+{
+    cpu->oprand = read8(cpu, cpu->reg.PC++);
+}
+
+static inline void addr_ZPX(cpu_t *cpu)
+{
+    cpu->oprand = (uint8_t)(read8(cpu, cpu->reg.PC++) + cpu->reg.X);
+}
+
+static inline void addr_ZPY(cpu_t *cpu)
+{
+    cpu->oprand = (uint8_t)(read8(cpu, cpu->reg.PC++) + cpu->reg.Y);
+}
+
+static inline void addr_Ind(cpu_t *cpu)
+{
+    cpu->oprand = read16(cpu, cpu->reg.PC);
+    cpu->reg.PC += 2;
+    /// Due to a bug in the 6502 (fixed in CMOS), if the jmp oprand is 0xxxFF,
+    /// this will cause the MSB to be read from 0xx00.
+    /// so we mask 0xFFxx and read from there...
+    cpu->oprand = (cpu->oprand & 0xFF) == 0xFF ? (read8(cpu, cpu->oprand & 0xFF00) << 8) | read8(cpu, cpu->oprand) : read16(cpu, cpu->oprand);
+}
+
+static inline void addr_IndZPX(cpu_t *cpu)
+{
+    cpu->oprand = read8(cpu, cpu->reg.PC++);
+    cpu->oprand = (read8(cpu, (uint8_t)(cpu->oprand + cpu->reg.X + 1)) << 8) | read8(cpu, (uint8_t)(cpu->oprand + cpu->reg.X));
+    tick(cpu, 2);
+}
+
+// Different to indirectX in that it does the lookup first, then adds Y.
+static inline void addr_IndZPY(cpu_t *cpu)
+{
+    cpu->oprand = read8(cpu, cpu->reg.PC++);
+    cpu->oprand = ((read8(cpu, (uint8_t)(cpu->oprand + 1)) << 8) | read8(cpu, cpu->oprand)) + cpu->reg.Y;
+    tick(cpu, 2);
+}
+
+/// Runtime version of the above, only used when built with CPU_ADDRESSING_RUNTIME.
+static inline void addressing(cpu_t *cpu, AddrType type)
 {
     switch (type)
     {
-        /// The oprand is either reg A or not needed.
-        case AddrType_Acc:
-            tick(1);
-            break;
-        case AddrType_Imp:
-            break;
-
-        case AddrType_Rel:
-            cpu->oprand = cpu->reg.PC++;
-            break;
-        case AddrType_Imm:
-            cpu->oprand = cpu->reg.PC++;
-            break;
+        case AddrType_Acc:      addr_Acc(cpu);     break;
+        case AddrType_Imp:      addr_Imp(cpu);     break;
+        case AddrType_Rel:      addr_Rel(cpu);     break;
+        case AddrType_Imm:      addr_Imm(cpu);     break;
+        case AddrType_Abs:      addr_Abs(cpu);     break;
+        case AddrType_AbsX:     addr_AbsX(cpu);    break;
+        case AddrType_AbsY:     addr_AbsY(cpu);    break;
+        case AddrType_ZP:       addr_ZP(cpu);      break;
+        case AddrType_ZPX:      addr_ZPX(cpu);     break;
+        case AddrType_ZPY:      addr_ZPY(cpu);     break;
+        case AddrType_Ind:      addr_Ind(cpu);     break;
+        case AddrType_IndZPX:   addr_IndZPX(cpu);  break;
+        case AddrType_IndZPY:   addr_IndZPY(cpu);  break;
         
-        case AddrType_Abs:
-            cpu->oprand = read16(cpu->reg.PC);
-            cpu->reg.PC += 2;
-            break;
-        
-        /// Extra clock cycle if page crossed.
-        case AddrType_AbsX:
-            page_cross(cpu->reg.PC, cpu->reg.PC + cpu->reg.X);
-            cpu->oprand = read16(cpu->reg.PC) + cpu->reg.X;
-            cpu->reg.PC += 2;
-            break;
-        case AddrType_AbsY:
-            page_cross(cpu->reg.PC, cpu->reg.PC + cpu->reg.Y);
-            cpu->oprand = read16(cpu->reg.PC) + cpu->reg.Y;
-            cpu->reg.PC += 2;
-            break;
+        default:
+            fprintf(stderr, "INCORRECT ADDRESS TYPE: %u", type);
+            assert(0);
+    }
+}
 
-        /// Zero page can only pull values between 0x00 - 0xFF.
-        /// if the value is 0xFF >, then it wraps around.
-        /// 2 + 0xFF = 0x01.
-        /// The easy way to do this is to just cast the return value as a uint8_t.
-        /// this will handle everything automatically.
-        /// another way is to do % 256.
-        /// that's probably(?) slower than a cast, and less obvious to me.
-        case AddrType_ZP:
-            cpu->oprand = read8(cpu->reg.PC++);
-            break;
-        case AddrType_ZPX:
-            cpu->oprand = (uint8_t)(read8(cpu->reg.PC++) + cpu->reg.X);
-            break;
-        case AddrType_ZPY:
-            cpu->oprand = (uint8_t)(read8(cpu->reg.PC++) + cpu->reg.Y);
-            break;
+/// The same modes for an already decoded instruction.
+/// PC has already been moved past the instruction, and the operand bytes are passed in.
+/// The cycles for fetching them are ticked by the handler, see CPU_FETCH_CYCLES_*.
+static inline void addr_decoded_Acc(cpu_t *cpu, uint16_t operand)
+{
+    tick(cpu, 1);
+}
+
+static inline void addr_decoded_Imp(cpu_t *cpu, uint16_t operand)
+{
+}
+
+static inline void addr_decoded_Rel(cpu_t *cpu, uint16_t operand)
+{
+    cpu->oprand = cpu->reg.PC - 1;
+}
+
+static inline void addr_decoded_Imm(cpu_t *cpu, uint16_t operand)
+{
+    cpu->oprand = cpu->reg.PC - 1;
+}
+
+static inline void addr_decoded_Abs(cpu_t *cpu, uint16_t operand)
+{
+    cpu->oprand = operand;
+}
+
+static inline void addr_decoded_AbsX(cpu_t *cpu, uint16_t operand)
+{
+    page_cross(cpu, cpu->reg.PC - 2, cpu->reg.PC - 2 + cpu->reg.X);
+    cpu->oprand = operand + cpu->reg.X;
+}
+
+static inline void addr_decoded_AbsY(cpu_t *cpu, uint16_t operand)
+{
+    page_cross(cpu, cpu->reg.PC - 2, cpu->reg.PC - 2 + cpu->reg.Y);
+    cpu->oprand = operand + cpu->reg.Y;
+}
+
+static inline void addr_decoded_ZP(cpu_t *cpu, uint16_t operand)
+{
+    cpu->oprand = operand;
+}
+
+static inline void addr_decoded_ZPX(cpu_t *cpu, uint16_t operand)
+{
+    cpu->oprand = (uint8_t)(operand + cpu->reg.X);
+}
+
+static inline void addr_decoded_ZPY(cpu_t *cpu, uint16_t operand)
+{
+    cpu->oprand = (uint8_t)(operand + cpu->reg.Y);
+}
+
+static inline void addr_decoded_Ind(cpu_t *cpu, uint16_t operand)
+{
+    cpu->oprand = (operand & 0xFF) == 0xFF ? (read8(cpu, operand & 0xFF00) << 8) | read8(cpu, operand) : read16(cpu, operand);
+}
 
-        case AddrType_Ind:
-            cpu->oprand = read16(cpu->reg.PC);
-            cpu->reg.PC += 2;
-            /// Due to a bug in the 6502 (fixed in CMOS), if the jmp oprand is 0xxxFF,
-            /// this will cause the MSB to be read from 0xx00.
-            /// so we mask 0xFFxx and read from there...
-            cpu->oprand = (cpu->oprand & 0xFF) == 0xFF ? (read8(cpu->oprand & 0xFF00) << 8) | read8(cpu->oprand) : read16(cpu->oprand);
-            break;
+static inline void addr_decoded_IndZPX(cpu_t *cpu, uint16_t operand)
+{
+    cpu->oprand = (read8(cpu, (uint8_t)(operand + cpu->reg.X + 1)) << 8) | read8(cpu, (uint8_t)(operand + cpu->reg.X));
+    tick(cpu, 2);
+}
 
-        case AddrType_IndZPX:
-            cpu->oprand = read8(cpu->reg.PC++);
-            cpu->oprand = (read8((uint8_t)(cpu->oprand + cpu->reg.X + 1)) << 8) | read8((uint8_t)(cpu->oprand + cpu->reg.X));
-            tick(2);
-            break;
+static inline void addr_decoded_IndZPY(cpu_t *cpu, uint16_t operand)
+{
+    cpu->oprand = ((read8(cpu, (uint8_t)(operand + 1)) << 8) | read8(cpu, operand)) + cpu->reg.Y;
+    tick(cpu, 2);
+}
 
-        // Different to indirectX in that it does the lookup first, then adds Y.
-        case AddrType_IndZPY:
-            cpu->oprand = read8(cpu->reg.PC++);
-            cpu->oprand = ((read8((uint8_t)(cpu->oprand + 1)) << 8) | read8(cpu->oprand)) + cpu->reg.Y;
-            tick(2);
-            break;
-        
+/// Instruction length and the cycles the addr_*() function spends reading the operand.
+static inline uint8_t mode_length(AddrType type)
+{
+    switch (type)
+    {
+        case AddrType_Acc: case AddrType_Imp:
+            return 1;
+        case AddrType_Abs: case AddrType_AbsX: case AddrType_AbsY: case AddrType_Ind:
+            return 3;
         default:
-            fprintf(stderr, "INCORRECT ADDRESS TYPE: %u", type);
-            assert(0);
+            return 2;
+    }
+}
+
+static inline uint8_t mode_fetch_cycles(AddrType type)
+{
+    switch (type)
+    {
+        /// the operand of these is read by the instruction itself.
+        case AddrType_Rel: case AddrType_Imm:
+            return 0;
+        default:
+            return mode_length(type) - 1;
     }
 }
 
-static inline void NIP()
+static inline void NIP(cpu_t *cpu)
 {
     fprintf(stderr, "NOT IMPLEMENTED opcode: 0x%X PC: 0x%X\n", cpu->opcode, cpu->reg.PC);
     assert(0);
@@ -371,7 +812,7 @@ static inline void NIP()
 /*
 *   ALU. 
 */
-static inline void __ADC_SBC(uint8_t v)
+static inline void __ADC_SBC(cpu_t *cpu, uint8_t v)
 {
     uint8_t old_carry_flag = cpu->reg.status_flag.C;
     uint8_t old_a_value = cpu->reg.A;
@@ -386,75 +827,70 @@ static inline void __ADC_SBC(uint8_t v)
     //if (cpu->reg.status_flag.D == 0)
     {
         cpu->reg.status_flag.V = ((old_a_value ^ cpu->reg.A) & (v ^ cpu->reg.A) & BIT7) > 0;
-        cpu->reg.status_flag.Z = cpu->reg.A == 0;
-        cpu->reg.status_flag.N = RBIT7(cpu->reg.A) == 1;
+        set_nz(cpu, cpu->reg.A);
     }
 
-    tick(1);
+    tick(cpu, 1);
 }
 
-static inline void ADC()
+static inline void ADC(cpu_t *cpu)
 {
-    __ADC_SBC(read8(cpu->oprand));
+    __ADC_SBC(cpu, read8(cpu, cpu->oprand));
 }
 
-static inline void SBC()
+static inline void SBC(cpu_t *cpu)
 {
     /// Comp the value for the reverse *big brain*
-    __ADC_SBC(~read8(cpu->oprand));
+    __ADC_SBC(cpu, ~read8(cpu, cpu->oprand));
 }
 
-static inline void AND()
+static inline void AND(cpu_t *cpu)
 {
-    cpu->reg.A &= read8(cpu->oprand);
+    cpu->reg.A &= read8(cpu, cpu->oprand);
 
-    cpu->reg.status_flag.Z = cpu->reg.A == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.A) == 1;
+    set_nz(cpu, cpu->reg.A);
 
-    tick(1);
+    tick(cpu, 1);
 }
 
-static inline void ASL_A()
+static inline void ASL_A(cpu_t *cpu)
 {
     cpu->reg.status_flag.C = RBIT7(cpu->reg.A);
 
     cpu->reg.A <<= 1;
 
-    cpu->reg.status_flag.Z = cpu->reg.A == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.A) == 1;
+    set_nz(cpu, cpu->reg.A);
 
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void ASL()
+static inline void ASL(cpu_t *cpu)
 {
-    uint8_t v = read8(cpu->oprand);
+    uint8_t v = read8(cpu, cpu->oprand);
     uint8_t r = v << 1;
 
-    write8(cpu->oprand, r);
+    write8(cpu, cpu->oprand, r);
 
     /// http://www.obelisk.me.uk/6502/reference.html#ASL
     /// this incorrectly states that Z is set if A == 0.
     /// however it is set is the result == 0.
     cpu->reg.status_flag.C = RBIT7(v);
-    cpu->reg.status_flag.Z = r == 0; 
-    cpu->reg.status_flag.N = RBIT7(r) == 1;
+    set_nz(cpu, r);
 
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void BIT()
+static inline void BIT(cpu_t *cpu)
 {
-    uint8_t v = read8(cpu->oprand);
+    uint8_t v = read8(cpu, cpu->oprand);
 
-    cpu->reg.status_flag.Z = (cpu->reg.A & v) == 0;
     cpu->reg.status_flag.V = RBIT6(v) & 1;
-    cpu->reg.status_flag.N = RBIT7(v);
+    set_z_n(cpu, (cpu->reg.A & v) == 0, v);
 
-    tick(1);
+    tick(cpu, 1);
 }
 
-static inline void BRK()
+static inline void BRK(cpu_t *cpu)
 {
     /// TODO: Finish this op.
     /// update tick count after finishing also.
@@ -462,9 +898,120 @@ static inline void BRK()
     cpu->reg.status_flag.B = true;
     assert(0);
 
-    tick(7);
+    tick(cpu, 7);
+}
+
+
+/*
+*   Idle loops.
+*/
+/// Build with -DCPU_IDLE_SKIP=0 to never skip idle loops, see cpu_set_idle_skip().
+#ifndef CPU_IDLE_SKIP
+    #define CPU_IDLE_SKIP 1
+#endif
+
+/// Longest loop, in bytes, that is checked.
+#define CPU_IDLE_MAX_BYTES 16
+
+/// Ram only changes when the cpu writes it (ie from the nmi handler), and ppustatus only on a ppu event.
+static bool idle_read(uint16_t addr)
+{
+    return addr <= CPUMemMap_ED_RamMirror ||
+        (addr <= CPUMemMap_ED_PPURegMirror && (addr & 0x7) == (PPURegisterAddr_PPUSTATUS & 0x7));
+}
+
+uint8_t cpu_idle_loop(const cpu_t *cpu, uint16_t target, uint16_t pc)
+{
+    const uint8_t page = pc >> 8;
+    const uint8_t *mem = cpu->read_pages[page];
+
+    /// rom only, so the loop can't change under us, and all in one page.
+    if (!mem || cpu->write_pages[page] || cpu->code_pages[page] ||
+        (target >> 8) != page || target > pc || pc - target > CPU_IDLE_MAX_BYTES)
+    {
+        return 0;
+    }
+
+    /// everything before the branch only loads / compares, so once it has gone round
+    /// once, going round again with the same memory gives the same registers.
+    uint8_t instructions = 0;
+    uint8_t flags = 0;
+    uint16_t at = target;
+    while (at < pc)
+    {
+        const uint8_t *op = &mem[at & 0xFF];
+        uint8_t length = 0;
+        switch (op[0])
+        {
+            /// NOP
+            case 0xEA:
+                length = 1;
+                break;
+
+            /// LDA / LDX / LDY / CMP / CPX / CPY / AND / ORA, immediate and zero page, and BIT zero page.
+            case 0xA9: case 0xA2: case 0xA0: case 0xC9: case 0xE0: case 0xC0: case 0x29: case 0x09:
+            case 0xA5: case 0xA6: case 0xA4: case 0xC5: case 0xE4: case 0xC4: case 0x25: case 0x05: case 0x24:
+                length = 2;
+                break;
+
+            /// the same, absolute.
+            case 0xAD: case 0xAE: case 0xAC: case 0xCD: case 0xEC: case 0xCC: case 0x2D: case 0x0D: case 0x2C:
+                length = 3;
+                break;
+
+            default:
+                return 0;
+        }
+
+        if ((at & 0xFF) + length > (pc & 0xFF))
+        {
+            return 0;
+        }
+
+        if (length == 3)
+        {
+            const uint16_t addr = op[1] | (op[2] << 8);
+            if (!idle_read(addr))
+            {
+                return 0;
+            }
+            flags |= addr > CPUMemMap_ED_RamMirror ? CPU_IDLE_READS_PPUSTATUS : 0;
+        }
+
+        at += length;
+        instructions++;
+    }
+
+    const uint8_t lo = pc & 0xFF;
+    switch (mem[lo])
+    {
+        /// BPL / BMI / BVC / BVS / BCC / BCS / BNE / BEQ
+        case 0x10: case 0x30: case 0x50: case 0x70: case 0x90: case 0xB0: case 0xD0: case 0xF0:
+            if (lo + 1 >= CPU_PAGE_SIZE || (uint16_t)(pc + 2 + (int8_t)mem[lo + 1]) != target)
+            {
+                return 0;
+            }
+            break;
+
+        /// JMP absolute
+        case 0x4C:
+            if (lo + 2 >= CPU_PAGE_SIZE || (mem[lo + 1] | (mem[lo + 2] << 8)) != target)
+            {
+                return 0;
+            }
+            break;
+
+        default:
+            return 0;
+    }
+
+    return (instructions + 1) | flags;
 }
 
+void cpu_set_idle_skip(nes_t *nes, bool enable)
+{
+    nes->cpu.idle.enabled = enable;
+}
 
 /*
 *   Branch Time!
@@ -472,246 +1019,234 @@ static inline void BRK()
 /// TODO: correct tick()
 /// all branch are 2 cycles, + 1 if taken, + 1 if page cross.
 
-static inline void __BRANCH(bool cond)
+static inline void __BRANCH(cpu_t *cpu, bool cond)
 {
-    int8_t v = read8(cpu->oprand);
+    int8_t v = read8(cpu, cpu->oprand);
     if (cond == true)
     {
-        page_cross(cpu->reg.PC, cpu->reg.PC + v);
+        page_cross(cpu, cpu->reg.PC, cpu->reg.PC + v);
         cpu->reg.PC += v;
-        tick(1);
+        tick(cpu, 1);
     }
-    tick(1);
+    tick(cpu, 1);
 }
 
-static inline void BCC()
+static inline void BCC(cpu_t *cpu)
 {
-    __BRANCH(cpu->reg.status_flag.C == 0);
+    __BRANCH(cpu, cpu->reg.status_flag.C == 0);
 }
 
-static inline void BCS()
+static inline void BCS(cpu_t *cpu)
 {
-    __BRANCH(cpu->reg.status_flag.C == 1);
+    __BRANCH(cpu, cpu->reg.status_flag.C == 1);
 }
 
-static inline void BEQ()
+static inline void BEQ(cpu_t *cpu)
 {
-    __BRANCH(cpu->reg.status_flag.Z == 1);
+    __BRANCH(cpu, flag_Z(cpu));
 }
 
-static inline void BNE()
+static inline void BNE(cpu_t *cpu)
 {
-    __BRANCH(cpu->reg.status_flag.Z == 0);
+    __BRANCH(cpu, !flag_Z(cpu));
 }
 
-static inline void BMI()
+static inline void BMI(cpu_t *cpu)
 {
-    __BRANCH(cpu->reg.status_flag.N == 1);
+    __BRANCH(cpu, flag_N(cpu));
 }
 
-static inline void BPL()
+static inline void BPL(cpu_t *cpu)
 {
-    __BRANCH(cpu->reg.status_flag.N == 0);
+    __BRANCH(cpu, !flag_N(cpu));
 }
 
-static inline void BVS()
+static inline void BVS(cpu_t *cpu)
 {
-    __BRANCH(cpu->reg.status_flag.V == 1);
+    __BRANCH(cpu, cpu->reg.status_flag.V == 1);
 }
 
-static inline void BVC()
+static inline void BVC(cpu_t *cpu)
 {
-    __BRANCH(cpu->reg.status_flag.V == 0);
+    __BRANCH(cpu, cpu->reg.status_flag.V == 0);
 }
 
 
 /*
 *   Flag Instructions
 */
-static inline void CLC()
+static inline void CLC(cpu_t *cpu)
 {
     cpu->reg.status_flag.C = false;
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void CLI()
+static inline void CLI(cpu_t *cpu)
 {
     cpu->reg.status_flag.I = false;
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void CLV()
+static inline void CLV(cpu_t *cpu)
 {
     cpu->reg.status_flag.V = false;
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void CLD()
+static inline void CLD(cpu_t *cpu)
 {
     cpu->reg.status_flag.D = false;
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void SEC()
+static inline void SEC(cpu_t *cpu)
 {
     cpu->reg.status_flag.C = true;
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void SEI()
+static inline void SEI(cpu_t *cpu)
 {
     cpu->reg.status_flag.I = true;
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void SED()
+static inline void SED(cpu_t *cpu)
 {
     cpu->reg.status_flag.D = true;
-    tick(2);
+    tick(cpu, 2);
 }
 
 
-static inline void CMP()
+static inline void CMP(cpu_t *cpu)
 {
-    uint8_t v = read8(cpu->oprand);
+    uint8_t v = read8(cpu, cpu->oprand);
     uint8_t r = cpu->reg.A - v;
 
     cpu->reg.status_flag.C = (cpu->reg.A >= v);
-    cpu->reg.status_flag.Z = r == 0;
-    cpu->reg.status_flag.N = RBIT7(r) == 1;
+    set_nz(cpu, r);
 
-    tick(1);
+    tick(cpu, 1);
 }
 
-static inline void CPX()
+static inline void CPX(cpu_t *cpu)
 {
-    uint8_t v = read8(cpu->oprand);
+    uint8_t v = read8(cpu, cpu->oprand);
     uint8_t r = cpu->reg.X - v;
 
     cpu->reg.status_flag.C = (cpu->reg.X >= v);
-    cpu->reg.status_flag.Z = r == 0;
-    cpu->reg.status_flag.N = RBIT7(r) == 1;
+    set_nz(cpu, r);
 
-    tick(1);
+    tick(cpu, 1);
 }
 
-static inline void CPY()
+static inline void CPY(cpu_t *cpu)
 {
-    uint8_t v = read8(cpu->oprand);
+    uint8_t v = read8(cpu, cpu->oprand);
     uint8_t r = cpu->reg.Y - v;
 
     cpu->reg.status_flag.C = (cpu->reg.Y >= v);
-    cpu->reg.status_flag.Z = r == 0;
-    cpu->reg.status_flag.N = RBIT7(r) == 1;
+    set_nz(cpu, r);
 
-    tick(1);
+    tick(cpu, 1);
 }
 
-static inline void DEC()
+static inline void DEC(cpu_t *cpu)
 {
-    uint8_t v = read8(cpu->oprand);
+    uint8_t v = read8(cpu, cpu->oprand);
     uint8_t r = v - 1;
 
-    write8(cpu->oprand, r);
+    write8(cpu, cpu->oprand, r);
 
-    cpu->reg.status_flag.Z = r == 0; 
-    cpu->reg.status_flag.N = RBIT7(r) == 1;
+    set_nz(cpu, r);
 
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void EOR()
+static inline void EOR(cpu_t *cpu)
 {
-    cpu->reg.A ^= read8(cpu->oprand);
+    cpu->reg.A ^= read8(cpu, cpu->oprand);
 
-    cpu->reg.status_flag.Z = cpu->reg.A == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.A) == 1;
+    set_nz(cpu, cpu->reg.A);
 
-    tick(1);
+    tick(cpu, 1);
 }
 
-static inline void INC()
+static inline void INC(cpu_t *cpu)
 {
-    uint8_t v = read8(cpu->oprand);
+    uint8_t v = read8(cpu, cpu->oprand);
     uint8_t r = v + 1;
 
-    write8(cpu->oprand, r);
+    write8(cpu, cpu->oprand, r);
 
-    cpu->reg.status_flag.Z = r == 0; 
-    cpu->reg.status_flag.N = RBIT7(r) == 1;
+    set_nz(cpu, r);
 
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void LDA()
+static inline void LDA(cpu_t *cpu)
 {
-    cpu->reg.A = read8(cpu->oprand);
+    cpu->reg.A = read8(cpu, cpu->oprand);
 
-    cpu->reg.status_flag.Z = cpu->reg.A == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.A) == 1;
+    set_nz(cpu, cpu->reg.A);
 
-    tick(1);
+    tick(cpu, 1);
 }
 
-static inline void LDX()
+static inline void LDX(cpu_t *cpu)
 {
-    cpu->reg.X = read8(cpu->oprand);
+    cpu->reg.X = read8(cpu, cpu->oprand);
 
-    cpu->reg.status_flag.Z = cpu->reg.X == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.X) == 1;
+    set_nz(cpu, cpu->reg.X);
 
-    tick(1);
+    tick(cpu, 1);
 }
 
-static inline void LDY()
+static inline void LDY(cpu_t *cpu)
 {
-    cpu->reg.Y = read8(cpu->oprand);
+    cpu->reg.Y = read8(cpu, cpu->oprand);
 
-    cpu->reg.status_flag.Z = cpu->reg.Y == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.Y) == 1;
+    set_nz(cpu, cpu->reg.Y);
 
-    tick(1);
+    tick(cpu, 1);
 }
 
-static inline void LSR_A()
+static inline void LSR_A(cpu_t *cpu)
 {
     cpu->reg.status_flag.C = cpu->reg.A & 1;
 
     cpu->reg.A >>= 1;
     
-    cpu->reg.status_flag.Z = cpu->reg.A == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.A) == 1;
+    set_nz(cpu, cpu->reg.A);
 
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void LSR()
+static inline void LSR(cpu_t *cpu)
 {
-    uint8_t v = read8(cpu->oprand);
+    uint8_t v = read8(cpu, cpu->oprand);
     uint8_t r = v >> 1;
 
-    write8(cpu->oprand, r);
+    write8(cpu, cpu->oprand, r);
 
     cpu->reg.status_flag.C = v & 1;
-    cpu->reg.status_flag.Z = r == 0; 
-    cpu->reg.status_flag.N = RBIT7(r) == 1;
+    set_nz(cpu, r);
 
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void NOP()
+static inline void NOP(cpu_t *cpu)
 {
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void ORA()
+static inline void ORA(cpu_t *cpu)
 {
-    cpu->reg.A |= read8(cpu->oprand);
+    cpu->reg.A |= read8(cpu, cpu->oprand);
 
-    cpu->reg.status_flag.Z = cpu->reg.A == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.A) == 1;
+    set_nz(cpu, cpu->reg.A);
 
-    tick(1);
+    tick(cpu, 1);
 }
 
 
@@ -719,459 +1254,864 @@ static inline void ORA()
 *   Stack Stuff
 */
 #define STACK_ADDR 0x100
-static inline void push_stack8(uint8_t v)
+static inline void push_stack8(cpu_t *cpu, uint8_t v)
 {
-    write8(cpu->reg.SP + STACK_ADDR, v);
+    write8(cpu, cpu->reg.SP + STACK_ADDR, v);
     --cpu->reg.SP;
 }
 
-static inline void push_stack16(uint16_t v)
+static inline void push_stack16(cpu_t *cpu, uint16_t v)
 {
-    push_stack8(v >> 8);
-    push_stack8(v & 0xFF);
+    push_stack8(cpu, v >> 8);
+    push_stack8(cpu, v & 0xFF);
 }
 
-static inline uint8_t pull_stack8()
+static inline uint8_t pull_stack8(cpu_t *cpu)
 {
     cpu->reg.SP++;
-    return read8(cpu->reg.SP + STACK_ADDR);
+    return read8(cpu, cpu->reg.SP + STACK_ADDR);
 }
 
-static inline uint16_t pull_stack16()
+static inline uint16_t pull_stack16(cpu_t *cpu)
 {
-   return (pull_stack8()) | (pull_stack8() << 8);
+    /// the order of the pulls matters, so don't do both in one expression.
+    const uint16_t low = pull_stack8(cpu);
+    const uint16_t high = pull_stack8(cpu);
+    return low | (high << 8);
 }
 
-static inline void JMP()
+static inline void JMP(cpu_t *cpu)
 {
     cpu->reg.PC = cpu->oprand;
-    tick(1);
+    tick(cpu, 1);
 }
 
-static inline void PHA()
+static inline void PHA(cpu_t *cpu)
 {
-    push_stack8(cpu->reg.A);
-    tick(2);
+    push_stack8(cpu, cpu->reg.A);
+    tick(cpu, 2);
 }
 
-static inline void PHP()
+static inline void PHP(cpu_t *cpu)
 {
     /// breakpoint bit is set.
     /// http://nesdev.com/6502bugs.txt
-    push_stack8(cpu->reg.P | BIT4);
-    tick(2);
+    push_stack8(cpu, get_P(cpu) | BIT4);
+    tick(cpu, 2);
 }
 
-static inline void PLA()
+static inline void PLA(cpu_t *cpu)
 {
-    cpu->reg.A = pull_stack8();
+    cpu->reg.A = pull_stack8(cpu);
 
-    cpu->reg.status_flag.Z = cpu->reg.A == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.A) == 1;
+    set_nz(cpu, cpu->reg.A);
 
-    tick(3);
+    tick(cpu, 3);
 }
 
-static inline void PLP()
+static inline void PLP(cpu_t *cpu)
 {
-    cpu->reg.P = pull_stack8();
+    cpu->reg.P = pull_stack8(cpu);
 
     cpu->reg.P &= ~BIT4;
     cpu->reg.P |= BIT5;
+    nz_load(cpu);
 
-    tick(3);
+    tick(cpu, 3);
 }
 
 /// JSR-RTS-RTI-BUG: http://nesdev.com/6502bugs.txt
-static inline void JSR()
+static inline void JSR(cpu_t *cpu)
 {
     /// JSR has a bug that sets the addr at -1.
     /// This is *fixed* in RTS, but not in RTI.
-    push_stack16(cpu->reg.PC - 1);
+    if (cpu->guestprof)
+    {
+        guestprof_call(cpu->guestprof, cpu->oprand, cpu->reg.SP, false, cpu->cycle_total);
+    }
+    push_stack16(cpu, cpu->reg.PC - 1);
     cpu->reg.PC = cpu->oprand;
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void RTS()
+static inline void RTS(cpu_t *cpu)
 {
     /// Due to JSR bug, the PC was set at PC -1.
     /// RTS increases the PC back.
-    cpu->reg.PC = pull_stack16() + 1;
-    tick(4);
+    cpu->reg.PC = pull_stack16(cpu) + 1;
+    if (cpu->guestprof)
+    {
+        guestprof_return(cpu->guestprof, cpu->reg.SP, cpu->cycle_total);
+    }
+    tick(cpu, 4);
 }
 
-static inline void RTI()
+static inline void RTI(cpu_t *cpu)
 {
-    cpu->reg.P = pull_stack8();
+    cpu->reg.P = pull_stack8(cpu);
 
     cpu->reg.P &= ~BIT4;
     cpu->reg.P |= BIT5;
+    nz_load(cpu);
 
     /// Due to the JSR bug, the PC returned will be -1.
     /// Obviously we don't need t0 decriment it as JSR already did that...
-    cpu->reg.PC = pull_stack16();
-    tick(3);
+    cpu->reg.PC = pull_stack16(cpu);
+    if (cpu->guestprof)
+    {
+        guestprof_return(cpu->guestprof, cpu->reg.SP, cpu->cycle_total);
+    }
+    tick(cpu, 3);
 }
 
 
 /*
 *   Register Instructions.
 */
-static inline void TAX()
+static inline void TAX(cpu_t *cpu)
 {
     cpu->reg.X = cpu->reg.A;
 
-    cpu->reg.status_flag.Z = cpu->reg.X == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.X) == 1; 
+    set_nz(cpu, cpu->reg.X);
 
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void TXA()
+static inline void TXA(cpu_t *cpu)
 {
     cpu->reg.A = cpu->reg.X;
 
-    cpu->reg.status_flag.Z = cpu->reg.A == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.A) == 1; 
+    set_nz(cpu, cpu->reg.A);
 
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void TSX()
+static inline void TSX(cpu_t *cpu)
 {
     cpu->reg.X = cpu->reg.SP;
 
-    cpu->reg.status_flag.Z = cpu->reg.X == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.X) == 1; 
+    set_nz(cpu, cpu->reg.X);
 
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void TXS()
+static inline void TXS(cpu_t *cpu)
 {
     cpu->reg.SP = cpu->reg.X;
 
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void DEX()
+static inline void DEX(cpu_t *cpu)
 {
     --cpu->reg.X;
 
-    cpu->reg.status_flag.Z = cpu->reg.X == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.X) == 1; 
+    set_nz(cpu, cpu->reg.X);
 
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void INX()
+static inline void INX(cpu_t *cpu)
 {
     ++cpu->reg.X;
 
-    cpu->reg.status_flag.Z = cpu->reg.X == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.X) == 1; 
+    set_nz(cpu, cpu->reg.X);
 
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void TAY()
+static inline void TAY(cpu_t *cpu)
 {
     cpu->reg.Y = cpu->reg.A;
 
-    cpu->reg.status_flag.Z = cpu->reg.Y == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.Y) == 1; 
+    set_nz(cpu, cpu->reg.Y);
 
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void TYA()
+static inline void TYA(cpu_t *cpu)
 {
     cpu->reg.A = cpu->reg.Y;
 
-    cpu->reg.status_flag.Z = cpu->reg.A == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.A) == 1; 
+    set_nz(cpu, cpu->reg.A);
 
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void DEY()
+static inline void DEY(cpu_t *cpu)
 {
     --cpu->reg.Y;
 
-    cpu->reg.status_flag.Z = cpu->reg.Y == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.Y) == 1; 
+    set_nz(cpu, cpu->reg.Y);
 
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void INY()
+static inline void INY(cpu_t *cpu)
 {
     ++cpu->reg.Y;
 
-    cpu->reg.status_flag.Z = cpu->reg.Y == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.Y) == 1; 
+    set_nz(cpu, cpu->reg.Y);
 
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void ROL_A()
+static inline void ROL_A(cpu_t *cpu)
 {
     uint8_t old_c_flag = cpu->reg.status_flag.C;
     cpu->reg.status_flag.C = RBIT7(cpu->reg.A);
 
     cpu->reg.A = (cpu->reg.A << 1) | old_c_flag;
 
-    cpu->reg.status_flag.Z = cpu->reg.A == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.A) == 1;
+    set_nz(cpu, cpu->reg.A);
 
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void ROL()
+static inline void ROL(cpu_t *cpu)
 {
-    uint8_t v = read8(cpu->oprand);
+    uint8_t v = read8(cpu, cpu->oprand);
     uint8_t r = (v << 1) | cpu->reg.status_flag.C;
 
-    write8(cpu->oprand, r);
+    write8(cpu, cpu->oprand, r);
 
     cpu->reg.status_flag.C = RBIT7(v);
-    cpu->reg.status_flag.Z = cpu->reg.A == 0; 
-    cpu->reg.status_flag.N = RBIT7(r) == 1;
+    set_z_n(cpu, cpu->reg.A == 0, r);
 
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void ROR_A()
+static inline void ROR_A(cpu_t *cpu)
 {
     uint8_t old_c_flag = cpu->reg.status_flag.C;
     cpu->reg.status_flag.C = cpu->reg.A & 1;
 
     cpu->reg.A = (cpu->reg.A >> 1) | (old_c_flag << 7);
 
-    cpu->reg.status_flag.Z = cpu->reg.A == 0; 
-    cpu->reg.status_flag.N = RBIT7(cpu->reg.A) == 1;
+    set_nz(cpu, cpu->reg.A);
 
-    tick(2);
+    tick(cpu, 2);
 }
 
-static inline void ROR()
+static inline void ROR(cpu_t *cpu)
 {
-    uint8_t v = read8(cpu->oprand);
+    uint8_t v = read8(cpu, cpu->oprand);
     uint8_t r = (v >> 1) | (cpu->reg.status_flag.C << 7);
 
-    write8(cpu->oprand, r);
+    write8(cpu, cpu->oprand, r);
 
     cpu->reg.status_flag.C = v & 1;
-    cpu->reg.status_flag.Z = cpu->reg.A == 0; 
-    cpu->reg.status_flag.N = RBIT7(r) == 1;
+    set_z_n(cpu, cpu->reg.A == 0, r);
+
+    tick(cpu, 2);
+}
+
+static inline void STA(cpu_t *cpu)
+{
+    write8(cpu, cpu->oprand, cpu->reg.A);
+
+    tick(cpu, 1);
+}
+
+static inline void STX(cpu_t *cpu)
+{
+    write8(cpu, cpu->oprand, cpu->reg.X);
+
+    tick(cpu, 1);
+}
+
+static inline void STY(cpu_t *cpu)
+{
+    write8(cpu, cpu->oprand, cpu->reg.Y);
 
-    tick(2);
+    tick(cpu, 1);
 }
 
-static inline void STA()
+
+/*
+*   Opcode Table.
+*/
+/// CPU_OPCODE_LIST (cpu_opcodes.h) is expanded into one handler per opcode that calls
+/// its addr_*() function directly, so the operand fetch is inlined into the op and
+/// cpu_tick() only has to do a single indexed jump, rather than a 150 case switch.
+
+/// Build with -DCPU_ADDRESSING_RUNTIME=1 to switch on the addressing mode at runtime.
+/// This is the old path, kept so that the bench can compare the two.
+#ifndef CPU_ADDRESSING_RUNTIME
+    #define CPU_ADDRESSING_RUNTIME 0
+#endif
+
+/// Build with -DCPU_DECODE_CACHE=0 to fetch and decode every instruction every time.
+#ifndef CPU_DECODE_CACHE
+    #define CPU_DECODE_CACHE 1
+#endif
+
+#if CPU_ADDRESSING_RUNTIME || CPU_DECODE_CACHE
+#define CPU_OPCODE_MODE_ENTRY(code, mode, ins) [code] = AddrType_##mode,
+
+static const uint8_t op_mode_table[0x100] =
+{
+    [0x00 ... 0xFF] = AddrType_Imp,
+    CPU_OPCODE_LIST(CPU_OPCODE_MODE_ENTRY)
+};
+#endif
+
+#if CPU_ADDRESSING_RUNTIME
+#define CPU_OPCODE_HANDLER(code, mode, ins) \
+    static void op_##code(cpu_t *cpu) { ins(cpu); }
+#else
+#define CPU_OPCODE_HANDLER(code, mode, ins) \
+    static void op_##code(cpu_t *cpu) { addr_##mode(cpu); ins(cpu); }
+#endif
+
+CPU_OPCODE_LIST(CPU_OPCODE_HANDLER)
+
+#if CPU_DECODE_CACHE
+/// Same as mode_fetch_cycles(), but constant so the tick folds into the handler's own ticks.
+/// Ticking them from cpu_tick() instead puts an extra store -> load on the cycle counter every instruction.
+#define CPU_FETCH_CYCLES_Acc    0
+#define CPU_FETCH_CYCLES_Imp    0
+#define CPU_FETCH_CYCLES_Rel    0
+#define CPU_FETCH_CYCLES_Imm    0
+#define CPU_FETCH_CYCLES_Abs    2
+#define CPU_FETCH_CYCLES_AbsX   2
+#define CPU_FETCH_CYCLES_AbsY   2
+#define CPU_FETCH_CYCLES_ZP     1
+#define CPU_FETCH_CYCLES_ZPX    1
+#define CPU_FETCH_CYCLES_ZPY    1
+#define CPU_FETCH_CYCLES_Ind    2
+#define CPU_FETCH_CYCLES_IndZPX 1
+#define CPU_FETCH_CYCLES_IndZPY 1
+
+/// Same as mode_length(), and constant for the same reason, the next PC then only depends
+/// on which handler was called (which is predicted), rather than on a load from the cache entry.
+#define CPU_LENGTH_Acc      1
+#define CPU_LENGTH_Imp      1
+#define CPU_LENGTH_Rel      2
+#define CPU_LENGTH_Imm      2
+#define CPU_LENGTH_Abs      3
+#define CPU_LENGTH_AbsX     3
+#define CPU_LENGTH_AbsY     3
+#define CPU_LENGTH_ZP       2
+#define CPU_LENGTH_ZPX      2
+#define CPU_LENGTH_ZPY      2
+#define CPU_LENGTH_Ind      3
+#define CPU_LENGTH_IndZPX   2
+#define CPU_LENGTH_IndZPY   2
+
+#define CPU_OPCODE_DECODED_HANDLER(code, mode, ins) \
+    static void op_decoded_##code(cpu_t *cpu, uint16_t operand) \
+    { \
+        cpu->reg.PC += CPU_LENGTH_##mode; \
+        cpu->cycle += CPU_FETCH_CYCLES_##mode; \
+        cpu->cycle_total += CPU_FETCH_CYCLES_##mode; \
+        addr_decoded_##mode(cpu, operand); \
+        ins(cpu); \
+    }
+
+#define CPU_OPCODE_DECODED_ENTRY(code, mode, ins) [code] = op_decoded_##code,
+
+CPU_OPCODE_LIST(CPU_OPCODE_DECODED_HANDLER)
+
+/// NULL for anything not implemented, those are never decoded so still hit NIP().
+static const cpu_decoded_cb op_decoded_table[0x100] =
 {
-    write8(cpu->oprand, cpu->reg.A);
+    CPU_OPCODE_LIST(CPU_OPCODE_DECODED_ENTRY)
+};
 
-    tick(1);
+#if CPU_IDLE_SKIP
+/// Called after the branch / jmp at pc that closes an idle loop went back round.
+static void idle_skip(cpu_t *cpu, uint16_t pc, uint8_t loop)
+{
+    const uint8_t instructions = loop & ~CPU_IDLE_READS_PPUSTATUS;
+
+    /// every instruction has to be traced.
+    if (!cpu->idle.enabled || cpu->trace)
+    {
+        return;
+    }
+
+    /// so that P can be compared.
+    nz_store(cpu);
+
+    const ppu_t *ppu = &cpu_nes(cpu)->ppu;
+    const uint64_t event = (loop & CPU_IDLE_READS_PPUSTATUS) ?
+        ppu_next_status_cycle(ppu, cpu->cycle_total) : ppu_next_event_cycle(ppu);
+
+    /// it went round exactly once since the last time, and nothing changed. That includes the
+    /// next event, if one went by part way round (say vblank start after a read of ppustatus)
+    /// the loop hasn't seen it yet, so it has to go round again first.
+    const cpu_register_t *last = &cpu->idle.reg;
+    if (cpu->idle.pc == pc && cpu->debug.count - cpu->idle.count == instructions && cpu->idle.event == event &&
+        last->A == cpu->reg.A && last->X == cpu->reg.X && last->Y == cpu->reg.Y &&
+        last->P == cpu->reg.P && last->SP == cpu->reg.SP && last->PC == cpu->reg.PC)
+    {
+        const uint64_t loop_cycles = cpu->cycle_total - cpu->idle.cycle_total;
+        const uint64_t deadline = event < cpu->cycle_deadline ? event : cpu->cycle_deadline;
+
+        /// whole iterations only, and every read in them is before the event.
+        if (loop_cycles > 0 && deadline > cpu->cycle_total + loop_cycles)
+        {
+            const uint64_t loops = (deadline - 1 - cpu->cycle_total) / loop_cycles;
+            cpu->cycle += loops * loop_cycles;
+            cpu->cycle_total += loops * loop_cycles;
+            cpu->debug.count += loops * instructions;
+        }
+    }
+
+    cpu->idle.pc = pc;
+    cpu->idle.reg = cpu->reg;
+    cpu->idle.cycle_total = cpu->cycle_total;
+    cpu->idle.count = cpu->debug.count;
+    cpu->idle.event = event;
 }
 
-static inline void STX()
+/// Handler for a branch / jmp that closes an idle loop, set by decode(), so no other branch pays for the check.
+static void op_decoded_idle(cpu_t *cpu, uint16_t operand)
 {
-    write8(cpu->oprand, cpu->reg.X);
+    const uint16_t pc = cpu->reg.PC;
+    op_decoded_table[cpu->opcode](cpu, operand);
 
-    tick(1);
+    /// the loop is all before it, so it went round if it was taken.
+    if (cpu->reg.PC <= pc)
+    {
+        idle_skip(cpu, pc, cpu_idle_loop(cpu, cpu->reg.PC, pc));
+    }
 }
+#endif
 
-static inline void STY()
+/// Slow path of cpu_tick(), fetches and decodes the instruction at pc into the cache.
+/// Returns NULL for anything that can't be cached, which then runs the normal way.
+/// Kept out of line so that the cache hit path in cpu_tick() stays small.
+__attribute__((noinline)) static const cpu_decoded_t *decode(cpu_t *cpu, uint16_t pc)
 {
-    write8(cpu->oprand, cpu->reg.Y);
+    const uint8_t page = pc >> 8;
+    const uint8_t *mem = cpu->read_pages[page];
+
+    /// io, or code run out of a mapper's read handler.
+    if (!mem)
+    {
+        return NULL;
+    }
+
+    const uint8_t opcode = mem[pc & 0xFF];
+    if (!op_decoded_table[opcode])
+    {
+        return NULL;
+    }
+
+    /// so that each page can be dropped on its own.
+    const uint8_t length = mode_length(op_mode_table[opcode]);
+    if ((pc & 0xFF) + length > CPU_PAGE_SIZE)
+    {
+        return NULL;
+    }
+
+    cpu_decoded_page_t *decoded = cpu->decoded_pages[page];
+    if (!decoded)
+    {
+        decoded = cpu->decoded_free;
+        if (decoded)
+        {
+            cpu->decoded_free = decoded->next_free;
+        }
+        else
+        {
+            decoded = malloc(sizeof(cpu_decoded_page_t));
+            if (!decoded)
+            {
+                return NULL;
+            }
+        }
+        memset(decoded, 0, sizeof(cpu_decoded_page_t));
+
+        /// ram is shared with its mirrors, and taken out of the write page table
+        /// so that writes can drop the code they change.
+        uint8_t aliases[RAM_MIRRORS];
+        const uint8_t count = page_aliases(page, aliases);
+        for (uint8_t i = 0; i < count; i++)
+        {
+            const uint8_t alias = aliases[i];
+            cpu->decoded_pages[alias] = decoded;
+            if (cpu->write_pages[alias])
+            {
+                cpu->code_pages[alias] = cpu->write_pages[alias];
+                cpu->write_pages[alias] = NULL;
+            }
+        }
+    }
 
-    tick(1);
+    cpu_decoded_t *entry = &decoded->entries[pc & 0xFF];
+    entry->opcode = opcode;
+    entry->length = length;
+    entry->cycles = mode_fetch_cycles(op_mode_table[opcode]);
+    entry->operand = 0;
+    if (length > 1)
+    {
+        entry->operand = mem[(pc & 0xFF) + 1];
+    }
+    if (length > 2)
+    {
+        entry->operand |= mem[(pc & 0xFF) + 2] << 8;
+    }
+    entry->handler = op_decoded_table[opcode];
+
+    #if CPU_IDLE_SKIP
+    /// BPL ... BEQ are all xxx10000.
+    uint16_t target = pc;
+    if (opcode == 0x4C)
+    {
+        target = entry->operand;
+    }
+    else if ((opcode & 0x1F) == 0x10)
+    {
+        target = pc + 2 + (int8_t)entry->operand;
+    }
+
+    if (target < pc && cpu_idle_loop(cpu, target, pc))
+    {
+        entry->handler = op_decoded_idle;
+    }
+    #endif
+
+    return entry;
 }
+#endif
+
+/// Build with -DCPU_DISPATCH_THREADED=1 to use computed-goto dispatch.
+/// Otherwise a function pointer table is used.
+#ifndef CPU_DISPATCH_THREADED
+    #define CPU_DISPATCH_THREADED 0
+#endif
+
+/// Build with -DCPU_TRACE=0 to compile out tracing entirely.
+/// Otherwise it costs a single untaken branch per instruction until cpu_set_trace() is called.
+#ifndef CPU_TRACE
+    #define CPU_TRACE 1
+#endif
 
+#if CPU_TRACE
+/// Reads without touching io, the operand bytes are almost always rom / ram anyway.
+static uint8_t peek8(const cpu_t *cpu, uint16_t addr)
+{
+    const uint8_t *page = cpu->read_pages[addr >> 8];
+    return page ? page[addr & 0xFF] : 0;
+}
 
-int cpu_tick()
+static void trace_record(cpu_t *cpu)
 {
+    const trace_record_t record =
+    {
+        .cycle = cpu->cycle_total,
+        .PC = cpu->reg.PC,
+        .opcode = cpu->opcode,
+        .operand = { peek8(cpu, cpu->reg.PC + 1), peek8(cpu, cpu->reg.PC + 2) },
+        .A = cpu->reg.A,
+        .X = cpu->reg.X,
+        .Y = cpu->reg.Y,
+        .P = get_P(cpu),
+        .SP = cpu->reg.SP,
+    };
+
+    trace_push(cpu->trace, &record);
+}
+#endif
+
+#if !CPU_DISPATCH_THREADED
+typedef void (*cpu_op_cb)(cpu_t *cpu);
+
+#define CPU_OPCODE_TABLE_ENTRY(code, mode, ins) [code] = op_##code,
+
+static const cpu_op_cb op_table[0x100] =
+{
+    /// ERROR. Will assert(0).
+    [0x00 ... 0xFF] = NIP,
+    CPU_OPCODE_LIST(CPU_OPCODE_TABLE_ENTRY)
+};
+#endif
+
+#if NES_PROFILE
+/// cpu_tick() is the timed wrapper below.
+static int execute(nes_t *nes)
+#else
+int cpu_tick(nes_t *nes)
+#endif
+{
+    cpu_t *cpu = &nes->cpu;
+
+    #if CPU_DECODE_CACHE
+    /// the fetch / decode (and the cycles for it) were already done the first time this ran.
+    const cpu_decoded_page_t *decoded_page = cpu->decoded_pages[cpu->reg.PC >> 8];
+    const cpu_decoded_t *decoded = decoded_page ? &decoded_page->entries[cpu->reg.PC & 0xFF] : NULL;
+    if (!decoded || !decoded->handler)
+    {
+        decoded = decode(cpu, cpu->reg.PC);
+    }
+
+    if (decoded)
+    {
+        cpu->opcode = decoded->opcode;
+
+        #if CPU_TRACE
+        if (cpu->trace)
+        {
+            trace_record(cpu);
+        }
+        #endif
+
+        cpu->debug.count++;
+        decoded->handler(cpu, decoded->operand);
+
+        return 0;
+    }
+    #endif
+
     /// 149 instructions so far...
 
-    cpu->opcode = read8(cpu->reg.PC);
+    cpu->opcode = read8(cpu, cpu->reg.PC);
     --cpu->cycle;
     --cpu->cycle_total;
 
-    printf("%04X   %02X %04X \tA:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%u count:%lu\n",
-    cpu->reg.PC, cpu->opcode, cpu->oprand, cpu->reg.A, cpu->reg.X, cpu->reg.Y, cpu->reg.P, cpu->reg.SP, cpu->cycle, cpu->debug.count);
+    #if CPU_TRACE
+    if (cpu->trace)
+    {
+        trace_record(cpu);
+    }
+    #endif
 
     cpu->debug.count++;
     cpu->reg.PC++;
 
-    switch (cpu->opcode)
+    #if CPU_ADDRESSING_RUNTIME
+    addressing(cpu, op_mode_table[cpu->opcode]);
+    #endif
+
+    #if CPU_DISPATCH_THREADED
+    #define CPU_OPCODE_LABEL_ENTRY(code, mode, ins) [code] = &&label_##code,
+    #define CPU_OPCODE_LABEL(code, mode, ins) label_##code: op_##code(cpu); return 0;
+
+    static const void *const label_table[0x100] =
+    {
+        [0x00 ... 0xFF] = &&label_NIP,
+        CPU_OPCODE_LIST(CPU_OPCODE_LABEL_ENTRY)
+    };
+
+    goto *label_table[cpu->opcode];
+
+    CPU_OPCODE_LIST(CPU_OPCODE_LABEL)
+
+    /// ERROR. Will assert(0).
+    label_NIP: NIP(cpu); return 0;
+
+    #undef CPU_OPCODE_LABEL
+    #undef CPU_OPCODE_LABEL_ENTRY
+    #else
+    op_table[cpu->opcode](cpu);
+
+    return 0;
+    #endif
+}
+
+#if NES_PROFILE
+int cpu_tick(nes_t *nes)
+{
+    profile_t *profile = nes->profile;
+    if (!profile)
+    {
+        return execute(nes);
+    }
+
+    const uint64_t start = profile_now();
+    const int ret = execute(nes);
+    profile->opcode_count[nes->cpu.opcode]++;
+    profile->opcode_ticks[nes->cpu.opcode] += profile_now() - start;
+    return ret;
+}
+#endif
+
+#if CPU_JIT
+/// The jit keeps P in a host register, N / Z included, so it takes and leaves them in reg.P.
+static int run_block(cpu_t *cpu)
+{
+    nz_store(cpu);
+    const int ret = jit_run(cpu->jit, cpu);
+    nz_load(cpu);
+    return ret;
+}
+#endif
+
+/// A single instruction, charged to the guest profiler.
+static inline int tick_guestprof(nes_t *nes, guestprof_t *guestprof)
+{
+    cpu_t *cpu = &nes->cpu;
+    const uint16_t pc = cpu->reg.PC;
+    const uint64_t cycle = cpu->cycle_total;
+
+    if (cpu_tick(nes) != 0)
     {
-        case 0x00: NIP(); break;
-        case 0x01: addressing(AddrType_IndZPX); ORA();      break;
-        case 0x05: addressing(AddrType_ZP);     ORA();      break;
-        case 0x06: addressing(AddrType_ZP);     ASL();      break;
-        case 0x08: addressing(AddrType_Imp);    PHP();      break;
-        case 0x09: addressing(AddrType_Imm);    ORA();      break;
-        case 0x0A: addressing(AddrType_Acc);    ASL_A();    break;
-        case 0x0D: addressing(AddrType_Abs);    ORA();      break;
-        case 0x0E: addressing(AddrType_Abs);    ASL();      break;
-        case 0x10: addressing(AddrType_Rel);    BPL();      break;
-        case 0x11: addressing(AddrType_IndZPY); ORA();      break;
-        case 0x15: addressing(AddrType_ZPX);    ORA();      break;
-        case 0x16: addressing(AddrType_ZPX);    ASL();      break;
-        case 0x18: addressing(AddrType_Imp);    CLC();      break;
-        case 0x19: addressing(AddrType_AbsY);   ORA();      break;
-        case 0x1D: addressing(AddrType_AbsX);   ORA();      break;
-        case 0x1E: addressing(AddrType_AbsX);   ASL();      break;
-        case 0x20: addressing(AddrType_Abs);    JSR();      break;
-        case 0x21: addressing(AddrType_IndZPX); AND();      break;
-        case 0x24: addressing(AddrType_ZP);     BIT();      break;
-        case 0x25: addressing(AddrType_ZP);     AND();      break;
-        case 0x26: addressing(AddrType_ZP);     ROL();      break;
-        case 0x28: addressing(AddrType_Imp);    PLP();      break;
-        case 0x29: addressing(AddrType_Imm);    AND();      break;
-        case 0x2A: addressing(AddrType_Acc);    ROL_A();    break;
-        case 0x2C: addressing(AddrType_Abs);    BIT();      break;
-        case 0x2D: addressing(AddrType_Abs);    AND();      break;
-        case 0x2E: addressing(AddrType_Abs);    ROL();      break;
-        case 0x30: addressing(AddrType_Rel);    BMI();      break;
-        case 0x31: addressing(AddrType_IndZPY); AND();      break;
-        case 0x35: addressing(AddrType_ZPX);    AND();      break;
-        case 0x36: addressing(AddrType_ZPX);    ROL();      break;
-        case 0x38: addressing(AddrType_Imp);    SEC();      break;
-        case 0x39: addressing(AddrType_AbsY);   AND();      break;
-        case 0x3D: addressing(AddrType_AbsX);   AND();      break;
-        case 0x3E: addressing(AddrType_AbsX);   ROL();      break;
-        case 0x40: addressing(AddrType_Imp);    RTI();      break;
-        case 0x41: addressing(AddrType_IndZPX); EOR();      break;
-        case 0x45: addressing(AddrType_ZP);     EOR();      break;
-        case 0x46: addressing(AddrType_ZP);     LSR();      break;
-        case 0x48: addressing(AddrType_Imp);    PHA();      break;
-        case 0x49: addressing(AddrType_Imm);    EOR();      break;
-        case 0x4A: addressing(AddrType_Acc);    LSR_A();    break;
-        case 0x4C: addressing(AddrType_Abs);    JMP();      break;
-        case 0x4D: addressing(AddrType_Abs);    EOR();      break;
-        case 0x4E: addressing(AddrType_Abs);    LSR();      break;
-        case 0x50: addressing(AddrType_Rel);    BVC();      break;
-        case 0x51: addressing(AddrType_IndZPY); EOR();      break;
-        case 0x55: addressing(AddrType_ZPX);    EOR();      break;
-        case 0x56: addressing(AddrType_ZPX);    LSR();      break;
-        case 0x58: addressing(AddrType_Imp);    CLI();      break;
-        case 0x59: addressing(AddrType_AbsY);   EOR();      break;
-        case 0x5D: addressing(AddrType_AbsX);   EOR();      break;
-        case 0x5E: addressing(AddrType_AbsX);   LSR();      break;
-        case 0x60: addressing(AddrType_Imp);    RTS();      break;
-        case 0x61: addressing(AddrType_IndZPX); ADC();      break;
-        case 0x65: addressing(AddrType_ZP);     ADC();      break;
-        case 0x66: addressing(AddrType_ZP);     ROR();      break;
-        case 0x68: addressing(AddrType_Imp);    PLA();      break;
-        case 0x69: addressing(AddrType_Imm);    ADC();      break;
-        case 0x6A: addressing(AddrType_Acc);    ROR_A();    break;
-        case 0x6C: addressing(AddrType_Ind);    JMP();      break;
-        case 0x6D: addressing(AddrType_Abs);    ADC();      break;
-        case 0x6E: addressing(AddrType_Abs);    ROR();      break;
-        case 0x70: addressing(AddrType_Rel);    BVS();      break;
-        case 0x71: addressing(AddrType_IndZPY); ADC();      break;
-        case 0x75: addressing(AddrType_ZPX);    ADC();      break;
-        case 0x76: addressing(AddrType_ZPX);    ROR();      break;
-        case 0x78: addressing(AddrType_Imp);    SEI();      break;
-        case 0x79: addressing(AddrType_AbsY);   ADC();      break;
-        case 0x7D: addressing(AddrType_AbsX);   ADC();      break;
-        case 0x7E: addressing(AddrType_AbsX);   ROR();      break;
-        case 0x81: addressing(AddrType_IndZPX); STA();      break;
-        case 0x84: addressing(AddrType_ZP);     STY();      break;
-        case 0x85: addressing(AddrType_ZP);     STA();      break;
-        case 0x86: addressing(AddrType_ZP);     STX();      break;
-        case 0x88: addressing(AddrType_Imp);    DEY();      break;
-        case 0x8A: addressing(AddrType_Imp);    TXA();      break;
-        case 0x8C: addressing(AddrType_Abs);    STY();      break;
-        case 0x8D: addressing(AddrType_Abs);    STA();      break;
-        case 0x8E: addressing(AddrType_Abs);    STX();      break;
-        case 0x90: addressing(AddrType_Rel);    BCC();      break;
-        case 0x91: addressing(AddrType_IndZPY); STA();      break;
-        case 0x94: addressing(AddrType_ZPX);    STY();      break;
-        case 0x95: addressing(AddrType_ZPX);    STA();      break;
-        case 0x96: addressing(AddrType_ZPY);    STX();      break;
-        case 0x98: addressing(AddrType_Imp);    TYA();      break;
-        case 0x99: addressing(AddrType_AbsY);   STA();      break;
-        case 0x9A: addressing(AddrType_Imp);    TXS();      break;
-        case 0x9D: addressing(AddrType_AbsX);   STA();      break;
-        case 0xA0: addressing(AddrType_Imm);    LDY();      break;
-        case 0xA1: addressing(AddrType_IndZPX); LDA();      break;
-        case 0xA2: addressing(AddrType_Imm);    LDX();      break;
-        case 0xA4: addressing(AddrType_ZP);     LDY();      break;
-        case 0xA5: addressing(AddrType_ZP);     LDA();      break;
-        case 0xA6: addressing(AddrType_ZP);     LDX();      break;
-        case 0xA8: addressing(AddrType_Imp);    TAY();      break;
-        case 0xA9: addressing(AddrType_Imm);    LDA();      break;
-        case 0xAA: addressing(AddrType_Imp);    TAX();      break;
-        case 0xAC: addressing(AddrType_Abs);    LDY();      break;
-        case 0xAD: addressing(AddrType_Abs);    LDA();      break;
-        case 0xAE: addressing(AddrType_Abs);    LDX();      break;
-        case 0xB0: addressing(AddrType_Rel);    BCS();      break;
-        case 0xB1: addressing(AddrType_IndZPY); LDA();      break;
-        case 0xB4: addressing(AddrType_ZPX);    LDY();      break;
-        case 0xB5: addressing(AddrType_ZPX);    LDA();      break;
-        case 0xB6: addressing(AddrType_ZPY);    LDX();      break;
-        case 0xB8: addressing(AddrType_Imp);    CLV();      break;
-        case 0xB9: addressing(AddrType_AbsY);   LDA();      break;
-        case 0xBA: addressing(AddrType_Imp);    TSX();      break;
-        case 0xBC: addressing(AddrType_AbsX);   LDY();      break;
-        case 0xBD: addressing(AddrType_AbsX);   LDA();      break;
-        case 0xBE: addressing(AddrType_AbsY);   LDX();      break;
-        case 0xC0: addressing(AddrType_Imm);    CPY();      break;
-        case 0xC1: addressing(AddrType_IndZPX); CMP();      break;
-        case 0xC4: addressing(AddrType_ZP);     CPY();      break;
-        case 0xC5: addressing(AddrType_ZP);     CMP();      break;
-        case 0xC6: addressing(AddrType_ZP);     DEC();      break;
-        case 0xC8: addressing(AddrType_Imp);    INY();      break;
-        case 0xC9: addressing(AddrType_Imm);    CMP();      break;
-        case 0xCA: addressing(AddrType_Imp);    DEX();      break;
-        case 0xCC: addressing(AddrType_Abs);    CPY();      break;
-        case 0xCD: addressing(AddrType_Abs);    CMP();      break;
-        case 0xCE: addressing(AddrType_Abs);    DEC();      break;
-        case 0xD0: addressing(AddrType_Rel);    BNE();      break;
-        case 0xD1: addressing(AddrType_IndZPY); CMP();      break;
-        case 0xD5: addressing(AddrType_ZPX);    CMP();      break;
-        case 0xD6: addressing(AddrType_ZPX);    DEC();      break;
-        case 0xD8: addressing(AddrType_Imp);    CLD();      break;
-        case 0xD9: addressing(AddrType_AbsY);   CMP();      break;
-        case 0xDD: addressing(AddrType_AbsX);   CMP();      break;
-        case 0xDE: addressing(AddrType_AbsX);   DEC();      break;
-        case 0xE0: addressing(AddrType_Imm);    CPX();      break;
-        case 0xE1: addressing(AddrType_IndZPX); SBC();      break;
-        case 0xE4: addressing(AddrType_ZP);     CPX();      break;
-        case 0xE5: addressing(AddrType_ZP);     SBC();      break;
-        case 0xE6: addressing(AddrType_ZP);     INC();      break;
-        case 0xE8: addressing(AddrType_Imp);    INX();      break;
-        case 0xE9: addressing(AddrType_Imm);    SBC();      break;
-        case 0xEA: addressing(AddrType_Imp);    NOP();      break;
-        case 0xEC: addressing(AddrType_Abs);    CPX();      break;
-        case 0xED: addressing(AddrType_Abs);    SBC();      break;
-        case 0xEE: addressing(AddrType_Abs);    INC();      break;
-        case 0xF0: addressing(AddrType_Rel);    BEQ();      break;
-        case 0xF1: addressing(AddrType_IndZPY); SBC();      break;
-        case 0xF5: addressing(AddrType_ZPX);    SBC();      break;
-        case 0xF6: addressing(AddrType_ZPX);    INC();      break;
-        case 0xF8: addressing(AddrType_Imp);    SED();      break;
-        case 0xF9: addressing(AddrType_AbsY);   SBC();      break;
-        case 0xFD: addressing(AddrType_AbsX);   SBC();      break;
-        case 0xFE: addressing(AddrType_AbsX);   INC();      break;
-
-        /// ERROR. Will assert(0).
-        default: NIP();
+        return -1;
     }
 
+    guestprof_instruction(guestprof, pc, cpu->cycle_total - cycle);
     return 0;
 }
 
+/// The guest profiler sees every instruction, so they are all interpreted, in a loop of their
+/// own so that not profiling doesn't cost a check per instruction.
+static int run_guestprof(nes_t *nes)
+{
+    cpu_t *cpu = &nes->cpu;
+    guestprof_t *guestprof = cpu->guestprof;
 
+    while (cpu->cycle_total < cpu->cycle_deadline)
+    {
+        if (tick_guestprof(nes, guestprof) != 0)
+        {
+            return -1;
+        }
+    }
 
-/*
-*   DEBUG
-*/
+    return 0;
+}
 
-cpu_t *cpu_debug_get()
+int cpu_run(nes_t *nes, uint64_t deadline)
 {
-    return cpu;
-}
\ No newline at end of file
+    cpu_t *cpu = &nes->cpu;
+
+    cpu->cycle_deadline = deadline;
+
+    /// reg.P is only exact outside of here, where it could also have been changed (ie a state load).
+    nz_load(cpu);
+
+    if (cpu->guestprof)
+    {
+        const int ret = run_guestprof(nes);
+        nz_store(cpu);
+        return ret;
+    }
+
+    int ret = 0;
+
+    /// the deadline can be pulled in by an io write, such as enabling nmi.
+    while (cpu->cycle_total < cpu->cycle_deadline)
+    {
+        #if CPU_JIT
+        /// tracing needs every instruction, so it is interpreted.
+        if (cpu->jit && !cpu->trace && run_block(cpu) == 0)
+        {
+            continue;
+        }
+        #endif
+
+        if (cpu_tick(nes) != 0)
+        {
+            ret = -1;
+            break;
+        }
+    }
+
+    nz_store(cpu);
+
+    return ret;
+}
+
+int cpu_step(nes_t *nes, uint64_t deadline)
+{
+    cpu_t *cpu = &nes->cpu;
+
+    /// an idle loop skips up to this as well.
+    cpu->cycle_deadline = deadline;
+
+    nz_load(cpu);
+
+    if (cpu->guestprof)
+    {
+        const int ret = tick_guestprof(nes, cpu->guestprof);
+        nz_store(cpu);
+        return ret;
+    }
+
+    #if CPU_JIT
+    if (cpu->jit && !cpu->trace && run_block(cpu) == 0)
+    {
+        return 0;
+    }
+    #endif
+
+    const int ret = cpu_tick(nes);
+    nz_store(cpu);
+
+    return ret;
+}
+
+int cpu_set_jit(nes_t *nes, bool enable)
+{
+    #if CPU_JIT
+    cpu_t *cpu = &nes->cpu;
+
+    if (!enable)
+    {
+        jit_exit(cpu->jit);
+        cpu->jit = NULL;
+        return 0;
+    }
+
+    if (!cpu->jit)
+    {
+        cpu->jit = jit_init();
+        if (!cpu->jit)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+    #else
+    if (enable)
+    {
+        fprintf(stderr, "jit is not available in this build\n");
+        return -1;
+    }
+    return 0;
+    #endif
+}
+
+void cpu_set_trace(nes_t *nes, trace_t *trace)
+{
+    nes->cpu.trace = trace;
+}
+
+void cpu_set_guestprof(nes_t *nes, guestprof_t *guestprof)
+{
+    cpu_t *cpu = &nes->cpu;
+
+    if (cpu->guestprof)
+    {
+        guestprof_end(cpu->guestprof, cpu->cycle_total);
+    }
+
+    cpu->guestprof = guestprof;
+    if (guestprof)
+    {
+        guestprof_begin(guestprof, cpu->cycle_total);
+    }
+}
+
+void cpu_nmi(nes_t *nes)
+{
+    cpu_t *cpu = &nes->cpu;
+    const uint8_t sp = cpu->reg.SP;
+
+    push_stack16(cpu, cpu->reg.PC);
+    push_stack8(cpu, (cpu->reg.P & ~BIT4) | BIT5);
+    cpu->reg.status_flag.I = true;
+    cpu->reg.PC = read16(cpu, 0xFFFA);
+
+    if (cpu->guestprof)
+    {
+        guestprof_call(cpu->guestprof, cpu->reg.PC, sp, true, cpu->cycle_total);
+    }
+
+    /// 2 pushes + 1 read16 = 5, interrupt sequence is 7.
+    tick(cpu, 2);
+}
@@ -7,6 +7,15 @@ extern "C" {
 #include <stdbool.h>
 #include <stdint.h>
 
+/// Defined in nes.h, every component lives inside of it.
+typedef struct nes nes_t;
+/// Defined in trace.h.
+typedef struct trace trace_t;
+/// Defined in jit.h.
+typedef struct jit jit_t;
+/// Defined in guestprof.h.
+typedef struct guestprof guestprof_t;
+
 typedef enum
 {
     CPUMemMap_ST_Ram,
@@ -88,14 +97,41 @@ typedef struct
     uint16_t PC;
 } cpu_register_t;
 
+#define CPU_PAGE_SIZE 0x100
+#define CPU_PAGE_COUNT 0x100
+
+typedef struct cpu cpu_t;
+
+/// The operand is passed in rather than stored in the cpu, so it doesn't have to go through memory.
+typedef void (*cpu_decoded_cb)(cpu_t *cpu, uint16_t operand);
+
+/// An instruction that has already been fetched and decoded, see cpu_tick().
 typedef struct
 {
-    cpu_register_t reg;
+    cpu_decoded_cb handler; /// NULL if not decoded yet.
+    uint16_t operand; /// the raw operand bytes.
+    uint8_t opcode;
+    uint8_t length;
+    uint8_t cycles; /// spent fetching the operand, the handler ticks these itself.
+} cpu_decoded_t;
 
-    uint8_t internal_ram[2048];
+/// Decoded instructions for a single 256 byte page, allocated the first time code runs from it.
+typedef struct cpu_decoded_page
+{
+    cpu_decoded_t entries[CPU_PAGE_SIZE];
+    struct cpu_decoded_page *next_free;
+} cpu_decoded_page_t;
 
-    uint32_t cycle;
-    uint64_t cycle_total;
+struct cpu
+{
+    /// Everything the interpreter touches on every instruction comes first, and fits in
+    /// one cache line (checked in cpu.c), nes_t starts the cpu on a line of its own.
+    cpu_register_t reg;
+
+    /// The value N / Z come from, while running they aren't kept in reg.P (see CPU_LAZY_NZ in cpu.c).
+    /// Z is the low byte being 0, N is bit 7 or bit 8 (set when N and Z come from different values).
+    /// cpu_run() / cpu_step() fold it back into reg.P before they return.
+    uint16_t nz;
 
     union
     {
@@ -108,25 +144,111 @@ typedef struct
     };
     uint8_t opcode;
 
+    uint32_t cycle;
+    uint64_t cycle_total;
+    uint64_t cycle_deadline; /// cpu_run() stops once cycle_total reaches this.
+
     struct
     {
         uint64_t count;
     } debug;
-} cpu_t;
 
+    trace_t *trace; /// NULL when not tracing.
+    jit_t *jit; /// NULL when the jit is off.
+
+    /// Memory map, one entry per 256 byte page.
+    /// A NULL entry means the access goes through the io handlers instead.
+    /// The mapper updates the prg pages when it switches banks.
+    uint8_t *read_pages[CPU_PAGE_COUNT];
+    uint8_t *write_pages[CPU_PAGE_COUNT];
+
+    /// Decoded instruction cache, indexed the same as the page table.
+    /// Remapping a page drops what was decoded from it.
+    /// Writable pages with decoded code are taken out of write_pages (kept in code_pages),
+    /// so writes to them go through the io path, which drops the instructions they touch.
+    cpu_decoded_page_t *decoded_pages[CPU_PAGE_COUNT];
+
+    /// Cold, only reached through the page tables or off the fast path.
+    cpu_decoded_page_t *decoded_free;
+    guestprof_t *guestprof; /// NULL when not profiling the guest.
+    uint8_t *code_pages[CPU_PAGE_COUNT];
+
+    uint8_t internal_ram[2048];
+
+    struct
+    {
+        bool enabled;
+
+        /// The state the last time an idle loop went round.
+        uint16_t pc; /// of the branch / jmp that closes it.
+        cpu_register_t reg;
+        uint64_t cycle_total;
+        uint64_t count;
+        uint64_t event; /// the cycle it could skip to, a ppu event on the way round moves it.
+    } idle;
+};
+
+int cpu_init(nes_t *nes);
+void cpu_exit(nes_t *nes);
+
+int cpu_power_up(nes_t *nes);
+int cpu_reset(nes_t *nes);
+
+/// Jump to nestest's automation entry point, call after cpu_power_up().
+void cpu_nestest_auto(nes_t *nes);
+
+void cpu_reset_cycle(nes_t *nes);
+
+/// addr and size must be page aligned.
+void cpu_map_pages(nes_t *nes, uint16_t addr, uint32_t size, uint8_t *mem, bool writable);
+void cpu_unmap_pages(nes_t *nes, uint16_t addr, uint32_t size);
+
+/// Drop every decoded instruction, ie after memory has been replaced by a save state.
+void cpu_invalidate_decoded(nes_t *nes);
+
+/// Drop what was decoded from writable memory (ram), ie after it has been replaced by a save state.
+/// Rom doesn't change under it, so what was decoded from rom (and the jit's blocks) is kept.
+void cpu_invalidate_writable_decoded(nes_t *nes);
+
+/// Start / stop (NULL) writing a trace record for every instruction.
+/// Does nothing in builds with CPU_TRACE=0.
+void cpu_set_trace(nes_t *nes, trace_t *trace);
+
+/// Start / stop (NULL) following the guest call stack and charging cycles to it, see guestprof.h.
+/// Everything is interpreted while it is attached.
+void cpu_set_guestprof(nes_t *nes, guestprof_t *guestprof);
+
+/// Turn the recompiler (see jit.h) on / off, it is off by default.
+/// Returns -1 if it isn't available in this build, or couldn't be started.
+int cpu_set_jit(nes_t *nes, bool enable);
+
+/// Skip the rest of an idle loop straight to the next event (or the deadline if that is first).
+/// An idle loop is a short loop in rom that only reads ram / ppustatus, neither of which can change
+/// until the next ppu event (ie vblank / the nmi handler), such as waiting for vblank.
+/// Apart from sprite 0 hit / overflow, so a loop reading ppustatus isn't skipped while they could be set.
+/// It only skips once the loop has gone round with nothing changing, and only whole iterations,
+/// so the state at the deadline is exactly the same as running it. On by default.
+/// Loops are found as they are decoded, so it needs the decode cache (CPU_DECODE_CACHE).
+void cpu_set_idle_skip(nes_t *nes, bool enable);
+
+/// Set in what cpu_idle_loop() returns if the loop reads ppustatus.
+#define CPU_IDLE_READS_PPUSTATUS 0x80
 
-const cpu_t *cpu_init();
-void cpu_exit();
+/// Instructions in the loop from target up to and including the backward branch / jmp at pc,
+/// or 0 if it isn't an idle loop, see cpu_set_idle_skip().
+uint8_t cpu_idle_loop(const cpu_t *cpu, uint16_t target, uint16_t pc);
 
-int cpu_power_up();
-int cpu_reset();
+/// A single instruction, this doesn't fold N / Z back into reg.P, use cpu_step() if P is looked at.
+int cpu_tick(nes_t *nes);
 
-void cpu_reset_cycle();
+/// Run a single compiled block if there is one at PC that fits before the deadline,
+/// otherwise a single instruction, same as cpu_tick().
+int cpu_step(nes_t *nes, uint64_t deadline);
 
-int cpu_tick();
+/// Run instructions until cycle_total reaches the deadline.
+int cpu_run(nes_t *nes, uint64_t deadline);
 
-/// debug
-cpu_t *cpu_debug_get();
+void cpu_nmi(nes_t *nes);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,159 @@
+#pragma once
+
+/// Every implemented opcode as (opcode, addressing mode, instruction).
+/// The mode is an AddrType without the prefix, the instruction is the cpu.c function,
+/// so the accumulator variants end in _A.
+///
+/// The cpu expands this into one handler per opcode, the tools that decode
+/// cpu state (ie the trace formatter) expand it into name / length tables.
+#define CPU_OPCODE_LIST(X) \
+    X(0x01, IndZPX, ORA) \
+    X(0x05, ZP,     ORA) \
+    X(0x06, ZP,     ASL) \
+    X(0x08, Imp,    PHP) \
+    X(0x09, Imm,    ORA) \
+    X(0x0A, Acc,    ASL_A) \
+    X(0x0D, Abs,    ORA) \
+    X(0x0E, Abs,    ASL) \
+    X(0x10, Rel,    BPL) \
+    X(0x11, IndZPY, ORA) \
+    X(0x15, ZPX,    ORA) \
+    X(0x16, ZPX,    ASL) \
+    X(0x18, Imp,    CLC) \
+    X(0x19, AbsY,   ORA) \
+    X(0x1D, AbsX,   ORA) \
+    X(0x1E, AbsX,   ASL) \
+    X(0x20, Abs,    JSR) \
+    X(0x21, IndZPX, AND) \
+    X(0x24, ZP,     BIT) \
+    X(0x25, ZP,     AND) \
+    X(0x26, ZP,     ROL) \
+    X(0x28, Imp,    PLP) \
+    X(0x29, Imm,    AND) \
+    X(0x2A, Acc,    ROL_A) \
+    X(0x2C, Abs,    BIT) \
+    X(0x2D, Abs,    AND) \
+    X(0x2E, Abs,    ROL) \
+    X(0x30, Rel,    BMI) \
+    X(0x31, IndZPY, AND) \
+    X(0x35, ZPX,    AND) \
+    X(0x36, ZPX,    ROL) \
+    X(0x38, Imp,    SEC) \
+    X(0x39, AbsY,   AND) \
+    X(0x3D, AbsX,   AND) \
+    X(0x3E, AbsX,   ROL) \
+    X(0x40, Imp,    RTI) \
+    X(0x41, IndZPX, EOR) \
+    X(0x45, ZP,     EOR) \
+    X(0x46, ZP,     LSR) \
+    X(0x48, Imp,    PHA) \
+    X(0x49, Imm,    EOR) \
+    X(0x4A, Acc,    LSR_A) \
+    X(0x4C, Abs,    JMP) \
+    X(0x4D, Abs,    EOR) \
+    X(0x4E, Abs,    LSR) \
+    X(0x50, Rel,    BVC) \
+    X(0x51, IndZPY, EOR) \
+    X(0x55, ZPX,    EOR) \
+    X(0x56, ZPX,    LSR) \
+    X(0x58, Imp,    CLI) \
+    X(0x59, AbsY,   EOR) \
+    X(0x5D, AbsX,   EOR) \
+    X(0x5E, AbsX,   LSR) \
+    X(0x60, Imp,    RTS) \
+    X(0x61, IndZPX, ADC) \
+    X(0x65, ZP,     ADC) \
+    X(0x66, ZP,     ROR) \
+    X(0x68, Imp,    PLA) \
+    X(0x69, Imm,    ADC) \
+    X(0x6A, Acc,    ROR_A) \
+    X(0x6C, Ind,    JMP) \
+    X(0x6D, Abs,    ADC) \
+    X(0x6E, Abs,    ROR) \
+    X(0x70, Rel,    BVS) \
+    X(0x71, IndZPY, ADC) \
+    X(0x75, ZPX,    ADC) \
+    X(0x76, ZPX,    ROR) \
+    X(0x78, Imp,    SEI) \
+    X(0x79, AbsY,   ADC) \
+    X(0x7D, AbsX,   ADC) \
+    X(0x7E, AbsX,   ROR) \
+    X(0x81, IndZPX, STA) \
+    X(0x84, ZP,     STY) \
+    X(0x85, ZP,     STA) \
+    X(0x86, ZP,     STX) \
+    X(0x88, Imp,    DEY) \
+    X(0x8A, Imp,    TXA) \
+    X(0x8C, Abs,    STY) \
+    X(0x8D, Abs,    STA) \
+    X(0x8E, Abs,    STX) \
+    X(0x90, Rel,    BCC) \
+    X(0x91, IndZPY, STA) \
+    X(0x94, ZPX,    STY) \
+    X(0x95, ZPX,    STA) \
+    X(0x96, ZPY,    STX) \
+    X(0x98, Imp,    TYA) \
+    X(0x99, AbsY,   STA) \
+    X(0x9A, Imp,    TXS) \
+    X(0x9D, AbsX,   STA) \
+    X(0xA0, Imm,    LDY) \
+    X(0xA1, IndZPX, LDA) \
+    X(0xA2, Imm,    LDX) \
+    X(0xA4, ZP,     LDY) \
+    X(0xA5, ZP,     LDA) \
+    X(0xA6, ZP,     LDX) \
+    X(0xA8, Imp,    TAY) \
+    X(0xA9, Imm,    LDA) \
+    X(0xAA, Imp,    TAX) \
+    X(0xAC, Abs,    LDY) \
+    X(0xAD, Abs,    LDA) \
+    X(0xAE, Abs,    LDX) \
+    X(0xB0, Rel,    BCS) \
+    X(0xB1, IndZPY, LDA) \
+    X(0xB4, ZPX,    LDY) \
+    X(0xB5, ZPX,    LDA) \
+    X(0xB6, ZPY,    LDX) \
+    X(0xB8, Imp,    CLV) \
+    X(0xB9, AbsY,   LDA) \
+    X(0xBA, Imp,    TSX) \
+    X(0xBC, AbsX,   LDY) \
+    X(0xBD, AbsX,   LDA) \
+    X(0xBE, AbsY,   LDX) \
+    X(0xC0, Imm,    CPY) \
+    X(0xC1, IndZPX, CMP) \
+    X(0xC4, ZP,     CPY) \
+    X(0xC5, ZP,     CMP) \
+    X(0xC6, ZP,     DEC) \
+    X(0xC8, Imp,    INY) \
+    X(0xC9, Imm,    CMP) \
+    X(0xCA, Imp,    DEX) \
+    X(0xCC, Abs,    CPY) \
+    X(0xCD, Abs,    CMP) \
+    X(0xCE, Abs,    DEC) \
+    X(0xD0, Rel,    BNE) \
+    X(0xD1, IndZPY, CMP) \
+    X(0xD5, ZPX,    CMP) \
+    X(0xD6, ZPX,    DEC) \
+    X(0xD8, Imp,    CLD) \
+    X(0xD9, AbsY,   CMP) \
+    X(0xDD, AbsX,   CMP) \
+    X(0xDE, AbsX,   DEC) \
+    X(0xE0, Imm,    CPX) \
+    X(0xE1, IndZPX, SBC) \
+    X(0xE4, ZP,     CPX) \
+    X(0xE5, ZP,     SBC) \
+    X(0xE6, ZP,     INC) \
+    X(0xE8, Imp,    INX) \
+    X(0xE9, Imm,    SBC) \
+    X(0xEA, Imp,    NOP) \
+    X(0xEC, Abs,    CPX) \
+    X(0xED, Abs,    SBC) \
+    X(0xEE, Abs,    INC) \
+    X(0xF0, Rel,    BEQ) \
+    X(0xF1, IndZPY, SBC) \
+    X(0xF5, ZPX,    SBC) \
+    X(0xF6, ZPX,    INC) \
+    X(0xF8, Imp,    SED) \
+    X(0xF9, AbsY,   SBC) \
+    X(0xFD, AbsX,   SBC) \
+    X(0xFE, AbsX,   INC)
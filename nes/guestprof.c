@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "guestprof.h"
+
+/// 2x the nodes, so it never gets more than half full.
+#define NODE_TABLE_SIZE (GUESTPROF_MAX_NODES * 2)
+
+/// How far back the pc listing looks for a label to give the pc as an offset from.
+#define LABEL_SEARCH_BYTES 0x100
+
+#define LABEL_LINE_SIZE 512
+
+int guestprof_start(guestprof_t *gp)
+{
+    memset(gp, 0, sizeof(guestprof_t));
+
+    gp->pcs = calloc(0x10000, sizeof(guestprof_pc_t));
+    gp->nodes = calloc(GUESTPROF_MAX_NODES, sizeof(guestprof_node_t));
+    gp->node_table = calloc(NODE_TABLE_SIZE, sizeof(uint32_t));
+    gp->labels = calloc(0x10000, sizeof(char *));
+    if (!gp->pcs || !gp->nodes || !gp->node_table || !gp->labels)
+    {
+        fprintf(stderr, "Failed to allocate guest profiler\n");
+        guestprof_stop(gp);
+        return -1;
+    }
+
+    /// the root, everything that isn't under a call.
+    gp->nodes[0] = (guestprof_node_t){ .parent = GUESTPROF_NO_PARENT };
+    gp->node_count = 1;
+
+    return 0;
+}
+
+void guestprof_stop(guestprof_t *gp)
+{
+    if (gp->labels)
+    {
+        for (uint32_t i = 0; i < 0x10000; i++)
+        {
+            free(gp->labels[i]);
+        }
+    }
+
+    free(gp->pcs);
+    free(gp->nodes);
+    free(gp->node_table);
+    free(gp->labels);
+    memset(gp, 0, sizeof(guestprof_t));
+}
+
+int guestprof_load_labels(guestprof_t *gp, const char *path)
+{
+    assert(path);
+    if (!path)
+    {
+        fprintf(stderr, "No label file given\n");
+        return -1;
+    }
+
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        fprintf(stderr, "Failed to open labels: %s\n", path);
+        return -1;
+    }
+
+    char line[LABEL_LINE_SIZE];
+    char name[LABEL_LINE_SIZE];
+    while (fgets(line, sizeof(line), fp))
+    {
+        /// ld65 writes 24 bit addresses, the bank byte is always 0 for the nes.
+        unsigned addr = 0;
+        if (sscanf(line, "al %x .%511s", &addr, name) != 2)
+        {
+            continue;
+        }
+        addr &= 0xFFFF;
+
+        char **label = &gp->labels[addr];
+        const bool segment = strncmp(name, "__", 2) == 0;
+        if (*label && (segment || strncmp(*label, "__", 2) != 0))
+        {
+            continue;
+        }
+
+        free(*label);
+        *label = strdup(name);
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+static uint32_t node_hash(uint32_t parent, uint16_t addr)
+{
+    return ((parent * 0x9E3779B1) ^ (addr * 0x85EBCA6B)) & (NODE_TABLE_SIZE - 1);
+}
+
+/// Returns GUESTPROF_NO_PARENT if there is no room for another node.
+static uint32_t find_node(guestprof_t *gp, uint32_t parent, uint16_t addr, bool interrupt)
+{
+    for (uint32_t i = node_hash(parent, addr);; i = (i + 1) & (NODE_TABLE_SIZE - 1))
+    {
+        const uint32_t slot = gp->node_table[i];
+        if (!slot)
+        {
+            if (gp->node_count == GUESTPROF_MAX_NODES)
+            {
+                return GUESTPROF_NO_PARENT;
+            }
+
+            const uint32_t node = gp->node_count++;
+            gp->nodes[node] = (guestprof_node_t){ .parent = parent, .addr = addr, .interrupt = interrupt };
+            gp->node_table[i] = node + 1;
+            return node;
+        }
+
+        const guestprof_node_t *n = &gp->nodes[slot - 1];
+        if (n->parent == parent && n->addr == addr && n->interrupt == interrupt)
+        {
+            return slot - 1;
+        }
+    }
+}
+
+/// Charge current up to cycle, before it changes.
+static void charge_node(guestprof_t *gp, uint64_t cycle)
+{
+    gp->nodes[gp->current].cycles += cycle - gp->node_cycle;
+    gp->node_cycle = cycle;
+}
+
+void guestprof_begin(guestprof_t *gp, uint64_t cycle)
+{
+    gp->depth = 0;
+    gp->current = 0;
+    gp->node_cycle = cycle;
+}
+
+void guestprof_end(guestprof_t *gp, uint64_t cycle)
+{
+    charge_node(gp, cycle);
+}
+
+void guestprof_call(guestprof_t *gp, uint16_t addr, uint8_t sp, bool interrupt, uint64_t cycle)
+{
+    if (gp->depth == GUESTPROF_MAX_DEPTH)
+    {
+        gp->dropped++;
+        return;
+    }
+
+    guestprof_node_t *caller = &gp->nodes[gp->current];
+    uint32_t node = caller->child;
+    if (interrupt || !node || caller->child_addr != addr)
+    {
+        node = find_node(gp, interrupt ? GUESTPROF_NO_PARENT : gp->current, addr, interrupt);
+        if (node == GUESTPROF_NO_PARENT)
+        {
+            /// still pushed, so the return finds it.
+            gp->dropped++;
+            node = gp->current;
+        }
+        else if (!interrupt)
+        {
+            caller->child_addr = addr;
+            caller->child = node;
+        }
+    }
+
+    charge_node(gp, cycle);
+    gp->nodes[node].calls++;
+    gp->stack[gp->depth++] = (guestprof_frame_t){ .node = node, .sp = sp };
+    gp->current = node;
+}
+
+void guestprof_return(guestprof_t *gp, uint8_t sp, uint64_t cycle)
+{
+    charge_node(gp, cycle);
+
+    while (gp->depth && gp->stack[gp->depth - 1].sp <= sp)
+    {
+        gp->depth--;
+    }
+
+    gp->current = gp->depth ? gp->stack[gp->depth - 1].node : 0;
+}
+
+static void write_node_name(const guestprof_t *gp, uint32_t node, FILE *fp)
+{
+    const guestprof_node_t *n = &gp->nodes[node];
+
+    if (node == 0)
+    {
+        fputs("reset", fp);
+    }
+    else if (gp->labels[n->addr])
+    {
+        fputs(gp->labels[n->addr], fp);
+    }
+    else
+    {
+        fprintf(fp, "%s$%04X", n->interrupt ? "nmi_" : "", n->addr);
+    }
+}
+
+int guestprof_write_folded(const guestprof_t *gp, FILE *fp)
+{
+    assert(gp && fp);
+    if (!gp || !fp)
+    {
+        fprintf(stderr, "Nothing to write the guest profile to\n");
+        return -1;
+    }
+
+    /// nodes are only made under a frame that fits, so a path is never deeper than the stack.
+    uint32_t path[GUESTPROF_MAX_DEPTH + 1];
+
+    for (uint32_t i = 0; i < gp->node_count; i++)
+    {
+        if (!gp->nodes[i].cycles)
+        {
+            continue;
+        }
+
+        uint32_t depth = 0;
+        for (uint32_t node = i; node != GUESTPROF_NO_PARENT; node = gp->nodes[node].parent)
+        {
+            path[depth++] = node;
+        }
+
+        while (depth--)
+        {
+            write_node_name(gp, path[depth], fp);
+            fputc(depth ? ';' : ' ', fp);
+        }
+        fprintf(fp, "%lu\n", gp->nodes[i].cycles);
+    }
+
+    if (ferror(fp))
+    {
+        fprintf(stderr, "Failed to write guest profile\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int guestprof_write_pcs(const guestprof_t *gp, FILE *fp)
+{
+    assert(gp && fp);
+    if (!gp || !fp)
+    {
+        fprintf(stderr, "Nothing to write the guest profile to\n");
+        return -1;
+    }
+
+    fprintf(fp, "pc,label,count,cycles\n");
+
+    for (uint32_t pc = 0; pc < 0x10000; pc++)
+    {
+        const guestprof_pc_t *p = &gp->pcs[pc];
+        if (!p->count && !p->cycles)
+        {
+            continue;
+        }
+
+        fprintf(fp, "%04X,", pc);
+
+        /// the closest label before it, as label+offset.
+        for (uint32_t offset = 0; offset < LABEL_SEARCH_BYTES && offset <= pc; offset++)
+        {
+            const char *label = gp->labels[pc - offset];
+            if (label)
+            {
+                fputs(label, fp);
+                if (offset)
+                {
+                    fprintf(fp, "+%u", offset);
+                }
+                break;
+            }
+        }
+
+        fprintf(fp, ",%lu,%lu\n", p->count, p->cycles);
+    }
+
+    if (ferror(fp))
+    {
+        fprintf(stderr, "Failed to write guest profile\n");
+        return -1;
+    }
+
+    return 0;
+}
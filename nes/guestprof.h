@@ -0,0 +1,110 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/// Guest code profiler, where the 6502 program spends its cycles.
+/// Emulated cycles are charged to the pc of the instruction that spent them, and to the
+/// call path it ran under. The call stack is followed through JSR / RTS and nmi / RTI,
+/// each frame remembers the SP it was entered at, so a return pops every frame at or
+/// above the SP it leaves behind. That way RTS used as a jump (push the address, RTS)
+/// doesn't pop anything, and a routine that drops its return address is popped by the next
+/// return that goes past it.
+///
+/// A call is charged to the callee from part way through the JSR (once it has read the address),
+/// nmi the same. The 7 cycles nmi takes to start aren't charged to any pc, they happen between instructions.
+///
+/// Interrupt handlers are roots of their own, rather than under whatever they interrupted,
+/// so the whole nmi is in one place. Addresses are cpu addresses, banks aren't told apart.
+///
+/// Attach with cpu_set_guestprof(), everything is interpreted while attached (no jit),
+/// idle loop skips are charged to the branch that skipped.
+
+/// Deepest call stack that is followed, calls past it are charged to the deepest frame.
+#define GUESTPROF_MAX_DEPTH 64
+/// Distinct call paths, once full new paths are charged to their caller.
+#define GUESTPROF_MAX_NODES (1 << 16)
+
+#define GUESTPROF_NO_PARENT UINT32_MAX
+
+/// One per distinct call path, the root is the code reset runs.
+typedef struct
+{
+    uint32_t parent; /// GUESTPROF_NO_PARENT for the root and interrupt handlers.
+    uint16_t addr; /// that was called.
+    bool interrupt;
+    uint16_t child_addr; /// the last call made from here, to skip the lookup when it is made again.
+    uint32_t child;
+    uint64_t calls;
+    uint64_t cycles; /// self, not including what it called.
+} guestprof_node_t;
+
+typedef struct
+{
+    uint32_t node;
+    uint8_t sp; /// before the call pushed anything, ie where the return leaves it.
+} guestprof_frame_t;
+
+/// Kept together so charging an instruction touches a single line.
+typedef struct
+{
+    uint64_t count; /// instructions that started here.
+    uint64_t cycles;
+} guestprof_pc_t;
+
+typedef struct guestprof
+{
+    guestprof_pc_t *pcs;
+
+    guestprof_node_t *nodes;
+    uint32_t node_count;
+    uint32_t *node_table; /// open addressed (parent, addr) -> node + 1, 0 is empty.
+
+    guestprof_frame_t stack[GUESTPROF_MAX_DEPTH];
+    uint32_t depth;
+    uint32_t current; /// node being run.
+    uint64_t node_cycle; /// when current started being charged.
+
+    uint64_t dropped; /// calls past GUESTPROF_MAX_DEPTH / GUESTPROF_MAX_NODES.
+
+    /// Symbols by address, NULL where there is none.
+    char **labels;
+} guestprof_t;
+
+int guestprof_start(guestprof_t *gp);
+void guestprof_stop(guestprof_t *gp);
+
+/// Names from a VICE label file, as written by ld65 -Ln ("al 00C123 .name" per line).
+/// Can be called more than once, the first label at an address wins, ld65's own __SEGMENT__ symbols lose.
+int guestprof_load_labels(guestprof_t *gp, const char *path);
+
+/// Provided for the cpu, see cpu_set_guestprof().
+void guestprof_begin(guestprof_t *gp, uint64_t cycle);
+void guestprof_end(guestprof_t *gp, uint64_t cycle);
+void guestprof_call(guestprof_t *gp, uint16_t addr, uint8_t sp, bool interrupt, uint64_t cycle);
+void guestprof_return(guestprof_t *gp, uint8_t sp, uint64_t cycle);
+
+/// Called once the instruction at pc is done, with the cycles it took.
+/// Nodes are only charged when the call stack changes, so that this stays cheap.
+static inline void guestprof_instruction(guestprof_t *gp, uint16_t pc, uint64_t cycles)
+{
+    guestprof_pc_t *entry = &gp->pcs[pc];
+    entry->count++;
+    entry->cycles += cycles;
+}
+
+/// Folded stacks ("reset;main;update_sprites 1234" per line), the input flamegraph.pl / speedscope / inferno take.
+/// The count is cycles.
+int guestprof_write_folded(const guestprof_t *gp, FILE *fp);
+
+/// "pc,label,count,cycles", one line for every pc that ran.
+int guestprof_write_pcs(const guestprof_t *gp, FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
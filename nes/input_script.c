@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "input_script.h"
+
+uint8_t input_parse_buttons(const char *s)
+{
+    uint8_t buttons = 0;
+    for (int i = 0; i < 8 && s[i] != '\0'; i++)
+    {
+        if (s[i] != '.' && s[i] != ' ')
+        {
+            /// 'R' is bit 7, 'A' is bit 0.
+            buttons |= 1 << (7 - i);
+        }
+    }
+    return buttons;
+}
+
+int input_script_load(input_script_t *script, const char *path)
+{
+    memset(script, 0, sizeof(input_script_t));
+
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        fprintf(stderr, "Failed to open input script: %s\n", path);
+        return -1;
+    }
+
+    uint32_t cap = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), fp))
+    {
+        uint32_t frame = 0;
+        char buttons[16] = {0};
+
+        if (line[0] == '#' || line[0] == '\n')
+        {
+            continue;
+        }
+
+        if (sscanf(line, "%u %15s", &frame, buttons) != 2)
+        {
+            fprintf(stderr, "Bad input script line: %s", line);
+            fclose(fp);
+            input_script_free(script);
+            return -1;
+        }
+
+        if (script->count == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            input_entry_t *entries = realloc(script->entries, cap * sizeof(input_entry_t));
+            if (!entries)
+            {
+                fprintf(stderr, "Failed to alloc input script entries\n");
+                fclose(fp);
+                input_script_free(script);
+                return -1;
+            }
+            script->entries = entries;
+        }
+
+        script->entries[script->count].frame = frame;
+        script->entries[script->count].buttons = input_parse_buttons(buttons);
+        script->count++;
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+void input_script_free(input_script_t *script)
+{
+    free(script->entries);
+    memset(script, 0, sizeof(input_script_t));
+}
+
+void input_script_apply(input_script_t *script, nes_t *nes, uint32_t frame)
+{
+    while (script->next < script->count && script->entries[script->next].frame <= frame)
+    {
+        joypad_set_buttons(&nes->joypad, 0, script->entries[script->next].buttons);
+        script->next++;
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "nes.h"
+
+/// Simple text input script for batch runs.
+/// One entry per line, "<frame> <buttons>", where buttons are in fm2 order "RLDUTSBA"
+/// and '.' means released, ie "120 ....T..." presses start.
+/// The buttons are held from that frame until the next entry. Lines starting with '#' are ignored.
+
+typedef struct
+{
+    uint32_t frame;
+    uint8_t buttons;
+} input_entry_t;
+
+typedef struct
+{
+    input_entry_t *entries;
+    uint32_t count;
+    uint32_t next;
+} input_script_t;
+
+int input_script_load(input_script_t *script, const char *path);
+void input_script_free(input_script_t *script);
+
+/// Sets joypad 0 for this frame, call before each nes_run().
+void input_script_apply(input_script_t *script, nes_t *nes, uint32_t frame);
+
+/// Buttons in fm2 order, "RLDUTSBA", anything other than '.' / ' ' is pressed. Stops early at the end of s.
+uint8_t input_parse_buttons(const char *s);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,1573 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "jit.h"
+#include "cpu.h"
+#include "util.h"
+#include "cpu_opcodes.h"
+
+#if CPU_JIT
+
+#include <sys/mman.h>
+
+/// Shared by every block, flushed and started again when it fills up.
+#define JIT_CODE_SIZE (4 << 20)
+/// Room reserved for a block while it is compiled, it is interpreted if it doesn't fit.
+#define JIT_BLOCK_MAX_SIZE (32 << 10)
+#define JIT_BLOCK_MAX_INSTRUCTIONS 64
+/// Each instruction can leave through a taken branch or a write that needs to stop.
+#define JIT_BLOCK_MAX_STUBS (JIT_BLOCK_MAX_INSTRUCTIONS * 2)
+
+typedef void (*jit_block_cb)(cpu_t *cpu, jit_t *jit);
+
+typedef struct
+{
+    jit_block_cb block; /// NULL when this pc is interpreted.
+    uint16_t max_cycles; /// the most cycles a single run of the block can take.
+    bool compiled;
+} jit_entry_t;
+
+typedef struct
+{
+    jit_entry_t entries[CPU_PAGE_SIZE];
+    bool interpret; /// not prg-rom, so nothing in it is compiled.
+} jit_page_t;
+
+struct jit
+{
+    /// N and Z for every result, the emitted code ors this straight into P.
+    uint8_t nz[0x100];
+    /// Set by an io write that means the block has to stop after the current instruction.
+    uint8_t exit;
+    /// Bumped whenever a page is remapped.
+    uint32_t generation;
+
+    uint8_t *code;
+    size_t code_used;
+
+    jit_page_t *pages[CPU_PAGE_COUNT];
+};
+
+jit_t *jit_init()
+{
+    jit_t *jit = calloc(1, sizeof(jit_t));
+    if (!jit)
+    {
+        fprintf(stderr, "Failed to alloc jit\n");
+        return NULL;
+    }
+
+    /// only ever writable or executable, never both, see compile().
+    jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed to map jit code buffer\n");
+        free(jit);
+        return NULL;
+    }
+
+    for (uint32_t v = 0; v < 0x100; v++)
+    {
+        jit->nz[v] = (v & BIT7) | (v == 0 ? BIT1 : 0);
+    }
+
+    return jit;
+}
+
+static void jit_flush(jit_t *jit)
+{
+    for (uint32_t page = 0; page < CPU_PAGE_COUNT; page++)
+    {
+        free(jit->pages[page]);
+        jit->pages[page] = NULL;
+    }
+    jit->code_used = 0;
+    jit->generation++;
+}
+
+void jit_exit(jit_t *jit)
+{
+    if (!jit)
+    {
+        return;
+    }
+
+    jit_flush(jit);
+    munmap(jit->code, JIT_CODE_SIZE);
+    free(jit);
+}
+
+void jit_invalidate_page(jit_t *jit, uint8_t page)
+{
+    if (jit->pages[page])
+    {
+        free(jit->pages[page]);
+        jit->pages[page] = NULL;
+    }
+    jit->generation++;
+}
+
+
+/*
+*   Io calls from the emitted code.
+*/
+/// pending is the cycles the block has run so far, which are normally only added on exit.
+static uint8_t jit_read8(cpu_t *cpu, uint32_t addr, uint32_t pending)
+{
+    cpu->cycle += pending;
+    cpu->cycle_total += pending;
+    const uint8_t v = cpu_read8_io(cpu, addr);
+    cpu->cycle -= pending;
+    cpu->cycle_total -= pending;
+    return v;
+}
+
+static void jit_write8(cpu_t *cpu, uint32_t addr, uint32_t v, uint32_t pending)
+{
+    jit_t *jit = cpu->jit;
+    const uint32_t generation = jit->generation;
+
+    cpu->cycle += pending;
+    cpu->cycle_total += pending;
+    cpu_write8_io(cpu, addr, v);
+
+    /// the deadline was pulled in (ie nmi was enabled), or the mapper switched banks.
+    if (cpu->cycle_total >= cpu->cycle_deadline || jit->generation != generation)
+    {
+        jit->exit = 1;
+    }
+
+    cpu->cycle -= pending;
+    cpu->cycle_total -= pending;
+}
+
+
+/*
+*   x86-64 encoding.
+*/
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+#define NO_INDEX -1
+
+/// Kept in callee saved registers for the whole block, so io calls don't touch them.
+#define REG_CPU RBX
+#define REG_JIT RBP
+#define REG_A R12
+#define REG_X R13
+#define REG_Y R14
+#define REG_P R15
+
+/// Condition codes, CC_ALWAYS is a plain jmp.
+enum { CC_O, CC_NO, CC_C, CC_NC, CC_Z, CC_NZ, CC_BE, CC_A, CC_ALWAYS = 0xFF };
+
+/// The /digit of the 0x80 / 0x81 / 0x83 group.
+enum { ALU_ADD, ALU_OR, ALU_ADC, ALU_SBB, ALU_AND, ALU_SUB, ALU_XOR, ALU_CMP };
+
+/// The /digit of the 0xC0 / 0xD0 shift group.
+enum { SHIFT_ROL, SHIFT_ROR, SHIFT_RCL, SHIFT_RCR, SHIFT_SHL, SHIFT_SHR };
+
+#define CPU_OFF(field) ((int32_t)offsetof(cpu_t, field))
+#define JIT_OFF(field) ((int32_t)offsetof(jit_t, field))
+
+typedef struct
+{
+    uint8_t *fixup; /// rel32 to point at the stub.
+    uint16_t pc;
+    uint32_t cycles;
+    uint32_t count;
+} jit_stub_t;
+
+typedef struct
+{
+    const cpu_t *cpu;
+    const uint8_t *mem; /// the page the block is in.
+
+    uint8_t *start;
+    uint8_t *p;
+    uint8_t *end;
+    bool full;
+
+    uint8_t *body; /// after the prologue, where a loop back to the start goes.
+    uint8_t *epilogue;
+
+    uint16_t block_pc;
+    uint32_t cycles; /// static cycles since the start of the block.
+    uint32_t max_cycles; /// plus every page cross and taken branch.
+    uint32_t count; /// instructions, including the one being compiled.
+    uint32_t io; /// instructions with an io register as a fixed operand.
+    bool idle; /// the block closes an idle loop, which the interpreter skips instead.
+
+    jit_stub_t stubs[JIT_BLOCK_MAX_STUBS];
+    uint32_t stub_count;
+} jit_emit_t;
+
+static void emit8(jit_emit_t *e, uint8_t v)
+{
+    if (e->p < e->end)
+    {
+        *e->p++ = v;
+    }
+    else
+    {
+        e->full = true;
+    }
+}
+
+static void emit16(jit_emit_t *e, uint16_t v)
+{
+    emit8(e, v);
+    emit8(e, v >> 8);
+}
+
+static void emit32(jit_emit_t *e, uint32_t v)
+{
+    emit16(e, v);
+    emit16(e, v >> 16);
+}
+
+static void emit64(jit_emit_t *e, uint64_t v)
+{
+    emit32(e, v);
+    emit32(e, v >> 32);
+}
+
+static void emit_bytes(jit_emit_t *e, const uint8_t *op, uint8_t n)
+{
+    for (uint8_t i = 0; i < n; i++)
+    {
+        emit8(e, op[i]);
+    }
+}
+
+/// byte is set when reg / rm are 8 bit registers, as 4-7 are only spl..dil with a rex prefix.
+static void x86_reg(jit_emit_t *e, bool w, bool byte, const uint8_t *op, uint8_t n, int reg, int rm)
+{
+    const uint8_t rex = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+    if (rex != 0x40 || (byte && ((reg >= 4 && reg < 8) || (rm >= 4 && rm < 8))))
+    {
+        emit8(e, rex);
+    }
+    emit_bytes(e, op, n);
+    emit8(e, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+/// [base + index * (1 << scale) + disp].
+static void x86_mem(jit_emit_t *e, bool w, bool byte, const uint8_t *op, uint8_t n, int reg, int base, int index, uint8_t scale, int32_t disp)
+{
+    const uint8_t rex = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((index != NO_INDEX && (index & 8)) ? 2 : 0) | ((base & 8) ? 1 : 0);
+    if (rex != 0x40 || (byte && reg >= 4 && reg < 8))
+    {
+        emit8(e, rex);
+    }
+    emit_bytes(e, op, n);
+
+    /// rbp / r13 as a base always need a displacement.
+    const uint8_t mod = (disp == 0 && (base & 7) != RBP) ? 0 : (disp >= -128 && disp <= 127) ? 1 : 2;
+    if (index != NO_INDEX || (base & 7) == RSP)
+    {
+        emit8(e, mod << 6 | (reg & 7) << 3 | 4);
+        emit8(e, scale << 6 | (index != NO_INDEX ? (index & 7) : 4) << 3 | (base & 7));
+    }
+    else
+    {
+        emit8(e, mod << 6 | (reg & 7) << 3 | (base & 7));
+    }
+
+    if (mod == 1)
+    {
+        emit8(e, disp);
+    }
+    else if (mod == 2)
+    {
+        emit32(e, disp);
+    }
+}
+
+#define OP(...) (const uint8_t[]){ __VA_ARGS__ }, sizeof((const uint8_t[]){ __VA_ARGS__ })
+
+static void movzx_r32_m8(jit_emit_t *e, int dst, int base, int index, int32_t disp)
+{
+    x86_mem(e, false, false, OP(0x0F, 0xB6), dst, base, index, 0, disp);
+}
+
+static void movzx_r32_r8(jit_emit_t *e, int dst, int src)
+{
+    x86_reg(e, false, true, OP(0x0F, 0xB6), dst, src);
+}
+
+static void mov_r64_m64(jit_emit_t *e, int dst, int base, int index, uint8_t scale, int32_t disp)
+{
+    x86_mem(e, true, false, OP(0x8B), dst, base, index, scale, disp);
+}
+
+static void mov_m8_r8(jit_emit_t *e, int base, int index, int32_t disp, int src)
+{
+    x86_mem(e, false, true, OP(0x88), src, base, index, 0, disp);
+}
+
+static void mov_m16_r16(jit_emit_t *e, int base, int32_t disp, int src)
+{
+    emit8(e, 0x66);
+    x86_mem(e, false, false, OP(0x89), src, base, NO_INDEX, 0, disp);
+}
+
+static void mov_m16_imm16(jit_emit_t *e, int base, int32_t disp, uint16_t imm)
+{
+    emit8(e, 0x66);
+    x86_mem(e, false, false, OP(0xC7), 0, base, NO_INDEX, 0, disp);
+    emit16(e, imm);
+}
+
+static void mov_r32_r32(jit_emit_t *e, int dst, int src)
+{
+    x86_reg(e, false, false, OP(0x89), src, dst);
+}
+
+static void mov_r64_r64(jit_emit_t *e, int dst, int src)
+{
+    x86_reg(e, true, false, OP(0x89), src, dst);
+}
+
+static void mov_r32_imm32(jit_emit_t *e, int dst, uint32_t imm)
+{
+    if (dst & 8)
+    {
+        emit8(e, 0x41);
+    }
+    emit8(e, 0xB8 + (dst & 7));
+    emit32(e, imm);
+}
+
+static void mov_r64_imm64(jit_emit_t *e, int dst, uint64_t imm)
+{
+    emit8(e, 0x48 | ((dst & 8) ? 1 : 0));
+    emit8(e, 0xB8 + (dst & 7));
+    emit64(e, imm);
+}
+
+static void lea_r32(jit_emit_t *e, int dst, int base, int32_t disp)
+{
+    x86_mem(e, false, false, OP(0x8D), dst, base, NO_INDEX, 0, disp);
+}
+
+/// op is the r/m8, r8 form, ie 0x00 add, 0x08 or, 0x10 adc, 0x20 and, 0x28 sub, 0x30 xor, 0x84 test.
+static void alu_r8_r8(jit_emit_t *e, uint8_t op, int dst, int src)
+{
+    x86_reg(e, false, true, &op, 1, src, dst);
+}
+
+static void alu_r32_imm32(jit_emit_t *e, uint8_t alu, int dst, int32_t imm)
+{
+    if (imm >= -128 && imm <= 127)
+    {
+        x86_reg(e, false, false, OP(0x83), alu, dst);
+        emit8(e, imm);
+    }
+    else
+    {
+        x86_reg(e, false, false, OP(0x81), alu, dst);
+        emit32(e, imm);
+    }
+}
+
+static void alu_r64_imm32(jit_emit_t *e, uint8_t alu, int dst, int32_t imm)
+{
+    if (imm >= -128 && imm <= 127)
+    {
+        x86_reg(e, true, false, OP(0x83), alu, dst);
+        emit8(e, imm);
+    }
+    else
+    {
+        x86_reg(e, true, false, OP(0x81), alu, dst);
+        emit32(e, imm);
+    }
+}
+
+static void alu_m_imm32(jit_emit_t *e, bool w, uint8_t alu, int base, int32_t disp, int32_t imm)
+{
+    if (imm >= -128 && imm <= 127)
+    {
+        x86_mem(e, w, false, OP(0x83), alu, base, NO_INDEX, 0, disp);
+        emit8(e, imm);
+    }
+    else
+    {
+        x86_mem(e, w, false, OP(0x81), alu, base, NO_INDEX, 0, disp);
+        emit32(e, imm);
+    }
+}
+
+/// add [base + disp], src.
+static void add_m_r(jit_emit_t *e, bool w, int base, int32_t disp, int src)
+{
+    x86_mem(e, w, false, OP(0x01), src, base, NO_INDEX, 0, disp);
+}
+
+static void cmp_r64_m64(jit_emit_t *e, int reg, int base, int32_t disp)
+{
+    x86_mem(e, true, false, OP(0x3B), reg, base, NO_INDEX, 0, disp);
+}
+
+static void cmp_m8_imm8(jit_emit_t *e, int base, int32_t disp, uint8_t imm)
+{
+    x86_mem(e, false, false, OP(0x80), ALU_CMP, base, NO_INDEX, 0, disp);
+    emit8(e, imm);
+}
+
+/// or dst8, [base + index + disp].
+static void or_r8_m8(jit_emit_t *e, int dst, int base, int index, int32_t disp)
+{
+    x86_mem(e, false, true, OP(0x0A), dst, base, index, 0, disp);
+}
+
+static void test_r32_imm32(jit_emit_t *e, int reg, uint32_t imm)
+{
+    x86_reg(e, false, false, OP(0xF7), 0, reg);
+    emit32(e, imm);
+}
+
+static void setcc(jit_emit_t *e, uint8_t cc, int dst)
+{
+    x86_reg(e, false, true, OP(0x0F, 0x90 | cc), 0, dst);
+}
+
+static void shift_r8_1(jit_emit_t *e, uint8_t shift, int dst)
+{
+    x86_reg(e, false, true, OP(0xD0), shift, dst);
+}
+
+static void shift_r8_imm8(jit_emit_t *e, uint8_t shift, int dst, uint8_t imm)
+{
+    x86_reg(e, false, true, OP(0xC0), shift, dst);
+    emit8(e, imm);
+}
+
+static void shift_r32_imm8(jit_emit_t *e, uint8_t shift, int dst, uint8_t imm)
+{
+    x86_reg(e, false, false, OP(0xC1), shift, dst);
+    emit8(e, imm);
+}
+
+/// Copies bit into CF.
+static void bt_r32_imm8(jit_emit_t *e, int reg, uint8_t bit)
+{
+    x86_reg(e, false, false, OP(0x0F, 0xBA), 4, reg);
+    emit8(e, bit);
+}
+
+static void inc_r8(jit_emit_t *e, int dst)
+{
+    x86_reg(e, false, true, OP(0xFE), 0, dst);
+}
+
+static void dec_r8(jit_emit_t *e, int dst)
+{
+    x86_reg(e, false, true, OP(0xFE), 1, dst);
+}
+
+static void inc_m8(jit_emit_t *e, int base, int32_t disp)
+{
+    x86_mem(e, false, false, OP(0xFE), 0, base, NO_INDEX, 0, disp);
+}
+
+static void dec_m8(jit_emit_t *e, int base, int32_t disp)
+{
+    x86_mem(e, false, false, OP(0xFE), 1, base, NO_INDEX, 0, disp);
+}
+
+static void not_r8(jit_emit_t *e, int dst)
+{
+    x86_reg(e, false, true, OP(0xF6), 2, dst);
+}
+
+static void push_r64(jit_emit_t *e, int reg)
+{
+    if (reg & 8)
+    {
+        emit8(e, 0x41);
+    }
+    emit8(e, 0x50 + (reg & 7));
+}
+
+static void pop_r64(jit_emit_t *e, int reg)
+{
+    if (reg & 8)
+    {
+        emit8(e, 0x41);
+    }
+    emit8(e, 0x58 + (reg & 7));
+}
+
+static void call_abs(jit_emit_t *e, const void *fn)
+{
+    mov_r64_imm64(e, RAX, (uint64_t)fn);
+    emit8(e, 0xFF);
+    emit8(e, 0xD0);
+}
+
+/// Returns where the rel8 goes, see patch_rel8().
+static uint8_t *jcc_rel8(jit_emit_t *e, uint8_t cc)
+{
+    emit8(e, 0x70 | cc);
+    emit8(e, 0);
+    return e->p;
+}
+
+static uint8_t *jmp_rel8(jit_emit_t *e)
+{
+    emit8(e, 0xEB);
+    emit8(e, 0);
+    return e->p;
+}
+
+/// Points the jump that ends at from at the current position.
+static void patch_rel8(jit_emit_t *e, uint8_t *from)
+{
+    if (e->full)
+    {
+        return;
+    }
+    const ptrdiff_t rel = e->p - from;
+    assert(rel >= -128 && rel <= 127);
+    from[-1] = (int8_t)rel;
+}
+
+static uint8_t *jcc_rel32(jit_emit_t *e, uint8_t cc)
+{
+    emit8(e, 0x0F);
+    emit8(e, 0x80 | cc);
+    emit32(e, 0);
+    return e->p;
+}
+
+static void patch_rel32(jit_emit_t *e, uint8_t *from, const uint8_t *to)
+{
+    if (e->full)
+    {
+        return;
+    }
+    const int32_t rel = to - from;
+    memcpy(from - 4, &rel, sizeof(rel));
+}
+
+static void jmp_to(jit_emit_t *e, const uint8_t *to)
+{
+    emit8(e, 0xE9);
+    emit32(e, 0);
+    patch_rel32(e, e->p, to);
+}
+
+
+/*
+*   Block structure.
+*/
+static void emit_prologue(jit_emit_t *e)
+{
+    push_r64(e, RBX);
+    push_r64(e, RBP);
+    push_r64(e, R12);
+    push_r64(e, R13);
+    push_r64(e, R14);
+    push_r64(e, R15);
+    /// keeps the stack 16 byte aligned for calls, and is a spare slot for an address.
+    alu_r64_imm32(e, ALU_SUB, RSP, 8);
+
+    mov_r64_r64(e, REG_CPU, RDI);
+    mov_r64_r64(e, REG_JIT, RSI);
+    movzx_r32_m8(e, REG_A, REG_CPU, NO_INDEX, CPU_OFF(reg.A));
+    movzx_r32_m8(e, REG_X, REG_CPU, NO_INDEX, CPU_OFF(reg.X));
+    movzx_r32_m8(e, REG_Y, REG_CPU, NO_INDEX, CPU_OFF(reg.Y));
+    movzx_r32_m8(e, REG_P, REG_CPU, NO_INDEX, CPU_OFF(reg.P));
+}
+
+static void emit_epilogue(jit_emit_t *e)
+{
+    mov_m8_r8(e, REG_CPU, NO_INDEX, CPU_OFF(reg.A), REG_A);
+    mov_m8_r8(e, REG_CPU, NO_INDEX, CPU_OFF(reg.X), REG_X);
+    mov_m8_r8(e, REG_CPU, NO_INDEX, CPU_OFF(reg.Y), REG_Y);
+    mov_m8_r8(e, REG_CPU, NO_INDEX, CPU_OFF(reg.P), REG_P);
+
+    alu_r64_imm32(e, ALU_ADD, RSP, 8);
+    pop_r64(e, R15);
+    pop_r64(e, R14);
+    pop_r64(e, R13);
+    pop_r64(e, R12);
+    pop_r64(e, RBP);
+    pop_r64(e, RBX);
+    emit8(e, 0xC3);
+}
+
+/// Adds the cycles and instructions run so far, PC is stored by the caller.
+static void emit_exit_counts(jit_emit_t *e, uint32_t cycles, uint32_t count)
+{
+    if (cycles)
+    {
+        alu_m_imm32(e, false, ALU_ADD, REG_CPU, CPU_OFF(cycle), cycles);
+        alu_m_imm32(e, true, ALU_ADD, REG_CPU, CPU_OFF(cycle_total), cycles);
+    }
+    alu_m_imm32(e, true, ALU_ADD, REG_CPU, CPU_OFF(debug.count), count);
+}
+
+/// Leave through a stub once the block is done, ie a taken branch.
+static void emit_side_exit(jit_emit_t *e, uint8_t cc, uint16_t pc, uint32_t cycles)
+{
+    if (e->stub_count >= JIT_BLOCK_MAX_STUBS)
+    {
+        e->full = true;
+        return;
+    }
+
+    jit_stub_t *stub = &e->stubs[e->stub_count++];
+    if (cc == CC_ALWAYS)
+    {
+        emit8(e, 0xE9);
+        emit32(e, 0);
+        stub->fixup = e->p;
+    }
+    else
+    {
+        stub->fixup = jcc_rel32(e, cc);
+    }
+    stub->pc = pc;
+    stub->cycles = cycles;
+    stub->count = e->count;
+}
+
+static void emit_stubs(jit_emit_t *e)
+{
+    for (uint32_t i = 0; i < e->stub_count; i++)
+    {
+        const jit_stub_t *stub = &e->stubs[i];
+        patch_rel32(e, stub->fixup, e->p);
+        emit_exit_counts(e, stub->cycles, stub->count);
+
+        /// a loop back to the start stays in the block for as long as another run fits.
+        if (stub->pc == e->block_pc)
+        {
+            mov_r64_m64(e, RAX, REG_CPU, NO_INDEX, 0, CPU_OFF(cycle_total));
+            alu_r64_imm32(e, ALU_ADD, RAX, e->max_cycles);
+            cmp_r64_m64(e, RAX, REG_CPU, CPU_OFF(cycle_deadline));
+            uint8_t *past_deadline = jcc_rel8(e, CC_A);
+            jmp_to(e, e->body);
+            patch_rel8(e, past_deadline);
+        }
+
+        mov_m16_imm16(e, REG_CPU, CPU_OFF(reg.PC), stub->pc);
+        jmp_to(e, e->epilogue);
+    }
+}
+
+/// Stop after this instruction if an io write asked to, see jit_write8().
+static void emit_exit_check(jit_emit_t *e, uint16_t next_pc)
+{
+    cmp_m8_imm8(e, REG_JIT, JIT_OFF(exit), 0);
+    emit_side_exit(e, CC_NZ, next_pc, e->cycles);
+}
+
+
+/*
+*   Flags.
+*/
+/// N and Z from an 8 bit result, P's other bits are kept.
+static void emit_nz(jit_emit_t *e, int reg)
+{
+    alu_r32_imm32(e, ALU_AND, REG_P, (uint8_t)~(BIT7 | BIT1));
+    movzx_r32_r8(e, RDI, reg);
+    or_r8_m8(e, REG_P, REG_JIT, RDI, JIT_OFF(nz));
+}
+
+/// C from the host carry (or its inverse), then N and Z from reg.
+static void emit_cnz(jit_emit_t *e, uint8_t cc, int reg)
+{
+    setcc(e, cc, RDX);
+    alu_r32_imm32(e, ALU_AND, REG_P, (uint8_t)~(BIT7 | BIT1 | BIT0));
+    alu_r8_r8(e, 0x08, REG_P, RDX);
+    movzx_r32_r8(e, RDI, reg);
+    or_r8_m8(e, REG_P, REG_JIT, RDI, JIT_OFF(nz));
+}
+
+
+/// N and Z from an 8 bit result, when they have already been cleared from P.
+static void emit_or_nz(jit_emit_t *e, int reg)
+{
+    movzx_r32_r8(e, RDI, reg);
+    or_r8_m8(e, REG_P, REG_JIT, RDI, JIT_OFF(nz));
+}
+
+
+/*
+*   Bus.
+*/
+typedef enum
+{
+    OPERAND_NONE,
+    OPERAND_IMM, /// the value itself.
+    OPERAND_STATIC, /// a fixed address.
+    OPERAND_DYNAMIC, /// an address in esi.
+} operand_type_t;
+
+typedef struct
+{
+    operand_type_t type;
+    uint16_t addr;
+    int page; /// the page a dynamic address is always in (ie zero page), -1 if it could be any.
+} operand_t;
+
+static bool is_ram(uint16_t addr)
+{
+    return addr <= CPUMemMap_ED_RamMirror;
+}
+
+static void test_r64_r64(jit_emit_t *e, int a, int b)
+{
+    x86_reg(e, true, false, OP(0x85), b, a);
+}
+
+/// The address has to be in esi already.
+static void emit_read_call(jit_emit_t *e)
+{
+    mov_r64_r64(e, RDI, REG_CPU);
+    mov_r32_imm32(e, RDX, e->cycles);
+    call_abs(e, jit_read8);
+    movzx_r32_r8(e, RAX, RAX);
+}
+
+/// Reads the operand into eax, ticking first like read8().
+/// Ram is read directly, it is never remapped and reads of it are never io.
+static void emit_read(jit_emit_t *e, const operand_t *op)
+{
+    e->cycles += 1;
+
+    if (op->type == OPERAND_IMM)
+    {
+        mov_r32_imm32(e, RAX, op->addr);
+        return;
+    }
+
+    if (op->type == OPERAND_STATIC && is_ram(op->addr))
+    {
+        movzx_r32_m8(e, RAX, REG_CPU, NO_INDEX, CPU_OFF(internal_ram) + (op->addr & 0x7FF));
+        return;
+    }
+
+    /// zero page / stack, the address is always below 0x200.
+    if (op->type == OPERAND_DYNAMIC && op->page >= 0 && is_ram(op->page << 8))
+    {
+        movzx_r32_m8(e, RAX, REG_CPU, RSI, CPU_OFF(internal_ram));
+        return;
+    }
+
+    if (op->type == OPERAND_STATIC)
+    {
+        mov_r64_m64(e, RAX, REG_CPU, NO_INDEX, 0, CPU_OFF(read_pages) + (op->addr >> 8) * 8);
+    }
+    else
+    {
+        mov_r32_r32(e, RAX, RSI);
+        shift_r32_imm8(e, SHIFT_SHR, RAX, 8);
+        mov_r64_m64(e, RAX, REG_CPU, RAX, 3, CPU_OFF(read_pages));
+    }
+
+    test_r64_r64(e, RAX, RAX);
+    uint8_t *slow = jcc_rel8(e, CC_Z);
+    if (op->type == OPERAND_STATIC)
+    {
+        movzx_r32_m8(e, RAX, RAX, NO_INDEX, op->addr & 0xFF);
+    }
+    else
+    {
+        movzx_r32_r8(e, RDI, RSI);
+        movzx_r32_m8(e, RAX, RAX, RDI, 0);
+    }
+    uint8_t *done = jmp_rel8(e);
+
+    patch_rel8(e, slow);
+    if (op->type == OPERAND_STATIC)
+    {
+        mov_r32_imm32(e, RSI, op->addr);
+    }
+    emit_read_call(e);
+    patch_rel8(e, done);
+}
+
+/// Writes the low byte of src to the operand, ticking first like write8().
+/// src can't be rax / rdi, or esi for a dynamic address.
+/// Ram goes through the page table as well, as a page of it with decoded code is protected.
+static void emit_write(jit_emit_t *e, const operand_t *op, int src)
+{
+    e->cycles += 1;
+
+    if (op->type == OPERAND_STATIC)
+    {
+        mov_r64_m64(e, RAX, REG_CPU, NO_INDEX, 0, CPU_OFF(write_pages) + (op->addr >> 8) * 8);
+    }
+    else if (op->page >= 0)
+    {
+        mov_r64_m64(e, RAX, REG_CPU, NO_INDEX, 0, CPU_OFF(write_pages) + op->page * 8);
+    }
+    else
+    {
+        mov_r32_r32(e, RAX, RSI);
+        shift_r32_imm8(e, SHIFT_SHR, RAX, 8);
+        mov_r64_m64(e, RAX, REG_CPU, RAX, 3, CPU_OFF(write_pages));
+    }
+
+    test_r64_r64(e, RAX, RAX);
+    uint8_t *slow = jcc_rel8(e, CC_Z);
+    if (op->type == OPERAND_STATIC)
+    {
+        mov_m8_r8(e, RAX, NO_INDEX, op->addr & 0xFF, src);
+    }
+    else
+    {
+        movzx_r32_r8(e, RDI, RSI);
+        mov_m8_r8(e, RAX, RDI, 0, src);
+    }
+    uint8_t *done = jmp_rel8(e);
+
+    patch_rel8(e, slow);
+    movzx_r32_r8(e, RDX, src);
+    if (op->type == OPERAND_STATIC)
+    {
+        mov_r32_imm32(e, RSI, op->addr);
+    }
+    mov_r32_imm32(e, RCX, e->cycles);
+    mov_r64_r64(e, RDI, REG_CPU);
+    call_abs(e, jit_write8);
+    patch_rel8(e, done);
+}
+
+static void mov_m32_r32(jit_emit_t *e, int base, int32_t disp, int src)
+{
+    x86_mem(e, false, false, OP(0x89), src, base, NO_INDEX, 0, disp);
+}
+
+static void mov_r32_m32(jit_emit_t *e, int dst, int base, int32_t disp)
+{
+    x86_mem(e, false, false, OP(0x8B), dst, base, NO_INDEX, 0, disp);
+}
+
+/// esi = 0x100 | SP.
+static void emit_stack_addr(jit_emit_t *e, operand_t *op)
+{
+    movzx_r32_m8(e, RSI, REG_CPU, NO_INDEX, CPU_OFF(reg.SP));
+    alu_r32_imm32(e, ALU_OR, RSI, 0x100);
+    *op = (operand_t){ .type = OPERAND_DYNAMIC, .page = 1 };
+}
+
+static void emit_push(jit_emit_t *e, int src)
+{
+    operand_t op;
+    emit_stack_addr(e, &op);
+    emit_write(e, &op, src);
+    dec_m8(e, REG_CPU, CPU_OFF(reg.SP));
+}
+
+/// Into eax.
+static void emit_pull(jit_emit_t *e)
+{
+    operand_t op;
+    inc_m8(e, REG_CPU, CPU_OFF(reg.SP));
+    emit_stack_addr(e, &op);
+    emit_read(e, &op);
+}
+
+
+/*
+*   Addressing.
+*/
+/// page_cross(), which compares the operand's own address (not the base) with it plus the index.
+static void emit_page_cross(jit_emit_t *e, uint16_t addr, int index)
+{
+    movzx_r32_r8(e, RCX, index);
+    alu_r32_imm32(e, ALU_ADD, RCX, addr);
+    alu_r32_imm32(e, ALU_XOR, RCX, addr);
+    test_r32_imm32(e, RCX, 0x0F00);
+    setcc(e, CC_NZ, RCX);
+    movzx_r32_r8(e, RCX, RCX);
+    add_m_r(e, false, REG_CPU, CPU_OFF(cycle), RCX);
+    add_m_r(e, true, REG_CPU, CPU_OFF(cycle_total), RCX);
+    e->max_cycles += 1;
+}
+
+/// Same cycles and quirks as the addr_*() functions, the address ends up in op.
+static void emit_addressing(jit_emit_t *e, uint8_t mode, uint16_t pc, uint16_t operand, operand_t *op)
+{
+    *op = (operand_t){ .type = OPERAND_NONE, .page = -1 };
+
+    switch (mode)
+    {
+        case AddrType_Acc:
+            e->cycles += 1;
+            break;
+
+        case AddrType_Imp:
+        case AddrType_Rel:
+            break;
+
+        case AddrType_Imm:
+            op->type = OPERAND_IMM;
+            op->addr = operand;
+            break;
+
+        case AddrType_Abs:
+            e->cycles += 2;
+            op->type = OPERAND_STATIC;
+            op->addr = operand;
+            break;
+
+        case AddrType_AbsX:
+        case AddrType_AbsY:
+        {
+            const int index = mode == AddrType_AbsX ? REG_X : REG_Y;
+            emit_page_cross(e, pc + 1, index);
+            e->cycles += 2;
+            movzx_r32_r8(e, RSI, index);
+            alu_r32_imm32(e, ALU_ADD, RSI, operand);
+            alu_r32_imm32(e, ALU_AND, RSI, 0xFFFF);
+            op->type = OPERAND_DYNAMIC;
+        } break;
+
+        case AddrType_ZP:
+            e->cycles += 1;
+            op->type = OPERAND_STATIC;
+            op->addr = operand;
+            break;
+
+        case AddrType_ZPX:
+        case AddrType_ZPY:
+            e->cycles += 1;
+            lea_r32(e, RSI, mode == AddrType_ZPX ? REG_X : REG_Y, operand);
+            movzx_r32_r8(e, RSI, RSI);
+            op->type = OPERAND_DYNAMIC;
+            op->page = 0;
+            break;
+
+        case AddrType_Ind:
+        {
+            e->cycles += 2;
+            const uint16_t hi = (operand & 0xFF) == 0xFF ? operand & 0xFF00 : operand + 1;
+            operand_t ptr = { .type = OPERAND_STATIC, .addr = operand, .page = -1 };
+            emit_read(e, &ptr);
+            mov_m32_r32(e, RSP, 0, RAX);
+            ptr.addr = hi;
+            emit_read(e, &ptr);
+            shift_r32_imm8(e, SHIFT_SHL, RAX, 8);
+            x86_mem(e, false, false, OP(0x0B), RAX, RSP, NO_INDEX, 0, 0);
+            mov_r32_r32(e, RSI, RAX);
+            op->type = OPERAND_DYNAMIC;
+        } break;
+
+        case AddrType_IndZPX:
+            e->cycles += 1 + 2 + 2;
+            lea_r32(e, RCX, REG_X, operand);
+            movzx_r32_r8(e, RCX, RCX);
+            movzx_r32_m8(e, RSI, REG_CPU, RCX, CPU_OFF(internal_ram));
+            inc_r8(e, RCX);
+            movzx_r32_m8(e, RCX, REG_CPU, RCX, CPU_OFF(internal_ram));
+            shift_r32_imm8(e, SHIFT_SHL, RCX, 8);
+            x86_reg(e, false, false, OP(0x09), RCX, RSI);
+            op->type = OPERAND_DYNAMIC;
+            break;
+
+        case AddrType_IndZPY:
+            e->cycles += 1 + 2 + 2;
+            movzx_r32_m8(e, RSI, REG_CPU, NO_INDEX, CPU_OFF(internal_ram) + operand);
+            movzx_r32_m8(e, RCX, REG_CPU, NO_INDEX, CPU_OFF(internal_ram) + ((operand + 1) & 0xFF));
+            shift_r32_imm8(e, SHIFT_SHL, RCX, 8);
+            x86_reg(e, false, false, OP(0x09), RCX, RSI);
+            movzx_r32_r8(e, RCX, REG_Y);
+            x86_reg(e, false, false, OP(0x01), RCX, RSI);
+            alu_r32_imm32(e, ALU_AND, RSI, 0xFFFF);
+            op->type = OPERAND_DYNAMIC;
+            break;
+    }
+}
+
+
+/*
+*   Instructions.
+*/
+typedef enum
+{
+    JIT_INS_NONE,
+    JIT_INS_ADC, JIT_INS_AND, JIT_INS_ASL, JIT_INS_ASL_A, JIT_INS_BCC, JIT_INS_BCS, JIT_INS_BEQ,
+    JIT_INS_BIT, JIT_INS_BMI, JIT_INS_BNE, JIT_INS_BPL, JIT_INS_BVC, JIT_INS_BVS, JIT_INS_CLC,
+    JIT_INS_CLD, JIT_INS_CLI, JIT_INS_CLV, JIT_INS_CMP, JIT_INS_CPX, JIT_INS_CPY, JIT_INS_DEC,
+    JIT_INS_DEX, JIT_INS_DEY, JIT_INS_EOR, JIT_INS_INC, JIT_INS_INX, JIT_INS_INY, JIT_INS_JMP,
+    JIT_INS_JSR, JIT_INS_LDA, JIT_INS_LDX, JIT_INS_LDY, JIT_INS_LSR, JIT_INS_LSR_A, JIT_INS_NOP,
+    JIT_INS_ORA, JIT_INS_PHA, JIT_INS_PHP, JIT_INS_PLA, JIT_INS_PLP, JIT_INS_ROL, JIT_INS_ROL_A,
+    JIT_INS_ROR, JIT_INS_ROR_A, JIT_INS_RTI, JIT_INS_RTS, JIT_INS_SBC, JIT_INS_SEC, JIT_INS_SED,
+    JIT_INS_SEI, JIT_INS_STA, JIT_INS_STX, JIT_INS_STY, JIT_INS_TAX, JIT_INS_TAY, JIT_INS_TSX,
+    JIT_INS_TXA, JIT_INS_TXS, JIT_INS_TYA,
+} jit_ins_t;
+
+typedef struct
+{
+    uint8_t ins; /// jit_ins_t, JIT_INS_NONE if not implemented.
+    uint8_t mode; /// AddrType.
+} jit_opcode_t;
+
+#define JIT_OPCODE_ENTRY(code, mode, ins) [code] = { JIT_INS_##ins, AddrType_##mode },
+
+static const jit_opcode_t jit_opcodes[0x100] =
+{
+    CPU_OPCODE_LIST(JIT_OPCODE_ENTRY)
+};
+
+static uint8_t jit_mode_length(uint8_t mode)
+{
+    switch (mode)
+    {
+        case AddrType_Acc: case AddrType_Imp:
+            return 1;
+        case AddrType_Abs: case AddrType_AbsX: case AddrType_AbsY: case AddrType_Ind:
+            return 3;
+        default:
+            return 2;
+    }
+}
+
+typedef enum
+{
+    JIT_STOP, /// not compiled, the block ends before it.
+    JIT_CONTINUE,
+    JIT_END_STATIC, /// jumps to a fixed pc.
+    JIT_END_DYNAMIC, /// jumps to the pc in ax.
+} jit_result_t;
+
+static bool ins_writes(uint8_t ins)
+{
+    switch (ins)
+    {
+        case JIT_INS_STA: case JIT_INS_STX: case JIT_INS_STY:
+        case JIT_INS_ASL: case JIT_INS_LSR: case JIT_INS_ROL: case JIT_INS_ROR:
+        case JIT_INS_INC: case JIT_INS_DEC:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/// A taken branch leaves through a stub, an untaken one carries on in the block.
+static void emit_branch(jit_emit_t *e, uint16_t pc, uint8_t offset, uint8_t flag, bool set)
+{
+    const uint16_t next = pc + 2;
+    const uint16_t target = next + (int8_t)offset;
+    const uint32_t cross = (next & 0x0F00) != (target & 0x0F00);
+
+    /// the offset read.
+    e->cycles += 1;
+    test_r32_imm32(e, REG_P, flag);
+    emit_side_exit(e, set ? CC_NZ : CC_Z, target, e->cycles + cross + 1 + 1);
+    e->max_cycles += cross + 1;
+    e->cycles += 1;
+
+    /// wherever the block starts, the interpreter has to run the branch to skip the loop.
+    if (cpu_idle_loop(e->cpu, target, pc))
+    {
+        e->idle = true;
+    }
+}
+
+static void emit_load(jit_emit_t *e, const operand_t *op, int dst)
+{
+    emit_read(e, op);
+    mov_r32_r32(e, dst, RAX);
+    emit_nz(e, dst);
+    e->cycles += 1;
+}
+
+static void emit_compare(jit_emit_t *e, const operand_t *op, int reg)
+{
+    emit_read(e, op);
+    mov_r32_r32(e, RCX, reg);
+    alu_r8_r8(e, 0x28, RCX, RAX);
+    emit_cnz(e, CC_NC, RCX);
+    e->cycles += 1;
+}
+
+static void emit_logic(jit_emit_t *e, const operand_t *op, uint8_t alu)
+{
+    emit_read(e, op);
+    alu_r8_r8(e, alu, REG_A, RAX);
+    emit_nz(e, REG_A);
+    e->cycles += 1;
+}
+
+static void emit_adc(jit_emit_t *e, const operand_t *op, bool sbc)
+{
+    emit_read(e, op);
+    if (sbc)
+    {
+        not_r8(e, RAX);
+    }
+    /// x86's carry and overflow are the same as the 6502's (in binary mode).
+    bt_r32_imm8(e, REG_P, 0);
+    alu_r8_r8(e, 0x10, REG_A, RAX);
+    setcc(e, CC_C, RCX);
+    setcc(e, CC_O, RDX);
+    alu_r32_imm32(e, ALU_AND, REG_P, (uint8_t)~(BIT7 | BIT6 | BIT1 | BIT0));
+    alu_r8_r8(e, 0x08, REG_P, RCX);
+    shift_r8_imm8(e, SHIFT_SHL, RDX, 6);
+    alu_r8_r8(e, 0x08, REG_P, RDX);
+    emit_or_nz(e, REG_A);
+    e->cycles += 1;
+}
+
+static void emit_bit(jit_emit_t *e, const operand_t *op)
+{
+    emit_read(e, op);
+    alu_r32_imm32(e, ALU_AND, REG_P, (uint8_t)~(BIT7 | BIT6 | BIT1));
+    mov_r32_r32(e, RCX, RAX);
+    alu_r32_imm32(e, ALU_AND, RCX, BIT7 | BIT6);
+    alu_r8_r8(e, 0x08, REG_P, RCX);
+    alu_r8_r8(e, 0x84, REG_A, RAX);
+    setcc(e, CC_Z, RCX);
+    alu_r8_r8(e, 0x00, RCX, RCX);
+    alu_r8_r8(e, 0x08, REG_P, RCX);
+    e->cycles += 1;
+}
+
+static void emit_shift_a(jit_emit_t *e, uint8_t shift)
+{
+    if (shift == SHIFT_RCL || shift == SHIFT_RCR)
+    {
+        bt_r32_imm8(e, REG_P, 0);
+    }
+    shift_r8_1(e, shift, REG_A);
+    emit_cnz(e, CC_C, REG_A);
+    e->cycles += 2;
+}
+
+/// ASL / LSR / ROL / ROR / INC / DEC on memory, read -> modify -> write.
+static void emit_rmw(jit_emit_t *e, const operand_t *op, uint8_t ins)
+{
+    /// the read can call out, which doesn't keep esi.
+    const bool save_addr = op->type == OPERAND_DYNAMIC;
+    if (save_addr)
+    {
+        mov_m32_r32(e, RSP, 0, RSI);
+    }
+
+    emit_read(e, op);
+    mov_r32_r32(e, RCX, RAX);
+
+    switch (ins)
+    {
+        case JIT_INS_ASL:
+            shift_r8_1(e, SHIFT_SHL, RCX);
+            emit_cnz(e, CC_C, RCX);
+            break;
+
+        case JIT_INS_LSR:
+            shift_r8_1(e, SHIFT_SHR, RCX);
+            emit_cnz(e, CC_C, RCX);
+            break;
+
+        case JIT_INS_ROL:
+        case JIT_INS_ROR:
+            /// Z comes from A rather than the result, same as ROL() / ROR().
+            bt_r32_imm8(e, REG_P, 0);
+            shift_r8_1(e, ins == JIT_INS_ROL ? SHIFT_RCL : SHIFT_RCR, RCX);
+            setcc(e, CC_C, RDX);
+            alu_r32_imm32(e, ALU_AND, REG_P, (uint8_t)~(BIT7 | BIT1 | BIT0));
+            alu_r8_r8(e, 0x08, REG_P, RDX);
+            mov_r32_r32(e, RDX, RCX);
+            alu_r32_imm32(e, ALU_AND, RDX, BIT7);
+            alu_r8_r8(e, 0x08, REG_P, RDX);
+            alu_r8_r8(e, 0x84, REG_A, REG_A);
+            setcc(e, CC_Z, RDX);
+            alu_r8_r8(e, 0x00, RDX, RDX);
+            alu_r8_r8(e, 0x08, REG_P, RDX);
+            break;
+
+        case JIT_INS_INC:
+            inc_r8(e, RCX);
+            emit_nz(e, RCX);
+            break;
+
+        case JIT_INS_DEC:
+            dec_r8(e, RCX);
+            emit_nz(e, RCX);
+            break;
+    }
+
+    if (save_addr)
+    {
+        mov_r32_m32(e, RSI, RSP, 0);
+    }
+
+    emit_write(e, op, RCX);
+    e->cycles += 2;
+}
+
+static void emit_flag(jit_emit_t *e, uint8_t flag, bool set)
+{
+    alu_r32_imm32(e, set ? ALU_OR : ALU_AND, REG_P, set ? flag : (uint8_t)~flag);
+    e->cycles += 2;
+}
+
+static void emit_transfer(jit_emit_t *e, int dst, int src)
+{
+    mov_r32_r32(e, dst, src);
+    emit_nz(e, dst);
+    e->cycles += 2;
+}
+
+static void emit_inc_dec(jit_emit_t *e, int reg, bool inc)
+{
+    if (inc)
+    {
+        inc_r8(e, reg);
+    }
+    else
+    {
+        dec_r8(e, reg);
+    }
+    emit_nz(e, reg);
+    e->cycles += 2;
+}
+
+/// P as pulled by PLP / RTI.
+static void emit_pull_p(jit_emit_t *e)
+{
+    emit_pull(e);
+    mov_r32_r32(e, REG_P, RAX);
+    alu_r32_imm32(e, ALU_AND, REG_P, (uint8_t)~BIT4);
+    alu_r32_imm32(e, ALU_OR, REG_P, BIT5);
+}
+
+/// Compiles the instruction at pc, *next is where the block carries on / jumps to.
+static jit_result_t compile_instruction(jit_emit_t *e, uint16_t pc, uint16_t *next)
+{
+    const uint8_t lo = pc & 0xFF;
+    const jit_opcode_t *info = &jit_opcodes[e->mem[lo]];
+    if (info->ins == JIT_INS_NONE)
+    {
+        return JIT_STOP;
+    }
+
+    /// the operand bytes have to be in this page, same as the decode cache.
+    const uint8_t length = jit_mode_length(info->mode);
+    if (lo + length > CPU_PAGE_SIZE)
+    {
+        return JIT_STOP;
+    }
+
+    uint16_t operand = 0;
+    if (length > 1)
+    {
+        operand = e->mem[lo + 1];
+    }
+    if (length > 2)
+    {
+        operand |= e->mem[lo + 2] << 8;
+    }
+
+    /// blocks full of io are left to the interpreter, see compile().
+    if ((info->mode == AddrType_Abs || info->mode == AddrType_ZP) && info->ins != JIT_INS_JMP &&
+        info->ins != JIT_INS_JSR && !is_ram(operand))
+    {
+        const uint8_t page = operand >> 8;
+        if (!e->cpu->read_pages[page] || (ins_writes(info->ins) && !e->cpu->write_pages[page]))
+        {
+            e->io++;
+        }
+    }
+
+    e->count++;
+    *next = pc + length;
+
+    operand_t op;
+    emit_addressing(e, info->mode, pc, operand, &op);
+
+    switch (info->ins)
+    {
+        case JIT_INS_LDA: emit_load(e, &op, REG_A); break;
+        case JIT_INS_LDX: emit_load(e, &op, REG_X); break;
+        case JIT_INS_LDY: emit_load(e, &op, REG_Y); break;
+
+        case JIT_INS_STA:
+        case JIT_INS_STX:
+        case JIT_INS_STY:
+            emit_write(e, &op, info->ins == JIT_INS_STA ? REG_A : info->ins == JIT_INS_STX ? REG_X : REG_Y);
+            e->cycles += 1;
+            emit_exit_check(e, *next);
+            break;
+
+        case JIT_INS_ADC: emit_adc(e, &op, false); break;
+        case JIT_INS_SBC: emit_adc(e, &op, true); break;
+        case JIT_INS_AND: emit_logic(e, &op, 0x20); break;
+        case JIT_INS_ORA: emit_logic(e, &op, 0x08); break;
+        case JIT_INS_EOR: emit_logic(e, &op, 0x30); break;
+        case JIT_INS_CMP: emit_compare(e, &op, REG_A); break;
+        case JIT_INS_CPX: emit_compare(e, &op, REG_X); break;
+        case JIT_INS_CPY: emit_compare(e, &op, REG_Y); break;
+        case JIT_INS_BIT: emit_bit(e, &op); break;
+
+        case JIT_INS_ASL_A: emit_shift_a(e, SHIFT_SHL); break;
+        case JIT_INS_LSR_A: emit_shift_a(e, SHIFT_SHR); break;
+        case JIT_INS_ROL_A: emit_shift_a(e, SHIFT_RCL); break;
+        case JIT_INS_ROR_A: emit_shift_a(e, SHIFT_RCR); break;
+
+        case JIT_INS_ASL:
+        case JIT_INS_LSR:
+        case JIT_INS_ROL:
+        case JIT_INS_ROR:
+        case JIT_INS_INC:
+        case JIT_INS_DEC:
+            emit_rmw(e, &op, info->ins);
+            emit_exit_check(e, *next);
+            break;
+
+        case JIT_INS_BCC: emit_branch(e, pc, operand, BIT0, false); break;
+        case JIT_INS_BCS: emit_branch(e, pc, operand, BIT0, true); break;
+        case JIT_INS_BNE: emit_branch(e, pc, operand, BIT1, false); break;
+        case JIT_INS_BEQ: emit_branch(e, pc, operand, BIT1, true); break;
+        case JIT_INS_BVC: emit_branch(e, pc, operand, BIT6, false); break;
+        case JIT_INS_BVS: emit_branch(e, pc, operand, BIT6, true); break;
+        case JIT_INS_BPL: emit_branch(e, pc, operand, BIT7, false); break;
+        case JIT_INS_BMI: emit_branch(e, pc, operand, BIT7, true); break;
+
+        case JIT_INS_CLC: emit_flag(e, BIT0, false); break;
+        case JIT_INS_SEC: emit_flag(e, BIT0, true); break;
+        case JIT_INS_CLI: emit_flag(e, BIT2, false); break;
+        case JIT_INS_SEI: emit_flag(e, BIT2, true); break;
+        case JIT_INS_CLD: emit_flag(e, BIT3, false); break;
+        case JIT_INS_SED: emit_flag(e, BIT3, true); break;
+        case JIT_INS_CLV: emit_flag(e, BIT6, false); break;
+
+        case JIT_INS_NOP: e->cycles += 2; break;
+
+        case JIT_INS_TAX: emit_transfer(e, REG_X, REG_A); break;
+        case JIT_INS_TAY: emit_transfer(e, REG_Y, REG_A); break;
+        case JIT_INS_TXA: emit_transfer(e, REG_A, REG_X); break;
+        case JIT_INS_TYA: emit_transfer(e, REG_A, REG_Y); break;
+
+        case JIT_INS_TSX:
+            movzx_r32_m8(e, REG_X, REG_CPU, NO_INDEX, CPU_OFF(reg.SP));
+            emit_nz(e, REG_X);
+            e->cycles += 2;
+            break;
+
+        case JIT_INS_TXS:
+            mov_m8_r8(e, REG_CPU, NO_INDEX, CPU_OFF(reg.SP), REG_X);
+            e->cycles += 2;
+            break;
+
+        case JIT_INS_INX: emit_inc_dec(e, REG_X, true); break;
+        case JIT_INS_DEX: emit_inc_dec(e, REG_X, false); break;
+        case JIT_INS_INY: emit_inc_dec(e, REG_Y, true); break;
+        case JIT_INS_DEY: emit_inc_dec(e, REG_Y, false); break;
+
+        case JIT_INS_PHA:
+            emit_push(e, REG_A);
+            e->cycles += 2;
+            emit_exit_check(e, *next);
+            break;
+
+        case JIT_INS_PHP:
+            mov_r32_r32(e, RCX, REG_P);
+            alu_r32_imm32(e, ALU_OR, RCX, BIT4);
+            emit_push(e, RCX);
+            e->cycles += 2;
+            emit_exit_check(e, *next);
+            break;
+
+        case JIT_INS_PLA:
+            emit_pull(e);
+            mov_r32_r32(e, REG_A, RAX);
+            emit_nz(e, REG_A);
+            e->cycles += 3;
+            break;
+
+        case JIT_INS_PLP:
+            emit_pull_p(e);
+            e->cycles += 3;
+            break;
+
+        case JIT_INS_JSR:
+        {
+            /// PC - 1, ie the last byte of the jsr.
+            const uint16_t ret = pc + 2;
+            mov_r32_imm32(e, RCX, ret >> 8);
+            emit_push(e, RCX);
+            mov_r32_imm32(e, RCX, ret & 0xFF);
+            emit_push(e, RCX);
+            e->cycles += 2;
+            *next = operand;
+        } return JIT_END_STATIC;
+
+        case JIT_INS_RTS:
+            emit_pull(e);
+            mov_r32_r32(e, RCX, RAX);
+            emit_pull(e);
+            shift_r32_imm8(e, SHIFT_SHL, RAX, 8);
+            x86_reg(e, false, false, OP(0x09), RCX, RAX);
+            alu_r32_imm32(e, ALU_ADD, RAX, 1);
+            e->cycles += 4;
+            return JIT_END_DYNAMIC;
+
+        case JIT_INS_RTI:
+            emit_pull_p(e);
+            emit_pull(e);
+            mov_r32_r32(e, RCX, RAX);
+            emit_pull(e);
+            shift_r32_imm8(e, SHIFT_SHL, RAX, 8);
+            x86_reg(e, false, false, OP(0x09), RCX, RAX);
+            e->cycles += 3;
+            return JIT_END_DYNAMIC;
+
+        case JIT_INS_JMP:
+            e->cycles += 1;
+            if (op.type == OPERAND_STATIC)
+            {
+                *next = op.addr;
+                e->idle |= cpu_idle_loop(e->cpu, op.addr, pc) != 0;
+                return JIT_END_STATIC;
+            }
+            mov_r32_r32(e, RAX, RSI);
+            return JIT_END_DYNAMIC;
+    }
+
+    return JIT_CONTINUE;
+}
+
+
+/*
+*   Dispatch.
+*/
+/// Compiles the block starting at pc, the entry is left without a block if it can't be.
+static jit_entry_t *compile(jit_t *jit, cpu_t *cpu, uint16_t pc)
+{
+    const uint8_t page = pc >> 8;
+
+    if (jit->code_used + JIT_BLOCK_MAX_SIZE > JIT_CODE_SIZE)
+    {
+        jit_flush(jit);
+    }
+
+    jit_page_t *jit_page = jit->pages[page];
+    if (!jit_page)
+    {
+        jit_page = calloc(1, sizeof(jit_page_t));
+        if (!jit_page)
+        {
+            return NULL;
+        }
+
+        /// only rom, code in ram can change under the block.
+        jit_page->interpret = is_ram(pc) || !cpu->read_pages[page] || cpu->write_pages[page] || cpu->code_pages[page];
+        jit->pages[page] = jit_page;
+    }
+
+    jit_entry_t *entry = &jit_page->entries[pc & 0xFF];
+    entry->compiled = true;
+    if (jit_page->interpret)
+    {
+        return entry;
+    }
+
+    if (mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_WRITE) != 0)
+    {
+        return entry;
+    }
+
+    jit_emit_t e = {0};
+    e.cpu = cpu;
+    e.mem = cpu->read_pages[page];
+    e.start = e.p = jit->code + jit->code_used;
+    e.end = e.start + JIT_BLOCK_MAX_SIZE;
+    e.block_pc = pc;
+
+    emit_prologue(&e);
+    e.body = e.p;
+
+    uint16_t at = pc;
+    jit_result_t result = JIT_CONTINUE;
+    while (e.count < JIT_BLOCK_MAX_INSTRUCTIONS && !e.full)
+    {
+        uint16_t next = 0;
+        result = compile_instruction(&e, at, &next);
+        if (result == JIT_STOP)
+        {
+            break;
+        }
+
+        at = next;
+        if (result != JIT_CONTINUE || (at >> 8) != page)
+        {
+            break;
+        }
+    }
+
+    /// a jump to a fixed pc is just a stub that is always taken, so a loop back to the start stays in the block.
+    if (result == JIT_END_STATIC)
+    {
+        emit_side_exit(&e, CC_ALWAYS, at, e.cycles);
+    }
+    else if (result == JIT_END_DYNAMIC)
+    {
+        mov_m16_r16(&e, REG_CPU, CPU_OFF(reg.PC), RAX);
+        emit_exit_counts(&e, e.cycles, e.count);
+    }
+    else
+    {
+        mov_m16_imm16(&e, REG_CPU, CPU_OFF(reg.PC), at);
+        emit_exit_counts(&e, e.cycles, e.count);
+    }
+
+    e.epilogue = e.p;
+    emit_epilogue(&e);
+    e.max_cycles += e.cycles;
+    emit_stubs(&e);
+
+    mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC);
+
+    if (e.full || e.count == 0 || e.io * 2 > e.count || e.idle)
+    {
+        return entry;
+    }
+
+    entry->block = (jit_block_cb)e.start;
+    entry->max_cycles = e.max_cycles;
+    jit->code_used = (e.p - jit->code + 15) & ~(size_t)15;
+
+    return entry;
+}
+
+int jit_run(jit_t *jit, cpu_t *cpu)
+{
+    const uint16_t pc = cpu->reg.PC;
+    const jit_page_t *page = jit->pages[pc >> 8];
+    const jit_entry_t *entry = page ? &page->entries[pc & 0xFF] : NULL;
+
+    if (!entry || !entry->compiled)
+    {
+        entry = compile(jit, cpu, pc);
+        if (!entry)
+        {
+            return -1;
+        }
+    }
+
+    /// the block can't stop part way for the deadline, so it only runs if all of it fits.
+    if (!entry->block || cpu->cycle_total + entry->max_cycles > cpu->cycle_deadline)
+    {
+        return -1;
+    }
+
+    entry->block(cpu, jit);
+    jit->exit = 0;
+
+    return 0;
+}
+
+#endif
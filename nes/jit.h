@@ -0,0 +1,52 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+
+/// Basic block recompiler, 6502 -> x86-64.
+/// Code that runs from prg-rom is translated a block at a time (straight line code,
+/// carrying on past untaken branches) into native code that keeps A / X / Y / P in host
+/// registers, and does every bus access through the cpu's page table, only calling out
+/// for io. Cycles are counted at compile time and added when the block exits, io calls
+/// are given the cycles so far so the ppu / apu catch up to the exact same cycle.
+///
+/// Anything else is left to the interpreter: code in ram (which can be self modifying),
+/// blocks that are mostly io register accesses, idle loops (which the interpreter skips, see
+/// cpu_set_idle_skip()), and the last few instructions before a deadline, as a block only
+/// runs if it can't go past it.
+/// A write that pulls the deadline in (nmi) or makes the mapper switch banks ends the block.
+///
+/// Build with -DCPU_JIT=0 to leave it out, it is only available on x86-64 linux.
+#ifndef CPU_JIT
+    #if defined(__x86_64__) && defined(__linux__)
+        #define CPU_JIT 1
+    #else
+        #define CPU_JIT 0
+    #endif
+#endif
+
+/// Returns NULL if the code buffer couldn't be mapped.
+jit_t *jit_init();
+void jit_exit(jit_t *jit);
+
+/// Runs the block at PC, compiling it first if needed.
+/// Returns -1 without running anything if there is no block here, or it
+/// could run past cpu->cycle_deadline, the caller then interprets an instruction instead.
+int jit_run(jit_t *jit, cpu_t *cpu);
+
+/// Drops every block compiled from this page, called when it is remapped.
+void jit_invalidate_page(jit_t *jit, uint8_t page);
+
+/// Provided by cpu.c, read8() / write8() for addresses with no page, without the tick.
+uint8_t cpu_read8_io(cpu_t *cpu, uint16_t addr);
+void cpu_write8_io(cpu_t *cpu, uint16_t addr, uint8_t v);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "joypad.h"
+
+int joypad_init(joypad_t *joypad)
+{
+    memset(joypad, 0, sizeof(joypad_t));
+    return 0;
+}
+
+int joypad_reset(joypad_t *joypad)
+{
+    memset(joypad, 0, sizeof(joypad_t));
+    return 0;
+}
+
+void joypad_set_buttons(joypad_t *joypad, uint8_t port, uint8_t buttons)
+{
+    assert(port < JOYPAD_PORTS);
+    joypad->buttons[port] = buttons;
+
+    /// while strobe is high, the shift register keeps reloading.
+    if (joypad->strobe)
+    {
+        joypad->shift[port] = buttons;
+    }
+}
+
+/// https://wiki.nesdev.com/w/index.php/Standard_controller
+uint8_t joypad_read(joypad_t *joypad, uint8_t port)
+{
+    assert(port < JOYPAD_PORTS);
+
+    if (joypad->strobe)
+    {
+        return joypad->buttons[port] & 1;
+    }
+
+    /// after 8 reads, official pads return 1.
+    const uint8_t v = joypad->shift[port] & 1;
+    joypad->shift[port] = (joypad->shift[port] >> 1) | 0x80;
+    return v;
+}
+
+void joypad_write(joypad_t *joypad, uint8_t v)
+{
+    joypad->strobe = v & 1;
+
+    if (joypad->strobe)
+    {
+        joypad->shift[0] = joypad->buttons[0];
+        joypad->shift[1] = joypad->buttons[1];
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/// Button bits, in the order the shift register returns them.
+typedef enum
+{
+    JoypadButton_A      = 1 << 0,
+    JoypadButton_B      = 1 << 1,
+    JoypadButton_Select = 1 << 2,
+    JoypadButton_Start  = 1 << 3,
+    JoypadButton_Up     = 1 << 4,
+    JoypadButton_Down   = 1 << 5,
+    JoypadButton_Left   = 1 << 6,
+    JoypadButton_Right  = 1 << 7,
+} JoypadButton;
+
+#define JOYPAD_PORTS 2
+
+typedef struct
+{
+    uint8_t buttons[JOYPAD_PORTS]; /// what is currently held.
+    uint8_t shift[JOYPAD_PORTS];   /// latched on strobe, shifted out on read.
+    uint8_t strobe;
+} joypad_t;
+
+int joypad_init(joypad_t *joypad);
+int joypad_reset(joypad_t *joypad);
+
+void joypad_set_buttons(joypad_t *joypad, uint8_t port, uint8_t buttons);
+
+uint8_t joypad_read(joypad_t *joypad, uint8_t port);
+void joypad_write(joypad_t *joypad, uint8_t v);
+
+#ifdef __cplusplus
+}
+#endif
@@ -5,8 +5,10 @@
 #include <string.h>
 #include <assert.h>
 
+#include "nes.h"
 #include "mapper.h"
 #include "cart.h"
+#include "cpu.h"
 #include "mappers/mapper_0.h"
 
 /// NOTES:
@@ -42,61 +44,41 @@
 /// Like maybe i want to read, write or dump stuff.
 /// Probably overkill though, I could just assign the read write functions + the save / dump functions.
 
-static mapper_t *mapper = NULL;
+/// UPDATE:
+/// The cpu now has a page table, so the mapper maps its prg banks straight into the cpu with cpu_map_pages().
+/// Reads / writes to those pages never reach the mapper, they are a single load from the table.
+/// On a bank switch, the mapper just calls cpu_map_pages() again for the pages that changed.
+/// The read / write callbacks are only called for pages that are left unmapped, such as mapper registers.
 
-void mapper_unset();
-
-int mapper_init()
+int mapper_init(nes_t *nes)
 {
-    assert(mapper == NULL);
-    if (mapper)
-    {
-        fprintf(stderr, "mapper already initialised\n");
-        return -1;
-    }
-
-    mapper = malloc(sizeof(mapper_t));
-    assert(mapper);
-    if (!mapper)
-    {
-        fprintf(stderr, "Failed to alloc mapper\n");
-        return -1;
-    }
+    mapper_t *mapper = &nes->mapper;
 
+    mapper->pgr_rom = NULL;
+    mapper->chr_rom = NULL;
+    mapper->pgr_rom_size = 0;
+    mapper->chr_rom_size = 0;
     mapper->read = NULL;
     mapper->write = NULL;
     mapper->dump = NULL;
+    mapper->remap = NULL;
     mapper->type = Mapper_NONE;
+    memset(mapper->state, 0, MAPPER_STATE_SIZE);
 
     return 0;
 }
 
-void mapper_exit()
+void mapper_exit(nes_t *nes)
 {
-    assert(mapper);
-    if (!mapper)
-    {
-        fprintf(stderr, "mapper not initialised\n");
-        return;
-    }
-
-    if (mapper->type != Mapper_NONE)
+    if (nes->mapper.type != Mapper_NONE)
     {
-        mapper_unset();
+        mapper_unset(nes);
     }
-
-    free(mapper);
-    mapper = NULL;
 }
 
-int mapper_reset()
+int mapper_reset(nes_t *nes)
 {
-    assert(mapper);
-    if (!mapper)
-    {
-        fprintf(stderr, "mapper not initialised\n");
-        return -1;
-    }
+    mapper_t *mapper = &nes->mapper;
 
     assert(mapper->type != Mapper_NONE);
     if (mapper->type == Mapper_NONE)
@@ -121,14 +103,9 @@ bool mapper_is_avaliable(Mapper mapper_type)
     }
 }
 
-int mapper_set(const rom_header_t *header)
+int mapper_set(nes_t *nes, const rom_header_t *header, uint8_t *rom, uint32_t size)
 {
-    assert(mapper);
-    if (!mapper)
-    {
-        fprintf(stderr, "mapper not initialised\n");
-        return -1;
-    }
+    mapper_t *mapper = &nes->mapper;
 
     assert(header);
     if (!header)
@@ -139,12 +116,34 @@ int mapper_set(const rom_header_t *header)
 
     if (mapper->type != Mapper_NONE)
     {
-        mapper_unset();
+        mapper_unset(nes);
+    }
+
+    mapper->pgr_rom_size = header->prg_rom_size * 0x4000;
+    mapper->chr_rom_size = header->chr_rom_size * 0x2000;
+
+    if (mapper->pgr_rom_size + mapper->chr_rom_size > size)
+    {
+        fprintf(stderr, "rom is smaller than the header says PRG:0x%X CHR:0x%X SIZE:0x%X\n", mapper->pgr_rom_size, mapper->chr_rom_size, size);
+        return -1;
+    }
+
+    mapper->pgr_rom = rom;
+    mapper->chr_rom = rom + mapper->pgr_rom_size;
+
+    /// mappers that switch mirroring set it again themselves.
+    if (header->flags6.hw_four_screen_mode)
+    {
+        ppu_set_mirroring(&nes->ppu, PPUMirroring_FourScreen);
+    }
+    else
+    {
+        ppu_set_mirroring(&nes->ppu, header->flags6.hw_nametable_type ? PPUMirroring_Vertical : PPUMirroring_Horizontal);
     }
 
     switch (header->flags6.mapper_number)
     {
-        case Mapper_0:  return mapper_0_init(mapper);
+        case Mapper_0:  return mapper_0_init(nes);
 
         default:
             fprintf(stderr, "mapper not yet supported\n");
@@ -153,14 +152,9 @@ int mapper_set(const rom_header_t *header)
     }
 }
 
-void mapper_unset()
+void mapper_unset(nes_t *nes)
 {
-    assert(mapper);
-    if (!mapper)
-    {
-        fprintf(stderr, "mapper not initialised\n");
-        return;
-    }
+    mapper_t *mapper = &nes->mapper;
 
     assert(mapper->type != Mapper_NONE);
     if (mapper->type == Mapper_NONE)
@@ -171,7 +165,7 @@ void mapper_unset()
 
     switch (mapper->type)
     {
-        case Mapper_0:  mapper_0_exit();    break;
+        case Mapper_0:  mapper_0_exit(nes); break;
 
         default:
             fprintf(stderr, "mapper not yet supported\n");
@@ -179,18 +173,33 @@ void mapper_unset()
             break;
     }
 
+    /// everything from the expansion area up belongs to the cart, and so do the pattern tables.
+    cpu_unmap_pages(nes, 0x4100, 0x10000 - 0x4100);
+    ppu_map_chr(&nes->ppu, 0x0000, 0x2000, NULL, false);
+
+    mapper->pgr_rom = NULL;
+    mapper->chr_rom = NULL;
+    mapper->pgr_rom_size = 0;
+    mapper->chr_rom_size = 0;
     mapper->read = NULL;
     mapper->write = NULL;
     mapper->dump = NULL;
+    mapper->remap = NULL;
     mapper->type = Mapper_NONE;
+    memset(mapper->state, 0, MAPPER_STATE_SIZE);
 }
 
-uint8_t mapper_read(uint16_t addr)
+uint8_t mapper_read(nes_t *nes, uint16_t addr)
 {
-    return mapper->read(addr);
+    return nes->mapper.read(nes, addr);
 }
 
-void mapper_write(uint16_t addr, uint8_t v)
+void mapper_write(nes_t *nes, uint16_t addr, uint8_t v)
 {
-    mapper->write(addr, v);
-}
\ No newline at end of file
+    nes->mapper.write(nes, addr, v);
+}
+
+void mapper_remap(nes_t *nes)
+{
+    nes->mapper.remap(nes);
+}
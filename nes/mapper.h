@@ -16,31 +16,45 @@ typedef enum
     Mapper_NONE = 0xFF,
 } Mapper;
 
-typedef uint8_t (*mapper_read_cb)(uint16_t addr);
-typedef void (*mapper_write_cb)(uint16_t addr, uint8_t v);
-typedef void (*mapper_dump_cb)(void);
+typedef uint8_t (*mapper_read_cb)(nes_t *nes, uint16_t addr);
+typedef void (*mapper_write_cb)(nes_t *nes, uint16_t addr, uint8_t v);
+typedef void (*mapper_dump_cb)(nes_t *nes);
+typedef void (*mapper_remap_cb)(nes_t *nes);
+
+/// Bank registers etc, anything a mapper needs to rebuild its memory map.
+/// This is all that is kept of the mapper in a save state.
+#define MAPPER_STATE_SIZE 32
 
 typedef struct
 {
+    uint8_t *pgr_rom;
+    uint8_t *chr_rom;
     uint32_t pgr_rom_size;
     uint32_t chr_rom_size;
 
     mapper_read_cb read;
     mapper_write_cb write;
     mapper_dump_cb dump;
+    mapper_remap_cb remap; /// maps the current banks into the cpu, from state.
     Mapper type;
+
+    uint8_t state[MAPPER_STATE_SIZE];
 } mapper_t;
 
-int mapper_init();
-void mapper_exit();
+int mapper_init(nes_t *nes);
+void mapper_exit(nes_t *nes);
 
-int mapper_reset();
+int mapper_reset(nes_t *nes);
 
 bool mapper_is_avaliable(Mapper mapper_type);
-int mapper_set(const rom_header_t *header);
+int mapper_set(nes_t *nes, const rom_header_t *header, uint8_t *rom, uint32_t size);
+void mapper_unset(nes_t *nes);
+
+uint8_t mapper_read(nes_t *nes, uint16_t addr);
+void mapper_write(nes_t *nes, uint16_t addr, uint8_t v);
 
-uint8_t mapper_read(uint16_t addr);
-void mapper_write(uint16_t addr, uint8_t v);
+/// Rebuild the page table from the mapper state, ie after loading a save state.
+void mapper_remap(nes_t *nes);
 
 #ifdef __cplusplus
 }
@@ -5,38 +5,70 @@
 #include <string.h>
 #include <assert.h>
 
+#include "../nes.h"
 #include "../mapper.h"
+#include "../cpu.h"
 
-static uint8_t read(uint16_t addr);
-static void write(uint16_t addr, uint8_t v);
-static void dump();
+/// NROM: 16KiB or 32KiB of prg-rom, no bank switching.
+/// 16KiB carts are mirrored into 0xC000.
+/// 8KiB of chr-rom, or chr-ram if the cart has none.
 
-int mapper_0_init(mapper_t *mapper)
+static uint8_t read(nes_t *nes, uint16_t addr);
+static void write(nes_t *nes, uint16_t addr, uint8_t v);
+static void dump(nes_t *nes);
+static void remap(nes_t *nes);
+
+int mapper_0_init(nes_t *nes)
 {
+    mapper_t *mapper = &nes->mapper;
+
     mapper->read = read;
     mapper->write = write;
     mapper->dump = dump;
+    mapper->remap = remap;
     mapper->type = Mapper_0;
 
+    remap(nes);
+
     return 0;
 }
 
-void mapper_0_exit()
+void mapper_0_exit(nes_t *nes)
 {
 
 }
 
-static uint8_t read(uint16_t addr)
+static uint8_t read(nes_t *nes, uint16_t addr)
 {
+    /// prg-rom is in the page table, so this is only unmapped cart space.
     return 0;
 }
 
-static void write(uint16_t addr, uint8_t v)
+static void write(nes_t *nes, uint16_t addr, uint8_t v)
+{
+    /// writes to rom are ignored.
+}
+
+static void dump(nes_t *nes)
 {
 
 }
 
-static void dump()
+static void remap(nes_t *nes)
 {
+    mapper_t *mapper = &nes->mapper;
 
-}
\ No newline at end of file
+    /// no banks, so no state.
+    const uint32_t bank1 = mapper->pgr_rom_size > 0x4000 ? 0x4000 : 0;
+    cpu_map_pages(nes, 0x8000, 0x4000, mapper->pgr_rom, false);
+    cpu_map_pages(nes, 0xC000, 0x4000, mapper->pgr_rom + bank1, false);
+
+    if (mapper->chr_rom_size)
+    {
+        ppu_map_chr(&nes->ppu, 0x0000, 0x2000, mapper->chr_rom, false);
+    }
+    else
+    {
+        ppu_map_chr(&nes->ppu, 0x0000, 0x2000, (uint8_t *)&nes->ppu.mem.pattern_table0, true);
+    }
+}
@@ -8,8 +8,8 @@ extern "C" {
 
 #include "../mapper.h"
 
-int mapper_0_init(mapper_t *mapper);
-void mapper_0_exit();
+int mapper_0_init(nes_t *nes);
+void mapper_0_exit(nes_t *nes);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,354 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "movie.h"
+#include "input_script.h"
+
+/// Longest fm2 button field read, "RLDUTSBA".
+#define FM2_BUTTONS 8
+
+void movie_init(movie_t *movie)
+{
+    memset(movie, 0, sizeof(movie_t));
+}
+
+void movie_free(movie_t *movie)
+{
+    free(movie->frames);
+    memset(movie, 0, sizeof(movie_t));
+}
+
+/// FNV-1a of the whole rom file.
+static uint64_t rom_hash(const nes_t *nes)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (uint32_t i = 0; i < nes->cart.size; i++)
+    {
+        hash = (hash ^ nes->cart.rom[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static int push_frame(movie_t *movie, const movie_frame_t *frame)
+{
+    if (movie->count == movie->capacity)
+    {
+        const uint32_t capacity = movie->capacity ? movie->capacity * 2 : 1024;
+        movie_frame_t *frames = realloc(movie->frames, capacity * sizeof(movie_frame_t));
+        if (!frames)
+        {
+            fprintf(stderr, "Failed to alloc movie frames\n");
+            return -1;
+        }
+        movie->frames = frames;
+        movie->capacity = capacity;
+    }
+
+    movie->frames[movie->count++] = *frame;
+    return 0;
+}
+
+static bool same_frame(const movie_frame_t *a, const movie_frame_t *b)
+{
+    return a->buttons[0] == b->buttons[0] && a->buttons[1] == b->buttons[1] && a->commands == b->commands;
+}
+
+static int load_binary(movie_t *movie, const uint8_t *data, size_t size)
+{
+    movie_header_t header;
+    memcpy(&header, data, sizeof(header));
+
+    if (header.version != MOVIE_VERSION)
+    {
+        fprintf(stderr, "Movie is version %u, expected %u\n", header.version, MOVIE_VERSION);
+        return -1;
+    }
+
+    movie->rom_hash = header.rom_hash;
+
+    size_t offset = sizeof(header);
+    while (movie->count < header.frames)
+    {
+        /// LEB128 run length.
+        uint32_t run = 0;
+        for (uint32_t shift = 0;; shift += 7)
+        {
+            if (offset == size || shift > 28)
+            {
+                fprintf(stderr, "Movie is truncated at frame %u\n", movie->count);
+                return -1;
+            }
+
+            const uint8_t byte = data[offset++];
+            run |= (uint32_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+            {
+                break;
+            }
+        }
+
+        if (!run || run > header.frames - movie->count || size - offset < 3)
+        {
+            fprintf(stderr, "Movie is corrupt at frame %u\n", movie->count);
+            return -1;
+        }
+
+        const movie_frame_t frame =
+        {
+            .buttons = { data[offset], data[offset + 1] },
+            .commands = data[offset + 2],
+        };
+        offset += 3;
+
+        for (uint32_t i = 0; i < run; i++)
+        {
+            if (push_frame(movie, &frame) != 0)
+            {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/// Reads the next '|' separated field from *s as buttons, leaving *s after the '|'.
+static uint8_t fm2_buttons(const char **s)
+{
+    char field[FM2_BUTTONS + 1] = {0};
+    const char *end = strchr(*s, '|');
+    const size_t len = end ? (size_t)(end - *s) : strlen(*s);
+    memcpy(field, *s, len < FM2_BUTTONS ? len : FM2_BUTTONS);
+    *s = end ? end + 1 : *s + len;
+    return input_parse_buttons(field);
+}
+
+/// "key value" header lines, then one "|commands|port0|port1|port2|" line per frame.
+static int load_fm2(movie_t *movie, char *text)
+{
+    uint32_t line_number = 0;
+    for (char *line = text; line && *line; )
+    {
+        char *next = strchr(line, '\n');
+        if (next)
+        {
+            *next++ = '\0';
+        }
+        line_number++;
+
+        if (line[0] == '|')
+        {
+            const char *s = line + 1;
+            movie_frame_t frame = { .commands = strtoul(s, NULL, 10) };
+            s = strchr(s, '|');
+            if (!s)
+            {
+                fprintf(stderr, "Bad fm2 line %u: %s\n", line_number, line);
+                return -1;
+            }
+            s++;
+            frame.buttons[0] = fm2_buttons(&s);
+            frame.buttons[1] = fm2_buttons(&s);
+
+            /// a power cycle on the first frame is where a movie starts anyway.
+            if (frame.commands & MovieCommand_Power)
+            {
+                if (movie->count != 0)
+                {
+                    fprintf(stderr, "fm2 power cycles after the first frame aren't supported, line %u\n", line_number);
+                    return -1;
+                }
+                frame.commands &= ~MovieCommand_Power;
+            }
+
+            if (push_frame(movie, &frame) != 0)
+            {
+                return -1;
+            }
+        }
+        else if (strncmp(line, "binary 1", 8) == 0)
+        {
+            fprintf(stderr, "Binary fm2 movies aren't supported\n");
+            return -1;
+        }
+
+        line = next;
+    }
+
+    return 0;
+}
+
+int movie_load(movie_t *movie, const char *path)
+{
+    movie_init(movie);
+
+    assert(path);
+    if (!path)
+    {
+        fprintf(stderr, "Empty path in movie load\n");
+        return -1;
+    }
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "Failed to open movie: %s\n", path);
+        return -1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    const long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    /// null terminated for the fm2 parser.
+    uint8_t *data = size >= 0 ? malloc(size + 1) : NULL;
+    if (!data || fread(data, 1, size, fp) != (size_t)size)
+    {
+        fprintf(stderr, "Failed to read movie: %s\n", path);
+        free(data);
+        fclose(fp);
+        return -1;
+    }
+    data[size] = '\0';
+    fclose(fp);
+
+    uint32_t magic = 0;
+    if ((size_t)size >= sizeof(magic))
+    {
+        memcpy(&magic, data, sizeof(magic));
+    }
+
+    int ret = -1;
+    if (magic == MOVIE_MAGIC && (size_t)size >= sizeof(movie_header_t))
+    {
+        ret = load_binary(movie, data, size);
+    }
+    else if (strncmp((const char *)data, "version", 7) == 0)
+    {
+        ret = load_fm2(movie, (char *)data);
+    }
+    else
+    {
+        fprintf(stderr, "Not a movie: %s\n", path);
+    }
+
+    free(data);
+    if (ret != 0)
+    {
+        movie_free(movie);
+    }
+    return ret;
+}
+
+static int write_run(FILE *fp, uint32_t run, const movie_frame_t *frame)
+{
+    do
+    {
+        const uint8_t byte = (run & 0x7F) | (run > 0x7F ? 0x80 : 0);
+        fputc(byte, fp);
+        run >>= 7;
+    } while (run);
+
+    const uint8_t bytes[3] = { frame->buttons[0], frame->buttons[1], frame->commands };
+    return fwrite(bytes, 1, sizeof(bytes), fp) == sizeof(bytes) ? 0 : -1;
+}
+
+int movie_save(const movie_t *movie, const char *path)
+{
+    assert(path);
+    if (!path)
+    {
+        fprintf(stderr, "Empty path in movie save\n");
+        return -1;
+    }
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "Failed to open movie: %s\n", path);
+        return -1;
+    }
+
+    const movie_header_t header =
+    {
+        .magic = MOVIE_MAGIC,
+        .version = MOVIE_VERSION,
+        .frames = movie->count,
+        .rom_hash = movie->rom_hash,
+    };
+    fwrite(&header, sizeof(header), 1, fp);
+
+    for (uint32_t i = 0; i < movie->count; )
+    {
+        uint32_t run = 1;
+        while (i + run < movie->count && same_frame(&movie->frames[i + run], &movie->frames[i]))
+        {
+            run++;
+        }
+
+        write_run(fp, run, &movie->frames[i]);
+        i += run;
+    }
+
+    const int ret = ferror(fp) ? -1 : 0;
+    if (fclose(fp) != 0 || ret != 0)
+    {
+        fprintf(stderr, "Failed to write movie: %s\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+bool movie_path(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+    return ext && (strcmp(ext, ".tnm") == 0 || strcmp(ext, ".fm2") == 0);
+}
+
+int movie_check_rom(const movie_t *movie, const nes_t *nes)
+{
+    if (movie->rom_hash && movie->rom_hash != rom_hash(nes))
+    {
+        fprintf(stderr, "Movie was recorded on a different rom\n");
+        return -1;
+    }
+    return 0;
+}
+
+int movie_record(movie_t *movie, const nes_t *nes, uint8_t commands)
+{
+    if (movie->count == 0)
+    {
+        movie->rom_hash = rom_hash(nes);
+    }
+
+    const movie_frame_t frame =
+    {
+        .buttons = { nes->joypad.buttons[0], nes->joypad.buttons[1] },
+        .commands = commands,
+    };
+    return push_frame(movie, &frame);
+}
+
+uint8_t movie_apply(const movie_t *movie, nes_t *nes, uint32_t frame)
+{
+    static const movie_frame_t released = {0};
+    const movie_frame_t *f = frame < movie->count ? &movie->frames[frame] : &released;
+
+    /// the reset button, which only resets the cpu.
+    if (f->commands & MovieCommand_Reset)
+    {
+        cpu_reset(nes);
+    }
+
+    for (uint8_t port = 0; port < JOYPAD_PORTS; port++)
+    {
+        joypad_set_buttons(&nes->joypad, port, f->buttons[port]);
+    }
+
+    return f->commands;
+}
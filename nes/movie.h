@@ -0,0 +1,80 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nes.h"
+
+/// Input movies, what both joypads held every frame since power up.
+/// Recording takes the joypads as they are once a frame, playback sets them before each
+/// nes_run(), which is all the input the console sees, so playing back a movie recorded
+/// here from power up gives the exact same run.
+///
+/// Saved as a binary file: a movie_header_t, then runs of identical frames, each a
+/// LEB128 run length followed by the frame (port 0, port 1, commands). Frames almost always
+/// repeat the last, so an hour is a few tens of KiB.
+///
+/// fm2 (fceux) text movies can be loaded as well. Only gamepads in port 0 / 1 are read,
+/// and the frame boundaries aren't the same as fceux's, so they aren't guaranteed to sync.
+
+#define MOVIE_MAGIC 0x564D4E54 /// "TNMV"
+#define MOVIE_VERSION 1
+
+/// Same bits as fm2.
+typedef enum
+{
+    MovieCommand_Reset = 1 << 0,
+    MovieCommand_Power = 1 << 1, /// not supported, movies start from power up.
+} MovieCommand;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t frames;
+    uint32_t _pad;
+    uint64_t rom_hash; /// 0 if not known.
+} movie_header_t;
+
+typedef struct
+{
+    uint8_t buttons[JOYPAD_PORTS];
+    uint8_t commands;
+} movie_frame_t;
+
+typedef struct
+{
+    movie_frame_t *frames;
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t rom_hash; /// of the rom it was recorded on, 0 if not known (ie fm2).
+} movie_t;
+
+void movie_init(movie_t *movie);
+void movie_free(movie_t *movie);
+
+/// Binary or fm2, going by the file's contents.
+int movie_load(movie_t *movie, const char *path);
+int movie_save(const movie_t *movie, const char *path);
+
+/// Whether path is a movie (.tnm / .fm2) rather than an input script, see input_script.h.
+bool movie_path(const char *path);
+
+/// Fails if the movie was recorded on another rom.
+int movie_check_rom(const movie_t *movie, const nes_t *nes);
+
+/// Appends what the joypads hold now, call once a frame before nes_run().
+/// commands are anything that was done to the console this frame, ie a reset.
+int movie_record(movie_t *movie, const nes_t *nes, uint8_t commands);
+
+/// Sets the joypads (and resets) for this frame, call before each nes_run().
+/// Past the end nothing is held. Returns the commands that were run, so they can be recorded.
+uint8_t movie_apply(const movie_t *movie, nes_t *nes, uint32_t frame);
+
+#ifdef __cplusplus
+}
+#endif
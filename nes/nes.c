@@ -10,77 +10,69 @@
 #include "ppu.h"
 #include "cart.h"
 #include "mapper.h"
+#include "joypad.h"
 
-typedef struct
+nes_t *nes_init()
 {
-    const cpu_t *cpu;
-    const apu_t *apu;
-    const ppu_t *ppu;
-    const cart_t *cart;
-} nes_t;
-
-static nes_t nes = {0};
-static bool nes_initialised = false;
-
-int nes_init()
-{
-    assert(nes_initialised == false);
-    if (nes_initialised)
+    /// nes_t is a multiple of its alignment, as aligned_alloc() wants.
+    nes_t *nes = aligned_alloc(NES_CACHE_LINE, sizeof(nes_t));
+    assert(nes);
+    if (!nes)
     {
-        fprintf(stderr, "nes already initialised\n");
-        return -1;
+        fprintf(stderr, "Failed to alloc nes\n");
+        return NULL;
     }
 
-    nes.cpu = cpu_init();
-    nes.apu = apu_init();
-    nes.ppu = ppu_init();
-    nes.cart = cart_init();
-    mapper_init();
-
-    nes_initialised = true;
+    cpu_init(nes);
+    apu_init(&nes->apu);
+    ppu_init(&nes->ppu);
+    cart_init(nes);
+    joypad_init(&nes->joypad);
+    mapper_init(nes);
+    nes->profile = NULL;
 
-    return 0;
+    return nes;
 }
 
-int nes_reset()
+int nes_reset(nes_t *nes)
 {
-    assert(nes_initialised);
-    if (nes_initialised == false)
+    assert(nes);
+    if (!nes)
     {
         fprintf(stderr, "nes not initialised\n");
         return -1;
     }
 
-    cpu_reset();
-    apu_reset();
-    ppu_reset();
-    cart_reset();
+    cpu_reset(nes);
+    apu_reset(&nes->apu);
+    ppu_reset(&nes->ppu);
+    cart_reset(nes);
+    joypad_reset(&nes->joypad);
 
     return 0;
 }
 
-void nes_exit()
+void nes_exit(nes_t *nes)
 {
-    assert(nes_initialised);
-    if (nes_initialised == false)
+    assert(nes);
+    if (!nes)
     {
         fprintf(stderr, "nes not initialised\n");
         return;
     }
 
-    cpu_exit();
-    apu_exit();
-    ppu_exit();
-    cart_exit();
-    mapper_exit();
+    /// the mapper goes first, as it unmaps the cart from the cpu.
+    mapper_exit(nes);
+    cart_exit(nes);
+    cpu_exit(nes);
 
-    nes_initialised = false;
+    free(nes);
 }
 
-int nes_loadrom(const char *path)
+int nes_loadrom(nes_t *nes, const char *path)
 {
-    assert(nes_initialised);
-    if (nes_initialised == false)
+    assert(nes);
+    if (!nes)
     {
         fprintf(stderr, "nes not initialised\n");
         return -1;
@@ -95,64 +87,100 @@ int nes_loadrom(const char *path)
 
     int ret = 0;
 
-    ret = cart_load(path);
-    assert(ret == 0);
+    ret = cart_load(nes, path);
     if (ret != 0)
     {
         return -1;
     }
 
-    cpu_power_up();
+    ppu_reset(&nes->ppu);
+    apu_reset(&nes->apu);
+    joypad_reset(&nes->joypad);
+    cpu_power_up(nes);
 
     return 0;
 }
 
-#define NTSC_CYCLE 1789773 / 60
+/// Catch the ppu / apu up to the cpu and service anything that is now due.
+/// The ppu / apu never run on their own, they only catch up here or when
+/// the cpu touches one of their registers.
+static void nes_sync(nes_t *nes)
+{
+    PROFILE_CALL(nes, ProfileSubsystem_PPU, ppu_catch_up(&nes->ppu, nes->cpu.cycle_total));
+    PROFILE_CALL(nes, ProfileSubsystem_APU, apu_catch_up(&nes->apu, nes->cpu.cycle_total));
 
-int nes_step()
+    if (ppu_nmi_pending(&nes->ppu))
+    {
+        ppu_nmi_ack(&nes->ppu);
+        PROFILE_CALL(nes, ProfileSubsystem_CPU, cpu_nmi(nes));
+    }
+}
+
+int nes_step(nes_t *nes)
 {
-    if (cpu_tick() != 0)
+    int ret = 0;
+    PROFILE_CALL(nes, ProfileSubsystem_CPU, ret = cpu_step(nes, ppu_next_event_cycle(&nes->ppu)));
+    if (ret != 0)
     {
         fprintf(stderr, "cpu tick error\n");
         return -1;
     }
 
-    /// TODO:
-    /// NTSC ppu updates 3 times exactly every 1 cpu cycle.
-    /// However, each cpu instruction takes more than 1 cycle, 2 at min.
-    /// So I can update this in the tick(), though i'll work on that later.
-    for (int i = 0; i < 3; i++)
-    {
-        if (ppu_tick() != 0)
-        {
-            fprintf(stderr, "ppu tick error\n");
-            return -1;
-        }
-    }
+    nes_sync(nes);
 
     return 0;
 }
 
-int nes_run()
+int nes_run(nes_t *nes)
 {
-    /// IMP: Not sure on this imp.
-    while (nes.cpu->cycle < NTSC_CYCLE)
+    const uint64_t frame = nes->ppu.frame;
+    int ret = 0;
+
+    /// run the cpu in bulk up to the next ppu event (vblank start / end, end of frame),
+    /// then sync. So the cpu only stops a few times a frame rather than every instruction.
+    while (nes->ppu.frame == frame)
     {
-        if (nes_step() != 0)
+        PROFILE_CALL(nes, ProfileSubsystem_CPU, ret = cpu_run(nes, ppu_next_event_cycle(&nes->ppu)));
+        if (ret != 0)
         {
+            fprintf(stderr, "cpu run error\n");
             return -1;
         }
+
+        nes_sync(nes);
     }
 
     /// apu updates at 60hz, so as long as nes_run() is called at 60hz, everythign will be fine.
-    if (apu_tick() != 0)
+    PROFILE_CALL(nes, ProfileSubsystem_APU, ret = apu_tick(&nes->apu));
+    if (ret != 0)
     {
         fprintf(stderr, "aputick error\n");
         return -1;
     }
 
     /// Will probably just make the structs rw instead of this.
-    cpu_reset_cycle();
+    cpu_reset_cycle(nes);
+
+    return 0;
+}
 
+int nes_set_profile(nes_t *nes, profile_t *profile)
+{
+    #if NES_PROFILE
+    if (profile)
+    {
+        /// whatever happens until the next nes_run() isn't ours.
+        profile->current = ProfileSubsystem_None;
+        profile->last = profile_now();
+    }
+    nes->profile = profile;
+    return 0;
+    #else
+    if (profile)
+    {
+        fprintf(stderr, "profiling is not available in this build\n");
+        return -1;
+    }
     return 0;
-}
\ No newline at end of file
+    #endif
+}
@@ -10,18 +10,46 @@ extern "C" {
 #include "apu.h"
 #include "ppu.h"
 #include "cart.h"
-
-
-int nes_init();
-void nes_exit();
-
-int nes_reset();
-
-int nes_loadrom(const char *path);
-
-int nes_run();
-int nes_step();
+#include "mapper.h"
+#include "joypad.h"
+#include "state.h"
+#include "rewind.h"
+#include "profile.h"
+
+/// Everything that makes up a console, in a single allocation (see nes_init()).
+/// There is no global state, so any number of these can be run at once, ie one per thread.
+/// Each component starts on its own cache line, and the console is allocated aligned to one,
+/// so the hot fields at the start of each never share a line with another component or console.
+#define NES_CACHE_LINE 64
+#define NES_CACHE_ALIGNED __attribute__((aligned(NES_CACHE_LINE)))
+
+struct nes
+{
+    cpu_t cpu NES_CACHE_ALIGNED;
+    ppu_t ppu NES_CACHE_ALIGNED;
+    apu_t apu NES_CACHE_ALIGNED;
+    cart_t cart NES_CACHE_ALIGNED;
+    mapper_t mapper NES_CACHE_ALIGNED;
+    joypad_t joypad NES_CACHE_ALIGNED;
+
+    profile_t *profile; /// NULL when not profiling.
+};
+
+nes_t *nes_init();
+void nes_exit(nes_t *nes);
+
+int nes_reset(nes_t *nes);
+
+int nes_loadrom(nes_t *nes, const char *path);
+
+int nes_run(nes_t *nes);
+int nes_step(nes_t *nes);
+
+/// Start / stop (NULL) counting into profile, see profile.h.
+/// The counters are added to, so reset it first to start from nothing.
+/// Returns -1 if it isn't available in this build (NES_PROFILE=0).
+int nes_set_profile(nes_t *nes, profile_t *profile);
 
 #ifdef __cplusplus
 }
-#endif
\ No newline at end of file
+#endif
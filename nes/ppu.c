@@ -2,72 +2,205 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <assert.h>
 
 #include "ppu.h"
-#include "mapper.h"
 
-static ppu_t *ppu = NULL;
+#if defined(__BMI2__)
+    #include <immintrin.h>
+#endif
 
-const ppu_t *ppu_init()
+/// Build with -DPPU_TILE_PDEP=0 to decode tiles with the portable bit spread rather than bmi2's pdep.
+#ifndef PPU_TILE_PDEP
+    #if defined(__BMI2__)
+        #define PPU_TILE_PDEP 1
+    #else
+        #define PPU_TILE_PDEP 0
+    #endif
+#endif
+
+_Static_assert(sizeof(((ppu_t *)0)->oam) == 0x100, "oam is written as 256 bytes");
+
+int ppu_init(ppu_t *ppu)
 {
-    assert(ppu == NULL);
-    if (ppu)
-    {
-        fprintf(stderr, "ppu already initialised\n");
-        return NULL;
-    }
+    memset(ppu, 0, sizeof(ppu_t));
+    ppu_set_mirroring(ppu, PPUMirroring_Horizontal);
+    return 0;
+}
+
+int ppu_reset(ppu_t *ppu)
+{
+    /// the cart's chr / mirroring stay.
+    memset(ppu, 0, offsetof(ppu_t, chr));
+    return 0;
+}
 
-    ppu = malloc(sizeof(ppu_t));
-    assert(ppu);
-    if (!ppu)
+void ppu_map_chr(ppu_t *ppu, uint16_t addr, uint32_t size, uint8_t *data, bool writable)
+{
+    assert(!(addr & 0x3FF) && !(size & 0x3FF) && addr + size <= 0x2000);
+
+    for (uint32_t i = 0; i < size / 0x400; i++)
     {
-        fprintf(stderr, "Failed to alloc ppu\n");
-        return NULL;
+        const uint8_t bank = (addr / 0x400) + i;
+        ppu->chr[bank] = data ? data + (i * 0x400) : NULL;
+        ppu->chr_writable &= ~(1 << bank);
+        ppu->chr_writable |= (data && writable) << bank;
+
+        /// a bank is 64 tiles, a word of valid bits.
+        ppu->tiles.valid[bank] = 0;
     }
-    
-    return ppu;
 }
 
-void ppu_exit()
+void ppu_invalidate_tiles(ppu_t *ppu)
+{
+    memset(ppu->tiles.valid, 0, sizeof(ppu->tiles.valid));
+}
+
+void ppu_invalidate_sprites(ppu_t *ppu)
+{
+    ppu->sprite_lists_valid = false;
+}
+
+void ppu_set_mirroring(ppu_t *ppu, PPUMirroring mirroring)
 {
-    assert(ppu);
-    if (!ppu)
+    /// which of the 4 nametables in vram each of $2000 / $2400 / $2800 / $2C00 is.
+    static const uint8_t layouts[][4] =
     {
-        fprintf(stderr, "ppu not initialised\n");
-        return;
+        [PPUMirroring_Horizontal] = { 0, 0, 1, 1 },
+        [PPUMirroring_Vertical] = { 0, 1, 0, 1 },
+        [PPUMirroring_FourScreen] = { 0, 1, 2, 3 },
+    };
+
+    ppu->mirroring = mirroring;
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        ppu->nametables[i] = (uint8_t *)&ppu->mem.nametable0 + (layouts[mirroring][i] * sizeof(ppu_nametable_t));
     }
+}
 
-    free(ppu);
-    ppu = NULL;
+typedef enum
+{
+    PPUMemMap_ST_PatternTable0,
+    PPUMemMap_ED_PatternTable0 = 0x0FFF,
+    PPUMemMap_ST_PatternTable1,
+    PPUMemMap_ED_PatternTable1 = 0x1FFF,
+    PPUMemMap_ST_Nametable0,
+    PPUMemMap_ED_Nametable0 = 0x23FF,
+    PPUMemMap_ST_Nametable1,
+    PPUMemMap_ED_Nametable1 = 0x27FF,
+    PPUMemMap_ST_Nametable2,
+    PPUMemMap_ED_Nametable2 = 0x2BFF,
+    PPUMemMap_ST_Nametable3,
+    PPUMemMap_ED_Nametable3 = 0x2FFF,
+    PPUMemMap_ST_NametableMirrors,
+    PPUMemMap_ED_NametableMirrors = 0x3EFF,
+    PPUMemMap_ST_PaletteRamIndexes,
+    PPUMemMap_ED_PaletteRamIndexes = 0x3F1F,
+    PPUMemMap_ST_PaletteRamIndexesMirrors,
+    PPUMemMap_ED_PaletteRamIndexesMirrors = 0x3FFF,
+} PPUMemMap;
+
+/// The byte of nametable at addr ($2000-$3EFF), after mirroring.
+static inline uint8_t *nametable(ppu_t *ppu, uint16_t addr)
+{
+    return &ppu->nametables[(addr >> 10) & 3][addr & 0x3FF];
 }
 
-int ppu_reset()
+/// Where each of the 32 palette entries is kept, $3F10 / $14 / $18 / $1C are $3F00 / $04 / $08 / $0C.
+static const uint8_t palette_mirror[PALETTE_RAM_SIZE] =
 {
-    assert(ppu);
-    if (!ppu)
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+    0x00, 0x11, 0x12, 0x13, 0x04, 0x15, 0x16, 0x17, 0x08, 0x19, 0x1A, 0x1B, 0x0C, 0x1D, 0x1E, 0x1F,
+};
+
+/// The palette entry of addr ($3F00-$3FFF).
+static inline uint8_t *palette(ppu_t *ppu, uint16_t addr)
+{
+    return &ppu->mem.palette_ram[palette_mirror[addr & 0x1F]];
+}
+
+static inline uint8_t ppu_read8(ppu_t *ppu, uint16_t addr)
+{
+    switch (addr)
     {
-        fprintf(stderr, "ppu not initialised\n");
-        return -1;
+        case PPUMemMap_ST_PatternTable0 ... PPUMemMap_ED_PatternTable1:
+            return ppu->chr[addr >> 10] ? ppu->chr[addr >> 10][addr & 0x3FF] : 0;
+
+        case PPUMemMap_ST_Nametable0 ... PPUMemMap_ED_NametableMirrors:
+            return *nametable(ppu, addr);
+
+        case PPUMemMap_ST_PaletteRamIndexes ... PPUMemMap_ED_PaletteRamIndexesMirrors:
+            return *palette(ppu, addr);
+
+        default: assert(0); return 0;
     }
+}
 
-    memset(ppu, 0, sizeof(ppu_t));
+static inline void ppu_write8(ppu_t *ppu, uint16_t addr, uint8_t v)
+{
+    switch (addr)
+    {
+        /// chr-rom ignores writes.
+        case PPUMemMap_ST_PatternTable0 ... PPUMemMap_ED_PatternTable1:
+            if (ppu->chr_writable & (1 << (addr >> 10)))
+            {
+                ppu->chr[addr >> 10][addr & 0x3FF] = v;
+                ppu->tiles.valid[addr >> 10] &= ~(1ULL << ((addr >> 4) & 63));
+            }
+            break;
 
-    return 0;
+        case PPUMemMap_ST_Nametable0 ... PPUMemMap_ED_NametableMirrors:
+            *nametable(ppu, addr) = v;
+            break;
+
+        /// palette ram is 6 bits wide.
+        case PPUMemMap_ST_PaletteRamIndexes ... PPUMemMap_ED_PaletteRamIndexesMirrors:
+            *palette(ppu, addr) = v & 0x3F;
+            break;
+
+        default:
+            assert(0);
+            break;
+    }
 }
 
-uint8_t ppu_read_register(uint16_t addr)
+uint8_t ppu_read_register(ppu_t *ppu, uint16_t addr)
 {
     switch (addr)
     {
         case PPURegisterAddr_PPUCTRL:   return ppu->reg.ppu_ctrl;
         case PPURegisterAddr_PPUMASK:   return ppu->reg.ppu_mask;
-        case PPURegisterAddr_PPUSTATUS: return ppu->reg.ppu_status;
+        case PPURegisterAddr_PPUSTATUS:
+        {
+            /// reading clears the vblank flag, and the write toggle.
+            const uint8_t v = ppu->reg.ppu_status;
+            ppu->reg.status.vblank = 0;
+            ppu->w = 0;
+            return v;
+        }
         case PPURegisterAddr_OAMADDR:   return ppu->reg.oam_addr;
-        case PPURegisterAddr_OAMDATA:   return ppu->reg.oam_data;
+        case PPURegisterAddr_OAMDATA:   return ((const uint8_t *)ppu->oam)[ppu->reg.oam_addr];
         case PPURegisterAddr_PPUSCROLL: return ppu->reg.ppu_scroll;
         case PPURegisterAddr_PPUADDR:   return ppu->reg.ppu_addr;
-        case PPURegisterAddr_PPUDATA:   return ppu->reg.ppu_data;
+        case PPURegisterAddr_PPUDATA:
+        {
+            /// the palette comes straight back, but still fills the buffer with the nametable under it.
+            const uint16_t vram_addr = ppu->v & 0x3FFF;
+            uint8_t v = ppu->read_buffer;
+            if (vram_addr >= PPUMemMap_ST_PaletteRamIndexes)
+            {
+                v = ppu_read8(ppu, vram_addr);
+                ppu->read_buffer = ppu_read8(ppu, vram_addr - 0x1000);
+            }
+            else
+            {
+                ppu->read_buffer = ppu_read8(ppu, vram_addr);
+            }
+            ppu->v = (ppu->v + (ppu->reg.ctrl.vram_addr_inc ? 32 : 1)) & 0x7FFF;
+            ppu->reg.ppu_data = v;
+            return v;
+        }
         case PPURegisterAddr_OAMDMA:    return ppu->reg.oam_dma;
 
         default:
@@ -77,18 +210,63 @@ uint8_t ppu_read_register(uint16_t addr)
     }
 }
 
-void ppu_write_register(uint16_t addr, uint8_t v)
+void ppu_write_register(ppu_t *ppu, uint16_t addr, uint8_t v)
 {
     switch (addr)
     {
-        case PPURegisterAddr_PPUCTRL:   ppu->reg.ppu_ctrl = v;      break;
+        case PPURegisterAddr_PPUCTRL:
+            /// enabling nmi during vblank fires one straight away.
+            if (ppu->reg.ctrl.nmi == 0 && (v & 0x80) && ppu->reg.status.vblank)
+            {
+                ppu->nmi_pending = true;
+            }
+            /// the lists are of 8 or 16 line sprites.
+            if ((ppu->reg.ppu_ctrl ^ v) & 0x20)
+            {
+                ppu->sprite_lists_valid = false;
+            }
+            ppu->reg.ppu_ctrl = v;
+            ppu->t = (ppu->t & ~0x0C00) | ((v & 0x3) << 10);
+            break;
         case PPURegisterAddr_PPUMASK:   ppu->reg.ppu_mask = v;      break;
         case PPURegisterAddr_PPUSTATUS: ppu->reg.ppu_status = v;    break;
         case PPURegisterAddr_OAMADDR:   ppu->reg.oam_addr = v;      break;
-        case PPURegisterAddr_OAMDATA:   ppu->reg.oam_data = v;      break;
-        case PPURegisterAddr_PPUSCROLL: ppu->reg.ppu_scroll = v;    break;
-        case PPURegisterAddr_PPUADDR:   ppu->reg.ppu_addr = v;      break;
-        case PPURegisterAddr_PPUDATA:   ppu->reg.ppu_data = v;      break;
+        case PPURegisterAddr_OAMDATA:
+            ppu->reg.oam_data = v;
+            ((uint8_t *)ppu->oam)[ppu->reg.oam_addr++] = v;
+            ppu->sprite_lists_valid = false;
+            break;
+        case PPURegisterAddr_PPUSCROLL:
+            ppu->reg.ppu_scroll = v;
+            if (ppu->w == 0)
+            {
+                ppu->t = (ppu->t & ~0x001F) | (v >> 3);
+                ppu->x = v & 0x7;
+            }
+            else
+            {
+                ppu->t = (ppu->t & ~0x73E0) | ((v & 0x7) << 12) | ((v & 0xF8) << 2);
+            }
+            ppu->w ^= 1;
+            break;
+        case PPURegisterAddr_PPUADDR:
+            ppu->reg.ppu_addr = v;
+            if (ppu->w == 0)
+            {
+                ppu->t = (ppu->t & 0x00FF) | ((v & 0x3F) << 8);
+            }
+            else
+            {
+                ppu->t = (ppu->t & 0xFF00) | v;
+                ppu->v = ppu->t;
+            }
+            ppu->w ^= 1;
+            break;
+        case PPURegisterAddr_PPUDATA:
+            ppu->reg.ppu_data = v;
+            ppu_write8(ppu, ppu->v & 0x3FFF, v);
+            ppu->v = (ppu->v + (ppu->reg.ctrl.vram_addr_inc ? 32 : 1)) & 0x7FFF;
+            break;
         case PPURegisterAddr_OAMDMA:    ppu->reg.oam_dma = v;       break;
         default:
             fprintf(stderr, "WRITING TO NON VALID ADDRESS IN PPU WRITE REG: 0x%04X\n", addr);
@@ -97,152 +275,545 @@ void ppu_write_register(uint16_t addr, uint8_t v)
     }
 }
 
-typedef enum
+void ppu_oam_dma(ppu_t *ppu, const uint8_t *data)
 {
-    PPUMemMap_ST_PatternTable0,
-    PPUMemMap_ED_PatternTable0 = 0x0FFF,
-    PPUMemMap_ST_PatternTable1,
-    PPUMemMap_ED_PatternTable1 = 0x1FFF,
-    PPUMemMap_ST_Nametable0,
-    PPUMemMap_ED_Nametable0 = 0x23FF,
-    PPUMemMap_ST_Nametable1,
-    PPUMemMap_ED_Nametable1 = 0x27FF,
-    PPUMemMap_ST_Nametable2,
-    PPUMemMap_ED_Nametable2 = 0x2BFF,
-    PPUMemMap_ST_Nametable3,
-    PPUMemMap_ED_Nametable3 = 0x2FFF,
-    PPUMemMap_ST_NametableMirrors,
-    PPUMemMap_ED_NametableMirrors = 0x3EFF,
-    PPUMemMap_ST_PaletteRamIndexes,
-    PPUMemMap_ED_PaletteRamIndexes = 0x3F1F,
-    PPUMemMap_ST_PaletteRamIndexesMirrors,
-    PPUMemMap_ED_PaletteRamIndexesMirrors = 0x3FFF,
-} PPUMemMap;
+    /// starts at oamaddr and wraps, so oamaddr ends up back where it was.
+    uint8_t *oam = (uint8_t *)ppu->oam;
+    const uint8_t start = ppu->reg.oam_addr;
+    memcpy(oam + start, data, 0x100 - start);
+    memcpy(oam, data + (0x100 - start), start);
+    ppu->sprite_lists_valid = false;
+}
 
-static inline uint8_t ppu_read8(uint16_t addr)
+/// Position of each event within a frame, in dots.
+#define PPU_EVENT_VBLANK_START ((PPU_VBLANK_SCANLINE * PPU_DOTS_PER_SCANLINE) + 1)
+#define PPU_EVENT_VBLANK_END ((PPU_PRERENDER_SCANLINE * PPU_DOTS_PER_SCANLINE) + 1)
+#define PPU_EVENT_FRAME_END (PPU_SCANLINES_PER_FRAME * PPU_DOTS_PER_SCANLINE)
+
+static inline uint32_t frame_position(const ppu_t *ppu)
 {
-    switch (addr)
+    return (ppu->scanline * PPU_DOTS_PER_SCANLINE) + ppu->dot;
+}
+
+static inline uint32_t next_event_position(uint32_t pos)
+{
+    if (pos < PPU_EVENT_VBLANK_START)   return PPU_EVENT_VBLANK_START;
+    if (pos < PPU_EVENT_VBLANK_END)     return PPU_EVENT_VBLANK_END;
+    return PPU_EVENT_FRAME_END;
+}
+
+/// Dots of a line that do something while rendering, see render_dots().
+#define PPU_DOT_DRAW_START 1
+#define PPU_DOT_DRAW_END 257 /// one past the last pixel.
+#define PPU_DOT_HORI_COPY 257
+#define PPU_DOT_VERT_COPY_START 280
+#define PPU_DOT_VERT_COPY_END 305
+#define PPU_DOT_PREFETCH0 328 /// the first 2 tiles of the next line are fetched at the end of this one.
+#define PPU_DOT_PREFETCH1 336
+
+static inline bool rendering(const ppu_t *ppu)
+{
+    return ppu->reg.mask.show_gb || ppu->reg.mask.show_sprites;
+}
+
+static inline void increment_x(ppu_t *ppu)
+{
+    if ((ppu->v & 0x001F) == 31)
+    {
+        ppu->v &= ~0x001F;
+        ppu->v ^= 0x0400;
+    }
+    else
     {
-        case PPUMemMap_ST_PatternTable0 ... PPUMemMap_ED_PatternTable0: assert(0);
-        case PPUMemMap_ST_PatternTable1 ... PPUMemMap_ED_PatternTable1: assert(0);
+        ppu->v++;
+    }
+}
 
-        case PPUMemMap_ST_Nametable0 ... PPUMemMap_ED_Nametable0: assert(0);
-        case PPUMemMap_ST_Nametable1 ... PPUMemMap_ED_Nametable1: assert(0);
-        case PPUMemMap_ST_Nametable2 ... PPUMemMap_ED_Nametable2: assert(0);
-        case PPUMemMap_ST_Nametable3 ... PPUMemMap_ED_Nametable3: assert(0);
+static inline void increment_y(ppu_t *ppu)
+{
+    if ((ppu->v & 0x7000) != 0x7000)
+    {
+        ppu->v += 0x1000;
+        return;
+    }
 
-        case PPUMemMap_ST_NametableMirrors ... PPUMemMap_ED_NametableMirrors: assert(0);
+    ppu->v &= ~0x7000;
+    uint16_t y = (ppu->v & 0x03E0) >> 5;
+    if (y == 29)
+    {
+        y = 0;
+        ppu->v ^= 0x0800;
+    }
+    else if (y == 31)
+    {
+        y = 0;
+    }
+    else
+    {
+        y++;
+    }
+    ppu->v = (ppu->v & ~0x03E0) | (y << 5);
+}
 
-        case PPUMemMap_ST_PaletteRamIndexes ... PPUMemMap_ED_PaletteRamIndexes: assert(0);
-            switch (addr)
-            {
-                case PPUMemMap_ST_PaletteRamIndexes + 0:    return ppu->mem.palette_ram_indexes.background_colour;
+/// Bit n of plane to byte n, so the rightmost pixel ends up first.
+static inline uint64_t spread_plane(uint8_t plane)
+{
+#if PPU_TILE_PDEP
+    return _pdep_u64(plane, 0x0101010101010101ULL);
+#else
+    uint64_t x = plane;
+    x = (x | (x << 28)) & 0x0000000F0000000FULL;
+    x = (x | (x << 14)) & 0x0003000300030003ULL;
+    x = (x | (x << 7)) & 0x0101010101010101ULL;
+    return x;
+#endif
+}
+
+static void decode_tile(ppu_t *ppu, uint16_t tile)
+{
+    for (uint8_t row = 0; row < 8; row++)
+    {
+        const uint16_t addr = (tile << 4) | row;
+        const uint64_t flipped = spread_plane(ppu_read8(ppu, addr)) | (spread_plane(ppu_read8(ppu, addr + 8)) << 1);
+        ppu->tiles.flipped[tile][row] = flipped;
+        ppu->tiles.rows[tile][row] = __builtin_bswap64(flipped);
+    }
+
+    ppu->tiles.valid[tile >> 6] |= 1ULL << (tile & 63);
+}
+
+/// The decoded row of the pattern at addr (the low plane byte of the row).
+static inline uint64_t tile_row(ppu_t *ppu, uint16_t addr, bool flip)
+{
+    const uint16_t tile = addr >> 4;
+    if (!(ppu->tiles.valid[tile >> 6] & (1ULL << (tile & 63))))
+    {
+        decode_tile(ppu, tile);
+    }
+
+    return flip ? ppu->tiles.flipped[tile][addr & 7] : ppu->tiles.rows[tile][addr & 7];
+}
+
+typedef struct
+{
+    uint8_t lo;
+    uint8_t hi;
+    uint8_t palette;
+} bg_tile_t;
 
-                case PPUMemMap_ST_PaletteRamIndexes + 1:    return ppu->mem.palette_ram_indexes.background_palette0.colour[0];
-                case PPUMemMap_ST_PaletteRamIndexes + 2:    return ppu->mem.palette_ram_indexes.background_palette0.colour[1];
-                case PPUMemMap_ST_PaletteRamIndexes + 3:    return ppu->mem.palette_ram_indexes.background_palette0.colour[2];
+/// The pattern address of the background tile row at v, and its palette.
+static inline uint16_t fetch_pattern(ppu_t *ppu, uint8_t *palette)
+{
+    const uint16_t v = ppu->v;
+    const uint8_t index = *nametable(ppu, v);
+    const uint8_t attribute = *nametable(ppu, 0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07));
+    *palette = (attribute >> (((v >> 4) & 0x4) | (v & 0x2))) & 0x3;
+    return (ppu->reg.ctrl.bg_pattern_table_addr << 12) | (index << 4) | (v >> 12);
+}
 
-                case PPUMemMap_ST_PaletteRamIndexes + 5:    return ppu->mem.palette_ram_indexes.background_palette1.colour[0];
-                case PPUMemMap_ST_PaletteRamIndexes + 6:    return ppu->mem.palette_ram_indexes.background_palette1.colour[1];
-                case PPUMemMap_ST_PaletteRamIndexes + 7:    return ppu->mem.palette_ram_indexes.background_palette1.colour[2];
+/// The background tile at v, then on to the next one.
+static inline bg_tile_t fetch_tile(ppu_t *ppu)
+{
+    bg_tile_t tile;
+    const uint16_t addr = fetch_pattern(ppu, &tile.palette);
+    tile.lo = ppu_read8(ppu, addr);
+    tile.hi = ppu_read8(ppu, addr + 8);
 
-                case PPUMemMap_ST_PaletteRamIndexes + 9:    return ppu->mem.palette_ram_indexes.background_palette2.colour[0];
-                case PPUMemMap_ST_PaletteRamIndexes + 10:   return ppu->mem.palette_ram_indexes.background_palette2.colour[1];
-                case PPUMemMap_ST_PaletteRamIndexes + 11:   return ppu->mem.palette_ram_indexes.background_palette2.colour[2];
+    increment_x(ppu);
+    return tile;
+}
 
-                case PPUMemMap_ST_PaletteRamIndexes + 13:   return ppu->mem.palette_ram_indexes.background_palette3.colour[0];
-                case PPUMemMap_ST_PaletteRamIndexes + 14:   return ppu->mem.palette_ram_indexes.background_palette3.colour[1];
-                case PPUMemMap_ST_PaletteRamIndexes + 15:   return ppu->mem.palette_ram_indexes.background_palette3.colour[2];
+/// Into the low byte of the shifters, which is empty once the last tile has shifted up.
+static inline void load_shifters(ppu_t *ppu, bg_tile_t tile)
+{
+    ppu->bg_lo |= tile.lo;
+    ppu->bg_hi |= tile.hi;
+    ppu->at_lo |= (tile.palette & 1) ? 0xFF : 0x00;
+    ppu->at_hi |= (tile.palette & 2) ? 0xFF : 0x00;
+}
+
+static inline void shift_shifters(ppu_t *ppu, uint8_t n)
+{
+    ppu->bg_lo <<= n;
+    ppu->bg_hi <<= n;
+    ppu->at_lo <<= n;
+    ppu->at_hi <<= n;
+}
 
-                case PPUMemMap_ST_PaletteRamIndexes + 17:   return ppu->mem.palette_ram_indexes.sprite_palette0.colour[0];
-                case PPUMemMap_ST_PaletteRamIndexes + 18:   return ppu->mem.palette_ram_indexes.sprite_palette0.colour[1];
-                case PPUMemMap_ST_PaletteRamIndexes + 19:   return ppu->mem.palette_ram_indexes.sprite_palette0.colour[2];
+/// palette << 2 | pixel from the shifters, fine x pixels in.
+static inline uint8_t shifter_pixel(const ppu_t *ppu)
+{
+    const uint8_t bit = 15 - ppu->x;
+    return ((ppu->bg_lo >> bit) & 1) | (((ppu->bg_hi >> bit) & 1) << 1) |
+        (((ppu->at_lo >> bit) & 1) << 2) | (((ppu->at_hi >> bit) & 1) << 3);
+}
 
-                case PPUMemMap_ST_PaletteRamIndexes + 21:   return ppu->mem.palette_ram_indexes.sprite_palette1.colour[0];
-                case PPUMemMap_ST_PaletteRamIndexes + 22:   return ppu->mem.palette_ram_indexes.sprite_palette1.colour[1];
-                case PPUMemMap_ST_PaletteRamIndexes + 23:   return ppu->mem.palette_ram_indexes.sprite_palette1.colour[2];
+static inline uint8_t palette_colour(ppu_t *ppu, uint8_t index)
+{
+    const uint8_t colour = ppu->mem.palette_ram[palette_mirror[index]];
+    return ppu->reg.mask.greyscale ? colour & 0x30 : colour;
+}
 
-                case PPUMemMap_ST_PaletteRamIndexes + 25:   return ppu->mem.palette_ram_indexes.sprite_palette2.colour[0];
-                case PPUMemMap_ST_PaletteRamIndexes + 26:   return ppu->mem.palette_ram_indexes.sprite_palette2.colour[1];
-                case PPUMemMap_ST_PaletteRamIndexes + 27:   return ppu->mem.palette_ram_indexes.sprite_palette2.colour[2];
+/// The colour at x from the background pixel there (palette << 2 | pixel) and the sprite line.
+static inline uint8_t compose_pixel(ppu_t *ppu, uint8_t x, uint8_t bg)
+{
+    const bool left = x < 8;
+    if (!ppu->reg.mask.show_gb || (left && !ppu->reg.mask.show_bg_leftmost))
+    {
+        bg = 0;
+    }
 
-                case PPUMemMap_ST_PaletteRamIndexes + 29:   return ppu->mem.palette_ram_indexes.sprite_palette3.colour[0];
-                case PPUMemMap_ST_PaletteRamIndexes + 30:   return ppu->mem.palette_ram_indexes.sprite_palette3.colour[1];
-                case PPUMemMap_ST_PaletteRamIndexes + 31:   return ppu->mem.palette_ram_indexes.sprite_palette3.colour[2];
+    uint8_t sprite = ppu->sprite_line[x];
+    if (!ppu->reg.mask.show_sprites || (left && !ppu->reg.mask.show_sprites_leftmost))
+    {
+        sprite = 0;
+    }
 
-                default: assert(0); return 0;
+    const bool bg_opaque = bg & 0x3;
+    if (sprite)
+    {
+        if ((sprite & PPU_SPRITE_ZERO) && bg_opaque && x != 255)
+        {
+            ppu->reg.status.sprite_0hit = 1;
+        }
+
+        if (!(sprite & PPU_SPRITE_BEHIND) || !bg_opaque)
+        {
+            return palette_colour(ppu, 0x10 | (sprite & PPU_SPRITE_COLOUR));
+        }
+    }
+
+    return palette_colour(ppu, bg_opaque ? bg : 0);
+}
+
+/// Which sprites are on every line, a sprite at a time, rather than every sprite a line at a time.
+static void build_sprite_lists(ppu_t *ppu)
+{
+    memset(ppu->sprite_counts, 0, sizeof(ppu->sprite_counts));
+
+    const uint8_t height = ppu->reg.ctrl.sprite_size ? 16 : 8;
+    for (uint8_t i = 0; i < 64; i++)
+    {
+        /// sprite y is the line above the top of the sprite, so it is evaluated on sprite y.
+        const uint16_t top = ppu->oam[i].sprite_y;
+        const uint16_t bottom = top + height < PPU_SCREEN_HEIGHT ? top + height : PPU_SCREEN_HEIGHT;
+        for (uint16_t line = top; line < bottom; line++)
+        {
+            const uint8_t count = ppu->sprite_counts[line] & ~PPU_SPRITE_LIST_OVERFLOW;
+            if (count == PPU_SPRITES_PER_LINE)
+            {
+                ppu->sprite_counts[line] |= PPU_SPRITE_LIST_OVERFLOW;
+                continue;
             }
-        case PPUMemMap_ST_PaletteRamIndexesMirrors ... PPUMemMap_ED_PaletteRamIndexesMirrors:
-            return ppu_read8(addr - (0x20 * ((addr - PPUMemMap_ST_PaletteRamIndexes) % 0x20)));
-        
-        default: assert(0); return 0;
+            ppu->sprite_lists[line][count] = i;
+            ppu->sprite_counts[line]++;
+        }
     }
+
+    ppu->sprite_lists_valid = true;
 }
 
-static inline void ppu_write8(uint16_t addr, uint8_t v)
+/// Draws the (up to 8) sprites on the next line into the sprite line, from its sprite list.
+/// The first opaque sprite at a pixel wins, whatever its priority, as on hardware.
+static void evaluate_sprites(ppu_t *ppu)
 {
-    switch (addr)
+    memset(ppu->sprite_line, 0, sizeof(ppu->sprite_line));
+
+    if (!ppu->sprite_lists_valid)
     {
-        case PPUMemMap_ST_PatternTable0 ... PPUMemMap_ED_PatternTable0: assert(0);
-        case PPUMemMap_ST_PatternTable1 ... PPUMemMap_ED_PatternTable1: assert(0);
+        build_sprite_lists(ppu);
+    }
 
-        case PPUMemMap_ST_Nametable0 ... PPUMemMap_ED_Nametable0: assert(0);
-        case PPUMemMap_ST_Nametable1 ... PPUMemMap_ED_Nametable1: assert(0);
-        case PPUMemMap_ST_Nametable2 ... PPUMemMap_ED_Nametable2: assert(0);
-        case PPUMemMap_ST_Nametable3 ... PPUMemMap_ED_Nametable3: assert(0);
+    const uint8_t height = ppu->reg.ctrl.sprite_size ? 16 : 8;
+    const uint8_t *list = ppu->sprite_lists[ppu->scanline];
+    const uint8_t count = ppu->sprite_counts[ppu->scanline] & ~PPU_SPRITE_LIST_OVERFLOW;
 
-        case PPUMemMap_ST_NametableMirrors ... PPUMemMap_ED_NametableMirrors: assert(0);
+    if (ppu->sprite_counts[ppu->scanline] & PPU_SPRITE_LIST_OVERFLOW)
+    {
+        ppu->reg.status.sprite_overflow = 1;
+    }
 
-        case PPUMemMap_ST_PaletteRamIndexes ... PPUMemMap_ED_PaletteRamIndexes: assert(0);
-            switch (addr)
+    for (uint8_t n = 0; n < count; n++)
+    {
+        const uint8_t i = list[n];
+        const ppu_oam_t *sprite = &ppu->oam[i];
+
+        uint16_t row = ppu->scanline - sprite->sprite_y;
+        if (sprite->_sprite_attribute.flip_vertically)
+        {
+            row = height - 1 - row;
+        }
+
+        uint16_t addr;
+        if (height == 16)
+        {
+            addr = ((sprite->sprite_number & 1) << 12) | ((sprite->sprite_number & 0xFE) << 4) | ((row & 8) << 1) | (row & 7);
+        }
+        else
+        {
+            addr = (ppu->reg.ctrl.sprite_pattern_table_addr << 12) | (sprite->sprite_number << 4) | row;
+        }
+
+        const uint64_t pixels = tile_row(ppu, addr, sprite->_sprite_attribute.flip_horizontally);
+        const uint8_t flags = (sprite->_sprite_attribute.palette << 2) |
+            (sprite->_sprite_attribute.priority ? PPU_SPRITE_BEHIND : 0) | (i == 0 ? PPU_SPRITE_ZERO : 0);
+
+        for (uint8_t p = 0; p < 8 && sprite->sprite_x + p < PPU_SCREEN_WIDTH; p++)
+        {
+            const uint8_t pixel = (pixels >> (p * 8)) & 0x3;
+            uint8_t *out = &ppu->sprite_line[sprite->sprite_x + p];
+            if (pixel && !*out)
             {
-                case PPUMemMap_ST_PaletteRamIndexes + 0:    ppu->mem.palette_ram_indexes.background_colour = v;             break;
+                *out = flags | pixel;
+            }
+        }
+    }
+}
 
-                case PPUMemMap_ST_PaletteRamIndexes + 1:    ppu->mem.palette_ram_indexes.background_palette0.colour[0] = v; break;
-                case PPUMemMap_ST_PaletteRamIndexes + 2:    ppu->mem.palette_ram_indexes.background_palette0.colour[1] = v; break;
-                case PPUMemMap_ST_PaletteRamIndexes + 3:    ppu->mem.palette_ram_indexes.background_palette0.colour[2] = v; break;
+/// Dots 1-256 in one go, what stepping through them dot by dot does, a tile at a time.
+static void draw_line(ppu_t *ppu, bool visible)
+{
+    /// 2 tiles from the shifters, then the 32 fetched during the line,
+    /// the last is never drawn but is fetched all the same.
+    uint8_t pixels[34 * 8];
 
-                case PPUMemMap_ST_PaletteRamIndexes + 5:    ppu->mem.palette_ram_indexes.background_palette1.colour[0] = v; break;
-                case PPUMemMap_ST_PaletteRamIndexes + 6:    ppu->mem.palette_ram_indexes.background_palette1.colour[1] = v; break;
-                case PPUMemMap_ST_PaletteRamIndexes + 7:    ppu->mem.palette_ram_indexes.background_palette1.colour[2] = v; break;
+    for (uint8_t i = 0; i < 16; i++)
+    {
+        const uint8_t bit = 15 - i;
+        pixels[i] = ((ppu->bg_lo >> bit) & 1) | (((ppu->bg_hi >> bit) & 1) << 1) |
+            (((ppu->at_lo >> bit) & 1) << 2) | (((ppu->at_hi >> bit) & 1) << 3);
+    }
 
-                case PPUMemMap_ST_PaletteRamIndexes + 9:    ppu->mem.palette_ram_indexes.background_palette2.colour[0] = v; break;
-                case PPUMemMap_ST_PaletteRamIndexes + 10:   ppu->mem.palette_ram_indexes.background_palette2.colour[1] = v; break;
-                case PPUMemMap_ST_PaletteRamIndexes + 11:   ppu->mem.palette_ram_indexes.background_palette2.colour[2] = v; break;
+    for (uint8_t i = 2; i < 34; i++)
+    {
+        uint8_t palette;
+        const uint64_t row = tile_row(ppu, fetch_pattern(ppu, &palette), false);
+        increment_x(ppu);
 
-                case PPUMemMap_ST_PaletteRamIndexes + 13:   ppu->mem.palette_ram_indexes.background_palette3.colour[0] = v; break;
-                case PPUMemMap_ST_PaletteRamIndexes + 14:   ppu->mem.palette_ram_indexes.background_palette3.colour[1] = v; break;
-                case PPUMemMap_ST_PaletteRamIndexes + 15:   ppu->mem.palette_ram_indexes.background_palette3.colour[2] = v; break;
+        /// palette << 2 into every pixel.
+        const uint64_t out = row | (palette * 0x0404040404040404ULL);
+        memcpy(&pixels[i * 8], &out, sizeof(out));
+    }
 
-                case PPUMemMap_ST_PaletteRamIndexes + 17:   ppu->mem.palette_ram_indexes.sprite_palette0.colour[0] = v;     break;
-                case PPUMemMap_ST_PaletteRamIndexes + 18:   ppu->mem.palette_ram_indexes.sprite_palette0.colour[1] = v;     break;
-                case PPUMemMap_ST_PaletteRamIndexes + 19:   ppu->mem.palette_ram_indexes.sprite_palette0.colour[2] = v;     break;
+    /// where the shifters would be after the last shift / load, the last 2 tiles.
+    for (uint16_t i = 32 * 8; i < 34 * 8; i++)
+    {
+        shift_shifters(ppu, 1);
+        ppu->bg_lo |= pixels[i] & 1;
+        ppu->bg_hi |= (pixels[i] >> 1) & 1;
+        ppu->at_lo |= (pixels[i] >> 2) & 1;
+        ppu->at_hi |= (pixels[i] >> 3) & 1;
+    }
 
-                case PPUMemMap_ST_PaletteRamIndexes + 21:   ppu->mem.palette_ram_indexes.sprite_palette1.colour[0] = v;     break;
-                case PPUMemMap_ST_PaletteRamIndexes + 22:   ppu->mem.palette_ram_indexes.sprite_palette1.colour[1] = v;     break;
-                case PPUMemMap_ST_PaletteRamIndexes + 23:   ppu->mem.palette_ram_indexes.sprite_palette1.colour[2] = v;     break;
+    increment_y(ppu);
 
-                case PPUMemMap_ST_PaletteRamIndexes + 25:   ppu->mem.palette_ram_indexes.sprite_palette2.colour[0] = v;     break;
-                case PPUMemMap_ST_PaletteRamIndexes + 26:   ppu->mem.palette_ram_indexes.sprite_palette2.colour[1] = v;     break;
-                case PPUMemMap_ST_PaletteRamIndexes + 27:   ppu->mem.palette_ram_indexes.sprite_palette2.colour[2] = v;     break;
+    if (visible)
+    {
+        uint8_t *line = ppu->framebuffer[ppu->scanline];
+        for (uint16_t x = 0; x < PPU_SCREEN_WIDTH; x++)
+        {
+            line[x] = compose_pixel(ppu, x, pixels[x + ppu->x]);
+        }
+    }
+}
 
-                case PPUMemMap_ST_PaletteRamIndexes + 29:   ppu->mem.palette_ram_indexes.sprite_palette3.colour[0] = v;     break;
-                case PPUMemMap_ST_PaletteRamIndexes + 30:   ppu->mem.palette_ram_indexes.sprite_palette3.colour[1] = v;     break;
-                case PPUMemMap_ST_PaletteRamIndexes + 31:   ppu->mem.palette_ram_indexes.sprite_palette3.colour[2] = v;     break;
+/// Dots [from, to) of 1-256, a dot at a time.
+static void step_dots(ppu_t *ppu, uint16_t from, uint16_t to, bool visible)
+{
+    for (uint16_t dot = from; dot < to; dot++)
+    {
+        if (visible)
+        {
+            ppu->framebuffer[ppu->scanline][dot - 1] = compose_pixel(ppu, dot - 1, shifter_pixel(ppu));
+        }
+
+        shift_shifters(ppu, 1);
+        if ((dot & 7) == 0)
+        {
+            load_shifters(ppu, fetch_tile(ppu));
+        }
+
+        if (dot == PPU_DOT_DRAW_END - 1)
+        {
+            increment_y(ppu);
+        }
+    }
+}
 
-                default: assert(0); break;
+/// Runs dots [from, to) of the current line, which is visible or the pre-render line.
+/// The registers can't change within a call, the cpu only touches them between catch ups.
+static void render_dots(ppu_t *ppu, uint16_t from, uint16_t to)
+{
+    const bool visible = ppu->scanline < PPU_SCREEN_HEIGHT;
+
+    /// the emphasis of a line is whatever it was last drawn with.
+    if (visible && from < PPU_DOT_DRAW_END)
+    {
+        ppu->emphasis[ppu->scanline] = ppu->reg.ppu_mask >> 5;
+    }
+
+    if (!rendering(ppu))
+    {
+        /// the backdrop, and v stays put.
+        if (visible)
+        {
+            const uint16_t start = from > PPU_DOT_DRAW_START ? from : PPU_DOT_DRAW_START;
+            const uint16_t end = to < PPU_DOT_DRAW_END ? to : PPU_DOT_DRAW_END;
+            if (start < end)
+            {
+                memset(&ppu->framebuffer[ppu->scanline][start - 1], palette_colour(ppu, 0), end - start);
+            }
+        }
+
+        if (from <= PPU_DOT_HORI_COPY && to > PPU_DOT_HORI_COPY)
+        {
+            memset(ppu->sprite_line, 0, sizeof(ppu->sprite_line));
+        }
+        return;
+    }
+
+    const uint16_t start = from > PPU_DOT_DRAW_START ? from : PPU_DOT_DRAW_START;
+    const uint16_t end = to < PPU_DOT_DRAW_END ? to : PPU_DOT_DRAW_END;
+    if (start == PPU_DOT_DRAW_START && end == PPU_DOT_DRAW_END)
+    {
+        draw_line(ppu, visible);
+    }
+    else if (start < end)
+    {
+        step_dots(ppu, start, end, visible);
+    }
+
+    if (from <= PPU_DOT_HORI_COPY && to > PPU_DOT_HORI_COPY)
+    {
+        ppu->v = (ppu->v & ~0x041F) | (ppu->t & 0x041F);
+
+        /// there are no sprites on the first line.
+        if (visible)
+        {
+            evaluate_sprites(ppu);
+        }
+        else
+        {
+            memset(ppu->sprite_line, 0, sizeof(ppu->sprite_line));
+        }
+    }
+
+    /// done every dot of it, once is the same as t can't change part way.
+    if (!visible && from < PPU_DOT_VERT_COPY_END && to > PPU_DOT_VERT_COPY_START)
+    {
+        ppu->v = (ppu->v & ~0x7BE0) | (ppu->t & 0x7BE0);
+    }
+
+    if (from <= PPU_DOT_PREFETCH0 && to > PPU_DOT_PREFETCH0)
+    {
+        shift_shifters(ppu, 8);
+        load_shifters(ppu, fetch_tile(ppu));
+    }
+    if (from <= PPU_DOT_PREFETCH1 && to > PPU_DOT_PREFETCH1)
+    {
+        shift_shifters(ppu, 8);
+        load_shifters(ppu, fetch_tile(ppu));
+    }
+}
+
+/// Advance by up to the next event or the end of a drawn line, then run the event if it was reached.
+/// Returns how many dots were actually run.
+static uint32_t ppu_advance(ppu_t *ppu, uint32_t dots)
+{
+    uint32_t pos = frame_position(ppu);
+    uint32_t next = next_event_position(pos);
+
+    /// lines that draw / fetch are run a line at a time, vblank in one go.
+    const bool render_line = ppu->scanline < PPU_SCREEN_HEIGHT || ppu->scanline == PPU_PRERENDER_SCANLINE;
+    if (render_line)
+    {
+        const uint32_t line_end = (ppu->scanline + 1) * PPU_DOTS_PER_SCANLINE;
+        next = line_end < next ? line_end : next;
+    }
+
+    if (dots > next - pos)
+    {
+        dots = next - pos;
+    }
+
+    if (render_line)
+    {
+        render_dots(ppu, ppu->dot, ppu->dot + dots);
+    }
+
+    pos += dots;
+    ppu->cycle_total += dots;
+
+    switch (pos)
+    {
+        case PPU_EVENT_VBLANK_START:
+            ppu->reg.status.vblank = 1;
+            if (ppu->reg.ctrl.nmi)
+            {
+                ppu->nmi_pending = true;
             }
-        case PPUMemMap_ST_PaletteRamIndexesMirrors ... PPUMemMap_ED_PaletteRamIndexesMirrors:
-            ppu_write8(addr - (0x20 * ((addr - PPUMemMap_ST_PaletteRamIndexes) % 0x20)), v);
             break;
-        
-        default:
-            assert(0);
+
+        case PPU_EVENT_VBLANK_END:
+            ppu->reg.status.vblank = 0;
+            ppu->reg.status.sprite_0hit = 0;
+            ppu->reg.status.sprite_overflow = 0;
+            break;
+
+        case PPU_EVENT_FRAME_END:
+            pos = 0;
+            ppu->frame++;
             break;
     }
+
+    ppu->scanline = pos / PPU_DOTS_PER_SCANLINE;
+    ppu->dot = pos % PPU_DOTS_PER_SCANLINE;
+
+    return dots;
 }
 
-int ppu_tick()
+int ppu_tick(ppu_t *ppu)
 {
+    ppu_advance(ppu, 1);
     return 0;
+}
+
+void ppu_catch_up(ppu_t *ppu, uint64_t cpu_cycle)
+{
+    const uint64_t target = cpu_cycle * PPU_DOTS_PER_CPU_CYCLE;
+
+    while (ppu->cycle_total < target)
+    {
+        const uint64_t remaining = target - ppu->cycle_total;
+        ppu_advance(ppu, remaining > PPU_EVENT_FRAME_END ? PPU_EVENT_FRAME_END : remaining);
+    }
+}
+
+uint64_t ppu_next_event_cycle(const ppu_t *ppu)
+{
+    const uint32_t pos = frame_position(ppu);
+    const uint64_t event = ppu->cycle_total + (next_event_position(pos) - pos);
+
+    /// round up, so the ppu has always reached the event when the cpu stops.
+    return (event + PPU_DOTS_PER_CPU_CYCLE - 1) / PPU_DOTS_PER_CPU_CYCLE;
+}
+
+uint64_t ppu_next_status_cycle(const ppu_t *ppu, uint64_t cpu_cycle)
+{
+    const bool drawing = rendering(ppu) && frame_position(ppu) < PPU_SCREEN_HEIGHT * PPU_DOTS_PER_SCANLINE;
+    if (drawing && !(ppu->reg.status.sprite_0hit && ppu->reg.status.sprite_overflow))
+    {
+        return cpu_cycle;
+    }
+    return ppu_next_event_cycle(ppu);
+}
+
+bool ppu_nmi_pending(const ppu_t *ppu)
+{
+    return ppu->nmi_pending;
+}
+
+void ppu_nmi_ack(ppu_t *ppu)
+{
+    ppu->nmi_pending = false;
 }
\ No newline at end of file
@@ -5,6 +5,7 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <stdbool.h>
 
 typedef enum
 {
@@ -95,26 +96,9 @@ typedef struct
     ppu_attribute_table_t attribute_table;
 } ppu_nametable_t; /// 0x0400
 
-#define PALETTE_COLOURS 3
-typedef struct
-{
-    uint8_t colour[PALETTE_COLOURS]; /// each palette has 3 colours.
-} ppu_palette_t;
-
-typedef struct
-{
-    uint8_t background_colour;
-
-    ppu_palette_t background_palette0;
-    ppu_palette_t background_palette1;
-    ppu_palette_t background_palette2;
-    ppu_palette_t background_palette3;
-
-    ppu_palette_t sprite_palette0;
-    ppu_palette_t sprite_palette1;
-    ppu_palette_t sprite_palette2;
-    ppu_palette_t sprite_palette3;
-} ppu_palettes_t;
+/// 4 background palettes then 4 sprite palettes, 4 colours each. Colour 0 of a sprite
+/// palette ($3F10 / $14 / $18 / $1C) is colour 0 of the background palette under it.
+#define PALETTE_RAM_SIZE 32
 
 typedef struct
 {
@@ -126,7 +110,7 @@ typedef struct
     ppu_nametable_t nametable2;
     ppu_nametable_t nametable3;
 
-    ppu_palettes_t palette_ram_indexes;
+    uint8_t palette_ram[PALETTE_RAM_SIZE]; /// colour indexes (0-63).
 } ppu_memory_map_t;
 
 typedef struct
@@ -156,22 +140,140 @@ typedef struct
     uint8_t sprite_x;
 } ppu_oam_t;
 
+/// How the 4 nametables at $2000-$2FFF are wired to vram, from the cart.
+typedef enum
+{
+    PPUMirroring_Horizontal, /// $2000 = $2400, $2800 = $2C00.
+    PPUMirroring_Vertical, /// $2000 = $2800, $2400 = $2C00.
+    PPUMirroring_FourScreen, /// all 4 are there.
+} PPUMirroring;
+
+/// ppu_t.sprite_line entries, 0 where there is no sprite pixel.
+#define PPU_SPRITE_COLOUR 0x0F /// palette << 2 | pixel, into the sprite palettes.
+#define PPU_SPRITE_BEHIND 0x40 /// behind the background.
+#define PPU_SPRITE_ZERO 0x80 /// from sprite 0, for sprite 0 hit.
+
+/// Most sprites drawn on a line, more sets sprite overflow.
+#define PPU_SPRITES_PER_LINE 8
+/// ppu_t.sprite_counts bit, there were more sprites on the line than were drawn.
+#define PPU_SPRITE_LIST_OVERFLOW 0x80
+
+/// Both pattern tables.
+#define PPU_TILES (PATTERN_TABLE_TILES * 2)
+
+/// Every pattern table tile decoded to a byte per pixel (0-3), so drawing a row is a load.
+/// A row is a uint64_t, the leftmost pixel in the lowest byte. Decoded the first time a tile
+/// is drawn after its chr changed (chr-ram writes, banks mapped).
+typedef struct
+{
+    uint64_t rows[PPU_TILES][8];
+    uint64_t flipped[PPU_TILES][8]; /// mirrored left to right, for sprites.
+    uint64_t valid[PPU_TILES / 64]; /// bit per tile.
+} ppu_tile_cache_t;
+
+#define PPU_SCREEN_WIDTH 256
+#define PPU_SCREEN_HEIGHT 240
+
+/// NTSC timing.
+#define PPU_DOTS_PER_SCANLINE 341
+#define PPU_SCANLINES_PER_FRAME 262
+#define PPU_VBLANK_SCANLINE 241
+#define PPU_PRERENDER_SCANLINE 261
+#define PPU_DOTS_PER_CPU_CYCLE 3
+
 typedef struct
 {
+    /// Registers and timing first, they are what the cpu's io path and the catch up
+    /// touch, and share a cache line. The memory after is only touched while rendering.
     ppu_registers_t reg;
+
+    uint16_t dot;
+    uint16_t scanline;
+    uint64_t frame;
+    uint64_t cycle_total; /// in ppu dots.
+
+    bool nmi_pending;
+
+    /// The internal registers PPUCTRL / PPUSCROLL / PPUADDR / PPUDATA really write to,
+    /// see "PPU scrolling" on the nesdev wiki.
+    uint16_t v; /// vram address (15 bits), what is being fetched while rendering.
+    uint16_t t; /// vram address of the top left of the screen.
+    uint8_t x; /// fine x scroll.
+    uint8_t w; /// write toggle, for PPUSCROLL / PPUADDR.
+    uint8_t read_buffer; /// PPUDATA reads are one behind, apart from the palette.
+
     ppu_memory_map_t mem;
     ppu_oam_t oam[64];
+
+    /// Background shifters, the high byte is the tile being drawn.
+    uint16_t bg_lo;
+    uint16_t bg_hi;
+    uint16_t at_lo;
+    uint16_t at_hi;
+
+    /// The sprites of the line being drawn, evaluated at the end of the line before.
+    uint8_t sprite_line[PPU_SCREEN_WIDTH];
+
+    /// The oam index of the sprites on each line (from the line evaluated on), in oam order.
+    /// Built from oam in one go the first time a line is evaluated after oam or the sprite size
+    /// changed, rather than scanning oam every line, as it mostly changes once a frame.
+    uint8_t sprite_lists[PPU_SCREEN_HEIGHT][PPU_SPRITES_PER_LINE];
+    uint8_t sprite_counts[PPU_SCREEN_HEIGHT]; /// how many are in the list, | PPU_SPRITE_LIST_OVERFLOW.
+    bool sprite_lists_valid;
+
+    /// Colour indexes (0-63), complete once the frame has ended.
+    uint8_t framebuffer[PPU_SCREEN_HEIGHT][PPU_SCREEN_WIDTH];
+
+    /// ppumask's emphasis bits (red, green, blue) each line was drawn with, see nes/video.h.
+    uint8_t emphasis[PPU_SCREEN_HEIGHT];
+
+    ppu_tile_cache_t tiles;
+
+    /// What the cart has wired in, kept over a reset. Everything above is cleared.
+    uint8_t *chr[8]; /// 1KiB banks of the pattern tables, NULL reads 0.
+    uint8_t chr_writable; /// bit per bank, chr-ram.
+    PPUMirroring mirroring;
+    uint8_t *nametables[4]; /// $2000 / $2400 / $2800 / $2C00 after mirroring, into mem.
 } ppu_t;
 
-const ppu_t *ppu_init();
-void ppu_exit();
+int ppu_init(ppu_t *ppu);
+int ppu_reset(ppu_t *ppu);
+
+uint8_t ppu_read_register(ppu_t *ppu, uint16_t addr);
+void ppu_write_register(ppu_t *ppu, uint16_t addr, uint8_t v);
+
+/// $4014, copies a page (256 bytes) into oam, the cpu does the stall.
+void ppu_oam_dma(ppu_t *ppu, const uint8_t *data);
+
+/// Maps size bytes of chr at addr in the pattern tables, in 1KiB banks. NULL unmaps.
+void ppu_map_chr(ppu_t *ppu, uint16_t addr, uint32_t size, uint8_t *data, bool writable);
+void ppu_set_mirroring(ppu_t *ppu, PPUMirroring mirroring);
+
+/// Throw away the decoded tiles, when chr changes other than through ppu_map_chr() / the ppu's own writes.
+void ppu_invalidate_tiles(ppu_t *ppu);
+
+/// Throw away the sprite lists, when oam changes other than through the ppu's registers / ppu_oam_dma().
+void ppu_invalidate_sprites(ppu_t *ppu);
+
+/// Advance the ppu by a single dot.
+int ppu_tick(ppu_t *ppu);
+
+/// Run the ppu until it has caught up to the cpu.
+/// Nothing in the ppu is observable until the cpu touches its registers or an event is due,
+/// so this is only called then, and runs in bulk between events.
+/// Lines are drawn a whole line at a time, unless the cpu touched a register part way through
+/// one, then that line is drawn a dot at a time, so the change lands on the right pixel.
+void ppu_catch_up(ppu_t *ppu, uint64_t cpu_cycle);
 
-int ppu_reset();
+/// The cpu cycle of the next vblank start / end or end of frame.
+uint64_t ppu_next_event_cycle(const ppu_t *ppu);
 
-uint8_t ppu_read_register(uint16_t addr);
-void ppu_write_register(uint16_t addr, uint8_t v);
+/// The cpu cycle ppustatus could next change by, given the ppu has caught up to cpu_cycle.
+/// Sprite 0 hit / overflow can be set on any dot of a drawn line, otherwise it is the next event.
+uint64_t ppu_next_status_cycle(const ppu_t *ppu, uint64_t cpu_cycle);
 
-int ppu_tick();
+bool ppu_nmi_pending(const ppu_t *ppu);
+void ppu_nmi_ack(ppu_t *ppu);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "profile.h"
+#include "cpu_opcodes.h"
+
+#define PROFILE_OPCODE_NAME_ENTRY(code, mode, ins) [code] = #ins " " #mode,
+
+static const char *const opcode_names[0x100] =
+{
+    CPU_OPCODE_LIST(PROFILE_OPCODE_NAME_ENTRY)
+};
+
+static const char *const subsystem_names[ProfileSubsystem_Count] =
+{
+    [ProfileSubsystem_None] = "none",
+    [ProfileSubsystem_CPU] = "cpu",
+    [ProfileSubsystem_PPU] = "ppu",
+    [ProfileSubsystem_APU] = "apu",
+    [ProfileSubsystem_Mapper] = "mapper",
+};
+
+static const char *const region_names[ProfileRegion_Count] =
+{
+    [ProfileRegion_Ram] = "ram",
+    [ProfileRegion_PPU] = "ppu",
+    [ProfileRegion_IO] = "io",
+    [ProfileRegion_Expansion] = "expansion",
+    [ProfileRegion_PrgRam] = "prg_ram",
+    [ProfileRegion_PrgRom] = "prg_rom",
+};
+
+void profile_reset(profile_t *profile)
+{
+    memset(profile, 0, sizeof(profile_t));
+    profile->last = profile_now();
+}
+
+int profile_write_csv(const profile_t *profile, FILE *fp)
+{
+    assert(profile && fp);
+    if (!profile || !fp)
+    {
+        fprintf(stderr, "Nothing to write the profile to\n");
+        return -1;
+    }
+
+    fprintf(fp, "kind,name,count,ticks\n");
+
+    for (uint32_t i = 0; i < 0x100; i++)
+    {
+        if (profile->opcode_count[i])
+        {
+            fprintf(fp, "opcode,%02X %s,%lu,%lu\n", i, opcode_names[i] ? opcode_names[i] : "???",
+                profile->opcode_count[i], profile->opcode_ticks[i]);
+        }
+    }
+
+    for (uint32_t i = 0; i < ProfileSubsystem_Count; i++)
+    {
+        fprintf(fp, "subsystem,%s,,%lu\n", subsystem_names[i], profile->subsystem_ticks[i]);
+    }
+
+    for (uint32_t i = 0; i < ProfileRegion_Count; i++)
+    {
+        fprintf(fp, "read,%s,%lu,\n", region_names[i], profile->reads[i]);
+    }
+
+    for (uint32_t i = 0; i < ProfileRegion_Count; i++)
+    {
+        fprintf(fp, "write,%s,%lu,\n", region_names[i], profile->writes[i]);
+    }
+
+    if (ferror(fp))
+    {
+        fprintf(stderr, "Failed to write profile\n");
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+#else
+    #include <time.h>
+#endif
+
+/// Profiling counters, to see where the host time goes.
+/// Compiled out unless everything is built with -DNES_PROFILE=1, then a profile_t
+/// is attached with nes_set_profile() and read straight out of the struct, or dumped with profile_write_csv().
+///
+/// Host time is in rdtsc ticks (clock_gettime() ns where there is no rdtsc), and includes the
+/// cost of reading it, which is a big part of a cheap instruction.
+/// Opcodes and bus accesses are only counted by the interpreter, jit blocks show up as cpu time.
+#ifndef NES_PROFILE
+    #define NES_PROFILE 0
+#endif
+
+typedef enum
+{
+    ProfileSubsystem_None, /// outside of nes_run() / nes_step().
+    ProfileSubsystem_CPU,
+    ProfileSubsystem_PPU,
+    ProfileSubsystem_APU,
+    ProfileSubsystem_Mapper,
+    ProfileSubsystem_Count,
+} ProfileSubsystem;
+
+/// Where in the cpu address space a bus access went.
+typedef enum
+{
+    ProfileRegion_Ram,          /// 0x0000 - 0x1FFF
+    ProfileRegion_PPU,          /// 0x2000 - 0x3FFF
+    ProfileRegion_IO,           /// 0x4000 - 0x401F
+    ProfileRegion_Expansion,    /// 0x4020 - 0x5FFF
+    ProfileRegion_PrgRam,       /// 0x6000 - 0x7FFF
+    ProfileRegion_PrgRom,       /// 0x8000 - 0xFFFF
+    ProfileRegion_Count,
+} ProfileRegion;
+
+typedef struct profile
+{
+    uint64_t opcode_count[0x100];
+    uint64_t opcode_ticks[0x100]; /// includes the io the instruction did.
+
+    /// Exclusive, ie the ppu catching up inside of a cpu read is ppu time, not cpu time.
+    uint64_t subsystem_ticks[ProfileSubsystem_Count];
+
+    uint64_t reads[ProfileRegion_Count];
+    uint64_t writes[ProfileRegion_Count];
+
+    /// Who the time since last is going to.
+    ProfileSubsystem current;
+    uint64_t last;
+} profile_t;
+
+void profile_reset(profile_t *profile);
+
+/// "kind,name,count,ticks", one line per opcode that ran, subsystem and region.
+int profile_write_csv(const profile_t *profile, FILE *fp);
+
+static inline uint64_t profile_now(void)
+{
+    #if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+    #else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    #endif
+}
+
+/// Charge the time so far to whoever was running, and start charging subsystem.
+/// Returns who was running, to switch back to afterwards.
+static inline ProfileSubsystem profile_switch(profile_t *profile, ProfileSubsystem subsystem)
+{
+    const uint64_t now = profile_now();
+    const ProfileSubsystem prev = profile->current;
+    profile->subsystem_ticks[prev] += now - profile->last;
+    profile->current = subsystem;
+    profile->last = now;
+    return prev;
+}
+
+static inline ProfileRegion profile_region(uint16_t addr)
+{
+    switch (addr)
+    {
+        case 0x0000 ... 0x1FFF: return ProfileRegion_Ram;
+        case 0x2000 ... 0x3FFF: return ProfileRegion_PPU;
+        case 0x4000 ... 0x401F: return ProfileRegion_IO;
+        case 0x4020 ... 0x5FFF: return ProfileRegion_Expansion;
+        case 0x6000 ... 0x7FFF: return ProfileRegion_PrgRam;
+        default:                return ProfileRegion_PrgRom;
+    }
+}
+
+/// Runs call with its time charged to subsystem, if a profile is attached to the nes.
+#if NES_PROFILE
+    #define PROFILE_CALL(nes, subsystem, call) do \
+    { \
+        profile_t *profile_ = (nes)->profile; \
+        const ProfileSubsystem prev_ = profile_ ? profile_switch(profile_, subsystem) : ProfileSubsystem_None; \
+        call; \
+        if (profile_) \
+        { \
+            profile_switch(profile_, prev_); \
+        } \
+    } while (0)
+#else
+    #define PROFILE_CALL(nes, subsystem, call) do { call; } while (0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
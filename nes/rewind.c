@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "nes.h"
+#include "rewind.h"
+
+/// The delta is encoded as a run of tokens, each one being
+/// [u16 zero bytes to skip] [u16 literal bytes] [literal bytes...].
+/// Literals are stored xor'd, so decoding is a skip then an xor into the state.
+#define RLE_MAX_RUN 0xFFFF
+/// Zero runs shorter than this are cheaper left in the literals than starting a new token.
+#define RLE_MIN_ZERO_RUN 4
+
+static size_t rle_worst_case(size_t size)
+{
+    return size + 4 * (size / RLE_MAX_RUN + 2);
+}
+
+static void put16(uint8_t *out, uint16_t v)
+{
+    out[0] = v & 0xFF;
+    out[1] = v >> 8;
+}
+
+static uint16_t get16(const uint8_t *in)
+{
+    return in[0] | (in[1] << 8);
+}
+
+/// Encodes a ^ b.
+static size_t rle_encode(const uint8_t *a, const uint8_t *b, size_t size, uint8_t *out)
+{
+    size_t o = 0;
+    size_t i = 0;
+
+    while (i < size)
+    {
+        /// skip matching bytes, a word at a time while we can.
+        size_t zero_start = i;
+        while (i + 8 <= size && i - zero_start + 8 <= RLE_MAX_RUN)
+        {
+            uint64_t wa, wb;
+            memcpy(&wa, a + i, 8);
+            memcpy(&wb, b + i, 8);
+            if (wa != wb)
+            {
+                break;
+            }
+            i += 8;
+        }
+        while (i < size && i - zero_start < RLE_MAX_RUN && a[i] == b[i])
+        {
+            i++;
+        }
+        const size_t zeros = i - zero_start;
+
+        /// literals run until the next zero run worth a token.
+        size_t lit_start = i;
+        size_t same = 0;
+        while (i < size && i - lit_start < RLE_MAX_RUN)
+        {
+            same = a[i] == b[i] ? same + 1 : 0;
+            i++;
+            if (same == RLE_MIN_ZERO_RUN)
+            {
+                i -= same;
+                break;
+            }
+        }
+        const size_t lits = i - lit_start;
+
+        put16(out + o, zeros);
+        put16(out + o + 2, lits);
+        o += 4;
+        for (size_t j = 0; j < lits; j++)
+        {
+            out[o + j] = a[lit_start + j] ^ b[lit_start + j];
+        }
+        o += lits;
+    }
+
+    return o;
+}
+
+/// Xors the encoded delta into state.
+static void rle_apply(const uint8_t *in, size_t in_size, uint8_t *state)
+{
+    size_t o = 0;
+    for (size_t i = 0; i + 4 <= in_size;)
+    {
+        const uint16_t zeros = get16(in + i);
+        const uint16_t lits = get16(in + i + 2);
+        i += 4;
+        o += zeros;
+        for (uint16_t j = 0; j < lits; j++)
+        {
+            state[o + j] ^= in[i + j];
+        }
+        o += lits;
+        i += lits;
+    }
+}
+
+int rewind_init(rewind_t *rewind, size_t buf_size, uint32_t max_frames)
+{
+    memset(rewind, 0, sizeof(rewind_t));
+
+    assert(buf_size && max_frames);
+    if (!buf_size || !max_frames)
+    {
+        fprintf(stderr, "Empty rewind size\n");
+        return -1;
+    }
+
+    rewind->state_size = nes_state_size();
+    rewind->buf_size = buf_size;
+    rewind->max_frames = max_frames;
+
+    rewind->buf = malloc(buf_size);
+    rewind->entries = malloc(max_frames * sizeof(rewind_entry_t));
+    rewind->current = calloc(1, rewind->state_size);
+    rewind->next = calloc(1, rewind->state_size);
+    rewind->encoded = malloc(rle_worst_case(rewind->state_size));
+
+    if (!rewind->buf || !rewind->entries || !rewind->current || !rewind->next || !rewind->encoded)
+    {
+        fprintf(stderr, "Failed to alloc rewind buffers\n");
+        rewind_exit(rewind);
+        return -1;
+    }
+
+    return 0;
+}
+
+void rewind_exit(rewind_t *rewind)
+{
+    free(rewind->buf);
+    free(rewind->entries);
+    free(rewind->current);
+    free(rewind->next);
+    free(rewind->encoded);
+    memset(rewind, 0, sizeof(rewind_t));
+}
+
+void rewind_clear(rewind_t *rewind)
+{
+    rewind->write = 0;
+    rewind->first = 0;
+    rewind->count = 0;
+    rewind->has_current = false;
+}
+
+static void drop_oldest(rewind_t *rewind)
+{
+    rewind->first = (rewind->first + 1) % rewind->max_frames;
+    rewind->count--;
+}
+
+static bool overlaps(const rewind_entry_t *entry, size_t start, size_t end)
+{
+    return entry->offset < end && entry->offset + entry->size > start;
+}
+
+int rewind_push(rewind_t *rewind, const nes_t *nes)
+{
+    if (nes_state_save(nes, rewind->next, rewind->state_size) != 0)
+    {
+        return -1;
+    }
+
+    if (rewind->has_current)
+    {
+        const size_t size = rle_encode(rewind->current, rewind->next, rewind->state_size, rewind->encoded);
+
+        /// a single delta bigger than the whole ring, history can't go back past here.
+        if (size > rewind->buf_size)
+        {
+            rewind_clear(rewind);
+        }
+        else
+        {
+            size_t start = rewind->write;
+            size_t end = start + size;
+
+            /// doesn't fit before the end, so wrap. Anything left past the write
+            /// point is from the last lap, so is the oldest, and goes first.
+            if (end > rewind->buf_size)
+            {
+                while (rewind->count && overlaps(&rewind->entries[rewind->first], start, rewind->buf_size))
+                {
+                    drop_oldest(rewind);
+                }
+                start = 0;
+                end = size;
+            }
+
+            while (rewind->count && overlaps(&rewind->entries[rewind->first], start, end))
+            {
+                drop_oldest(rewind);
+            }
+
+            if (rewind->count == rewind->max_frames)
+            {
+                drop_oldest(rewind);
+            }
+
+            memcpy(rewind->buf + start, rewind->encoded, size);
+            rewind_entry_t *entry = &rewind->entries[(rewind->first + rewind->count) % rewind->max_frames];
+            entry->offset = start;
+            entry->size = size;
+            rewind->count++;
+            rewind->write = end;
+        }
+    }
+
+    /// the new state becomes the newest, the old buffer gets reused next push.
+    uint8_t *tmp = rewind->current;
+    rewind->current = rewind->next;
+    rewind->next = tmp;
+    rewind->has_current = true;
+
+    return 0;
+}
+
+int rewind_pop(rewind_t *rewind, nes_t *nes)
+{
+    if (!rewind->count)
+    {
+        return -1;
+    }
+
+    const uint32_t newest = (rewind->first + rewind->count - 1) % rewind->max_frames;
+    const rewind_entry_t *entry = &rewind->entries[newest];
+
+    rle_apply(rewind->buf + entry->offset, entry->size, rewind->current);
+
+    /// the next push goes straight after what is now the newest delta.
+    rewind->count--;
+    rewind->write = 0;
+    if (rewind->count)
+    {
+        const rewind_entry_t *prev = &rewind->entries[(newest + rewind->max_frames - 1) % rewind->max_frames];
+        rewind->write = prev->offset + prev->size;
+    }
+
+    return nes_state_load(nes, rewind->current, rewind->state_size);
+}
+
+uint32_t rewind_frames(const rewind_t *rewind)
+{
+    return rewind->count;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/// Defined in nes.h, every component lives inside of it.
+typedef struct nes nes_t;
+
+/// Rewind history, a save state is pushed every frame.
+/// Only the newest state is kept whole, every older frame is stored as the xor
+/// of it and the frame after it, run length encoded. Most of a state doesn't change
+/// between frames, so that is mostly zeros and packs down to a few hundred bytes.
+/// Stepping back decodes one delta straight into the newest state.
+///
+/// The deltas live in a fixed size ring, once that (or the frame limit) is full
+/// the oldest frames are dropped, so memory use never grows past what was asked for.
+
+typedef struct
+{
+    uint32_t offset;
+    uint32_t size;
+} rewind_entry_t;
+
+typedef struct
+{
+    uint8_t *buf; /// ring of encoded deltas.
+    size_t buf_size;
+    size_t write; /// end of the newest delta.
+
+    rewind_entry_t *entries; /// ring of deltas, oldest first.
+    uint32_t max_frames;
+    uint32_t first;
+    uint32_t count;
+
+    uint8_t *current; /// newest state, whole.
+    uint8_t *next;    /// the state being pushed.
+    uint8_t *encoded; /// worst case sized scratch to encode into.
+    size_t state_size;
+    bool has_current;
+} rewind_t;
+
+int rewind_init(rewind_t *rewind, size_t buf_size, uint32_t max_frames);
+void rewind_exit(rewind_t *rewind);
+
+/// Drop all history, ie after loading a rom or a save state.
+void rewind_clear(rewind_t *rewind);
+
+/// Save the current frame into the history, call once per frame.
+int rewind_push(rewind_t *rewind, const nes_t *nes);
+
+/// Step back one frame, fails once there is no history left.
+int rewind_pop(rewind_t *rewind, nes_t *nes);
+
+uint32_t rewind_frames(const rewind_t *rewind);
+
+#ifdef __cplusplus
+}
+#endif
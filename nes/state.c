@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "nes.h"
+#include "state.h"
+#include "guestprof.h"
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+
+    /// checked on load, a state is no good on a cart with a different layout.
+    uint32_t mapper_type;
+    uint32_t pgr_rom_size;
+    uint32_t chr_rom_size;
+} state_header_t;
+
+typedef struct
+{
+    state_header_t header;
+
+    struct
+    {
+        cpu_register_t reg;
+        uint8_t internal_ram[2048];
+        uint32_t cycle;
+        uint64_t cycle_total;
+        uint64_t count;
+    } cpu;
+
+    struct
+    {
+        ppu_registers_t reg;
+        ppu_memory_map_t mem;
+        ppu_oam_t oam[64];
+        uint16_t dot;
+        uint16_t scanline;
+        uint64_t frame;
+        uint64_t cycle_total;
+        uint8_t nmi_pending;
+        uint16_t v;
+        uint16_t t;
+        uint8_t x;
+        uint8_t w;
+        uint8_t read_buffer;
+        uint16_t bg_lo;
+        uint16_t bg_hi;
+        uint16_t at_lo;
+        uint16_t at_hi;
+        uint8_t sprite_line[PPU_SCREEN_WIDTH];
+    } ppu;
+
+    struct
+    {
+        apu_registers_t reg;
+        uint64_t cycle_total;
+    } apu;
+
+    joypad_t joypad;
+
+    uint8_t mapper[MAPPER_STATE_SIZE];
+} state_t;
+
+size_t nes_state_size()
+{
+    return sizeof(state_t);
+}
+
+int nes_state_save(const nes_t *nes, void *buf, size_t size)
+{
+    assert(nes && buf);
+    if (!nes || !buf)
+    {
+        fprintf(stderr, "Empty nes or buffer in state save\n");
+        return -1;
+    }
+
+    assert(size >= sizeof(state_t));
+    if (size < sizeof(state_t))
+    {
+        fprintf(stderr, "State buffer too small WANT:0x%zX GOT:0x%zX\n", sizeof(state_t), size);
+        return -1;
+    }
+
+    state_t *state = buf;
+
+    state->header.magic = NES_STATE_MAGIC;
+    state->header.version = NES_STATE_VERSION;
+    state->header.size = sizeof(state_t);
+    state->header.mapper_type = nes->mapper.type;
+    state->header.pgr_rom_size = nes->mapper.pgr_rom_size;
+    state->header.chr_rom_size = nes->mapper.chr_rom_size;
+
+    state->cpu.reg = nes->cpu.reg;
+    memcpy(state->cpu.internal_ram, nes->cpu.internal_ram, sizeof(state->cpu.internal_ram));
+    state->cpu.cycle = nes->cpu.cycle;
+    state->cpu.cycle_total = nes->cpu.cycle_total;
+    state->cpu.count = nes->cpu.debug.count;
+
+    state->ppu.reg = nes->ppu.reg;
+    state->ppu.mem = nes->ppu.mem;
+    memcpy(state->ppu.oam, nes->ppu.oam, sizeof(state->ppu.oam));
+    state->ppu.dot = nes->ppu.dot;
+    state->ppu.scanline = nes->ppu.scanline;
+    state->ppu.frame = nes->ppu.frame;
+    state->ppu.cycle_total = nes->ppu.cycle_total;
+    state->ppu.nmi_pending = nes->ppu.nmi_pending;
+    state->ppu.v = nes->ppu.v;
+    state->ppu.t = nes->ppu.t;
+    state->ppu.x = nes->ppu.x;
+    state->ppu.w = nes->ppu.w;
+    state->ppu.read_buffer = nes->ppu.read_buffer;
+    state->ppu.bg_lo = nes->ppu.bg_lo;
+    state->ppu.bg_hi = nes->ppu.bg_hi;
+    state->ppu.at_lo = nes->ppu.at_lo;
+    state->ppu.at_hi = nes->ppu.at_hi;
+    memcpy(state->ppu.sprite_line, nes->ppu.sprite_line, sizeof(state->ppu.sprite_line));
+
+    state->apu.reg = nes->apu.reg;
+    state->apu.cycle_total = nes->apu.cycle_total;
+
+    state->joypad = nes->joypad;
+
+    memcpy(state->mapper, nes->mapper.state, MAPPER_STATE_SIZE);
+
+    return 0;
+}
+
+int nes_state_load(nes_t *nes, const void *buf, size_t size)
+{
+    assert(nes && buf);
+    if (!nes || !buf)
+    {
+        fprintf(stderr, "Empty nes or buffer in state load\n");
+        return -1;
+    }
+
+    if (size < sizeof(state_header_t))
+    {
+        fprintf(stderr, "State is smaller than its header 0x%zX\n", size);
+        return -1;
+    }
+
+    const state_t *state = buf;
+
+    if (state->header.magic != NES_STATE_MAGIC || state->header.version != NES_STATE_VERSION ||
+        state->header.size != sizeof(state_t) || size < sizeof(state_t))
+    {
+        fprintf(stderr, "Not a state from this version MAGIC:0x%X VERSION:%u SIZE:0x%X\n",
+            state->header.magic, state->header.version, state->header.size);
+        return -1;
+    }
+
+    if (state->header.mapper_type != nes->mapper.type ||
+        state->header.pgr_rom_size != nes->mapper.pgr_rom_size ||
+        state->header.chr_rom_size != nes->mapper.chr_rom_size)
+    {
+        fprintf(stderr, "State was saved with a different rom MAPPER:%u PRG:0x%X CHR:0x%X\n",
+            state->header.mapper_type, state->header.pgr_rom_size, state->header.chr_rom_size);
+        return -1;
+    }
+
+    /// ram is about to change under any code decoded from it, rom isn't.
+    cpu_invalidate_writable_decoded(nes);
+
+    nes->cpu.reg = state->cpu.reg;
+    memcpy(nes->cpu.internal_ram, state->cpu.internal_ram, sizeof(state->cpu.internal_ram));
+    nes->cpu.cycle = state->cpu.cycle;
+    nes->cpu.cycle_total = state->cpu.cycle_total;
+    nes->cpu.cycle_deadline = state->cpu.cycle_total;
+    nes->cpu.debug.count = state->cpu.count;
+
+    /// the call stack it was following is gone, and the cycles went backwards.
+    if (nes->cpu.guestprof)
+    {
+        guestprof_begin(nes->cpu.guestprof, nes->cpu.cycle_total);
+    }
+
+    nes->ppu.reg = state->ppu.reg;
+    nes->ppu.mem = state->ppu.mem;
+    ppu_invalidate_tiles(&nes->ppu);
+    memcpy(nes->ppu.oam, state->ppu.oam, sizeof(state->ppu.oam));
+    ppu_invalidate_sprites(&nes->ppu);
+    nes->ppu.dot = state->ppu.dot;
+    nes->ppu.scanline = state->ppu.scanline;
+    nes->ppu.frame = state->ppu.frame;
+    nes->ppu.cycle_total = state->ppu.cycle_total;
+    nes->ppu.nmi_pending = state->ppu.nmi_pending;
+    nes->ppu.v = state->ppu.v;
+    nes->ppu.t = state->ppu.t;
+    nes->ppu.x = state->ppu.x;
+    nes->ppu.w = state->ppu.w;
+    nes->ppu.read_buffer = state->ppu.read_buffer;
+    nes->ppu.bg_lo = state->ppu.bg_lo;
+    nes->ppu.bg_hi = state->ppu.bg_hi;
+    nes->ppu.at_lo = state->ppu.at_lo;
+    nes->ppu.at_hi = state->ppu.at_hi;
+    memcpy(nes->ppu.sprite_line, state->ppu.sprite_line, sizeof(nes->ppu.sprite_line));
+
+    nes->apu.reg = state->apu.reg;
+    nes->apu.cycle_total = state->apu.cycle_total;
+
+    nes->joypad = state->joypad;
+
+    /// the banks mapped in only depend on the mapper state, so are already right if it is the same.
+    if (memcmp(nes->mapper.state, state->mapper, MAPPER_STATE_SIZE) != 0)
+    {
+        memcpy(nes->mapper.state, state->mapper, MAPPER_STATE_SIZE);
+        if (nes->mapper.type != Mapper_NONE)
+        {
+            mapper_remap(nes);
+        }
+    }
+
+    return 0;
+}
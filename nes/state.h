@@ -0,0 +1,29 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Defined in nes.h, every component lives inside of it.
+typedef struct nes nes_t;
+
+/// Save states are a single fixed size blob, a header followed by every component
+/// copied field by field, so saving / loading is just a handful of memcpys.
+/// The layout is tied to this build, bump the version whenever a saved field changes.
+#define NES_STATE_MAGIC 0x53454E54 /// "TNES"
+#define NES_STATE_VERSION 3
+
+size_t nes_state_size();
+
+/// buf must be at least nes_state_size() bytes.
+int nes_state_save(const nes_t *nes, void *buf, size_t size);
+
+/// Fails if the state is from another version, or was saved with a different rom layout.
+int nes_state_load(nes_t *nes, const void *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "trace.h"
+
+static void *writer_thread(void *user)
+{
+    trace_t *trace = user;
+    const uint64_t capacity = trace->mask + 1;
+
+    for (;;)
+    {
+        const uint64_t tail = atomic_load_explicit(&trace->tail, memory_order_relaxed);
+        const uint64_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+
+        if (head == tail)
+        {
+            /// stop is only set once the cpu is done pushing, so empty here means done.
+            if (atomic_load_explicit(&trace->stop, memory_order_acquire))
+            {
+                if (atomic_load_explicit(&trace->head, memory_order_acquire) == tail)
+                {
+                    break;
+                }
+                continue;
+            }
+
+            const struct timespec ts = { .tv_sec = 0, .tv_nsec = 1000000 };
+            nanosleep(&ts, NULL);
+            continue;
+        }
+
+        /// write up to the end of the ring, the rest is picked up next time around.
+        const uint64_t start = tail & trace->mask;
+        uint64_t count = head - tail;
+        if (start + count > capacity)
+        {
+            count = capacity - start;
+        }
+
+        if (fwrite(&trace->records[start], sizeof(trace_record_t), count, trace->fp) != count)
+        {
+            fprintf(stderr, "Failed to write trace\n");
+        }
+
+        atomic_store_explicit(&trace->tail, tail + count, memory_order_release);
+    }
+
+    return NULL;
+}
+
+int trace_start(trace_t *trace, const char *path, uint32_t capacity)
+{
+    memset(trace, 0, sizeof(trace_t));
+
+    assert(path);
+    if (!path)
+    {
+        fprintf(stderr, "Empty path in trace start\n");
+        return -1;
+    }
+
+    assert(capacity && (capacity & (capacity - 1)) == 0);
+    if (!capacity || (capacity & (capacity - 1)) != 0)
+    {
+        fprintf(stderr, "Trace capacity must be a power of 2 GOT:%u\n", capacity);
+        return -1;
+    }
+
+    trace->fp = fopen(path, "wb");
+    if (!trace->fp)
+    {
+        fprintf(stderr, "Failed to open trace: %s\n", path);
+        return -1;
+    }
+
+    trace->records = malloc(capacity * sizeof(trace_record_t));
+    if (!trace->records)
+    {
+        fprintf(stderr, "Failed to alloc trace records\n");
+        fclose(trace->fp);
+        return -1;
+    }
+    trace->mask = capacity - 1;
+
+    const trace_header_t header = { .magic = TRACE_MAGIC, .version = TRACE_VERSION, .record_size = sizeof(trace_record_t) };
+    fwrite(&header, sizeof(header), 1, trace->fp);
+
+    if (pthread_create(&trace->thread, NULL, writer_thread, trace) != 0)
+    {
+        fprintf(stderr, "Failed to start trace writer\n");
+        free(trace->records);
+        fclose(trace->fp);
+        return -1;
+    }
+
+    return 0;
+}
+
+void trace_stop(trace_t *trace)
+{
+    atomic_store_explicit(&trace->stop, true, memory_order_release);
+    pthread_join(trace->thread, NULL);
+
+    fclose(trace->fp);
+    free(trace->records);
+    memset(trace, 0, sizeof(trace_t));
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+
+/// Binary cpu trace.
+/// The cpu writes one fixed size record per instruction into a single producer /
+/// single consumer ring, and a background thread drains it to disk.
+/// Nothing is formatted here, use t-nes-tracefmt to turn the file into nestest log text.
+///
+/// The file is a trace_header_t followed by trace_record_t's, in host byte order.
+
+#define TRACE_MAGIC 0x43525454 /// "TTRC"
+#define TRACE_VERSION 1
+
+/// Records, must be a power of 2.
+#define TRACE_DEFAULT_CAPACITY (1 << 16)
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t _pad;
+} trace_header_t;
+
+/// State before the instruction runs.
+typedef struct
+{
+    uint64_t cycle;
+    uint16_t PC;
+    uint8_t opcode;
+    uint8_t operand[2]; /// the 2 bytes after the opcode, whether the instruction uses them or not.
+    uint8_t A;
+    uint8_t X;
+    uint8_t Y;
+    uint8_t P;
+    uint8_t SP;
+    uint8_t _pad[6];
+} trace_record_t;
+
+_Static_assert(sizeof(trace_record_t) == 24, "trace records are a fixed size");
+
+typedef struct trace
+{
+    trace_record_t *records;
+    uint64_t mask;
+
+    /// head is only written by the cpu, tail only by the writer thread.
+    /// each side keeps a copy of the other's, so only has to reload it when it looks full / empty.
+    _Alignas(64) _Atomic uint64_t head;
+    uint64_t tail_cache;
+    _Alignas(64) _Atomic uint64_t tail;
+
+    _Atomic bool stop;
+    pthread_t thread;
+    FILE *fp;
+} trace_t;
+
+int trace_start(trace_t *trace, const char *path, uint32_t capacity);
+
+/// Waits for everything pushed so far to hit the disk.
+void trace_stop(trace_t *trace);
+
+static inline void trace_push(trace_t *trace, const trace_record_t *record)
+{
+    const uint64_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+
+    /// full, the writer has to catch up. Blocks rather than dropping so the trace is complete.
+    while (head - trace->tail_cache > trace->mask)
+    {
+        trace->tail_cache = atomic_load_explicit(&trace->tail, memory_order_acquire);
+        if (head - trace->tail_cache > trace->mask)
+        {
+            sched_yield();
+        }
+    }
+
+    trace->records[head & trace->mask] = *record;
+    atomic_store_explicit(&trace->head, head + 1, memory_order_release);
+}
+
+#ifdef __cplusplus
+}
+#endif
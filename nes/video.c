@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "video.h"
+
+/// Build with -DVIDEO_SIMD=0 to convert a pixel at a time rather than 32 at a time with avx2 shuffles.
+#ifndef VIDEO_SIMD
+    #if defined(__AVX2__)
+        #define VIDEO_SIMD 1
+    #else
+        #define VIDEO_SIMD 0
+    #endif
+#endif
+
+#if VIDEO_SIMD
+    #include <immintrin.h>
+#endif
+
+/// How much an emphasis bit dims the other two channels.
+#define VIDEO_EMPHASIS_DIM 0.746
+
+/// The 2C02's colours as 0xRRGGBB, with no emphasis.
+static const uint32_t palette_2c02[64] =
+{
+    0x666666, 0x002A88, 0x1412A7, 0x3B00A4, 0x5C007E, 0x6E0040, 0x6C0600, 0x561D00,
+    0x333500, 0x0B4800, 0x005200, 0x004F08, 0x00404D, 0x000000, 0x000000, 0x000000,
+    0xADADAD, 0x155FD9, 0x4240FF, 0x7527FE, 0xA01ACC, 0xB71E7B, 0xB53120, 0x994E00,
+    0x6B6D00, 0x388700, 0x0C9300, 0x008F32, 0x007C8D, 0x000000, 0x000000, 0x000000,
+    0xFFFEFF, 0x64B0FF, 0x9290FF, 0xC676FF, 0xF36AFF, 0xFE6ECC, 0xFE8170, 0xEA9E22,
+    0xBCBE00, 0x88D800, 0x5CE430, 0x45E082, 0x48CDDE, 0x4F4F4F, 0x000000, 0x000000,
+    0xFFFEFF, 0xC0DFFF, 0xD3D2FF, 0xE8C8FF, 0xFBC2FF, 0xFEC4EA, 0xFECCC5, 0xF7D8A5,
+    0xE4E594, 0xCFEF96, 0xBDF4AB, 0xB3F3CC, 0xB5EBF2, 0xB8B8B8, 0x000000, 0x000000,
+};
+
+static uint32_t pack(VideoFormat format, uint8_t r, uint8_t g, uint8_t b)
+{
+    switch (format)
+    {
+        case VideoFormat_RGBA8888:  return 0xFF000000 | (b << 16) | (g << 8) | r;
+        case VideoFormat_BGRA8888:  return 0xFF000000 | (r << 16) | (g << 8) | b;
+        case VideoFormat_RGB565:    return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+        default: assert(0); return 0;
+    }
+}
+
+void video_init(video_t *video)
+{
+    memset(video, 0, sizeof(video_t));
+
+    for (uint8_t emphasis = 0; emphasis < VIDEO_EMPHASIS; emphasis++)
+    {
+        for (uint8_t i = 0; i < 64; i++)
+        {
+            double rgb[3] =
+            {
+                (palette_2c02[i] >> 16) & 0xFF,
+                (palette_2c02[i] >> 8) & 0xFF,
+                palette_2c02[i] & 0xFF,
+            };
+
+            /// each bit (red, green, blue) dims the channels it doesn't name.
+            for (uint8_t c = 0; c < 3; c++)
+            {
+                for (uint8_t bit = 0; bit < 3; bit++)
+                {
+                    if (bit != c && (emphasis & (1 << bit)))
+                    {
+                        rgb[c] *= VIDEO_EMPHASIS_DIM;
+                    }
+                }
+            }
+
+            for (uint8_t format = 0; format < VideoFormat_Count; format++)
+            {
+                const uint32_t colour = pack(format, rgb[0] + 0.5, rgb[1] + 0.5, rgb[2] + 0.5);
+                video->colours[format][emphasis][i] = colour;
+                for (uint8_t n = 0; n < 4; n++)
+                {
+                    video->bytes[format][emphasis][n][i] = colour >> (n * 8);
+                }
+            }
+        }
+    }
+}
+
+uint32_t video_bytes_per_pixel(VideoFormat format)
+{
+    return format == VideoFormat_RGB565 ? 2 : 4;
+}
+
+#if VIDEO_SIMD
+/// Byte n of 32 pixels, from the index split into quarters by split_index().
+static inline __m256i lookup32(const __m256i quarters[4], const __m256i split[4])
+{
+    return _mm256_or_si256(
+        _mm256_or_si256(_mm256_shuffle_epi8(quarters[0], split[0]), _mm256_shuffle_epi8(quarters[1], split[1])),
+        _mm256_or_si256(_mm256_shuffle_epi8(quarters[2], split[2]), _mm256_shuffle_epi8(quarters[3], split[3])));
+}
+
+/// The index into each 16 entry quarter of a table, with the top bit set (so the shuffle gives 0)
+/// where it is in another quarter.
+static inline void split_index(__m256i index, __m256i split[4])
+{
+    for (uint8_t q = 0; q < 4; q++)
+    {
+        split[q] = _mm256_adds_epu8(_mm256_xor_si256(index, _mm256_set1_epi8(q * 16)), _mm256_set1_epi8(0x70));
+    }
+}
+
+static void convert_line(const video_t *video, VideoFormat format, uint8_t emphasis, const uint8_t *line, uint8_t *out)
+{
+    const uint32_t bpp = video_bytes_per_pixel(format);
+
+    __m256i tables[4][4];
+    for (uint32_t n = 0; n < bpp; n++)
+    {
+        for (uint8_t q = 0; q < 4; q++)
+        {
+            tables[n][q] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)&video->bytes[format][emphasis][n][q * 16]));
+        }
+    }
+
+    /// the unpacks interleave within each 128 bit half, so the halves are put back in order as they are stored.
+    for (uint16_t x = 0; x < PPU_SCREEN_WIDTH; x += 32)
+    {
+        __m256i split[4];
+        split_index(_mm256_loadu_si256((const __m256i *)&line[x]), split);
+        const __m256i b0 = lookup32(tables[0], split);
+        const __m256i b1 = lookup32(tables[1], split);
+
+        if (bpp == 2)
+        {
+            const __m256i lo = _mm256_unpacklo_epi8(b0, b1); /// 0-7, 16-23
+            const __m256i hi = _mm256_unpackhi_epi8(b0, b1); /// 8-15, 24-31
+            _mm256_storeu_si256((__m256i *)&out[x * 2], _mm256_permute2x128_si256(lo, hi, 0x20));
+            _mm256_storeu_si256((__m256i *)&out[x * 2 + 32], _mm256_permute2x128_si256(lo, hi, 0x31));
+            continue;
+        }
+
+        const __m256i b2 = lookup32(tables[2], split);
+        const __m256i b3 = lookup32(tables[3], split);
+        const __m256i lo01 = _mm256_unpacklo_epi8(b0, b1);
+        const __m256i hi01 = _mm256_unpackhi_epi8(b0, b1);
+        const __m256i lo23 = _mm256_unpacklo_epi8(b2, b3);
+        const __m256i hi23 = _mm256_unpackhi_epi8(b2, b3);
+        const __m256i p0 = _mm256_unpacklo_epi16(lo01, lo23); /// 0-3, 16-19
+        const __m256i p1 = _mm256_unpackhi_epi16(lo01, lo23); /// 4-7, 20-23
+        const __m256i p2 = _mm256_unpacklo_epi16(hi01, hi23); /// 8-11, 24-27
+        const __m256i p3 = _mm256_unpackhi_epi16(hi01, hi23); /// 12-15, 28-31
+        _mm256_storeu_si256((__m256i *)&out[x * 4], _mm256_permute2x128_si256(p0, p1, 0x20));
+        _mm256_storeu_si256((__m256i *)&out[x * 4 + 32], _mm256_permute2x128_si256(p2, p3, 0x20));
+        _mm256_storeu_si256((__m256i *)&out[x * 4 + 64], _mm256_permute2x128_si256(p0, p1, 0x31));
+        _mm256_storeu_si256((__m256i *)&out[x * 4 + 96], _mm256_permute2x128_si256(p2, p3, 0x31));
+    }
+}
+#else
+static void convert_line(const video_t *video, VideoFormat format, uint8_t emphasis, const uint8_t *line, uint8_t *out)
+{
+    const uint32_t *colours = video->colours[format][emphasis];
+
+    if (format == VideoFormat_RGB565)
+    {
+        for (uint16_t x = 0; x < PPU_SCREEN_WIDTH; x++)
+        {
+            const uint16_t pixel = colours[line[x]];
+            memcpy(&out[x * 2], &pixel, sizeof(pixel));
+        }
+        return;
+    }
+
+    for (uint16_t x = 0; x < PPU_SCREEN_WIDTH; x++)
+    {
+        memcpy(&out[x * 4], &colours[line[x]], sizeof(uint32_t));
+    }
+}
+#endif
+
+int video_convert(const video_t *video, const ppu_t *ppu, VideoFormat format, void *pixels, uint32_t pitch)
+{
+    assert(video && ppu && pixels);
+    if (!video || !ppu || !pixels)
+    {
+        fprintf(stderr, "Empty video, ppu or pixels in video convert\n");
+        return -1;
+    }
+
+    assert(format < VideoFormat_Count && pitch >= PPU_SCREEN_WIDTH * video_bytes_per_pixel(format));
+    if (format >= VideoFormat_Count || pitch < PPU_SCREEN_WIDTH * video_bytes_per_pixel(format))
+    {
+        fprintf(stderr, "Bad video format %u or pitch %u\n", format, pitch);
+        return -1;
+    }
+
+    for (uint16_t y = 0; y < PPU_SCREEN_HEIGHT; y++)
+    {
+        convert_line(video, format, ppu->emphasis[y] & 7, ppu->framebuffer[y], (uint8_t *)pixels + (y * pitch));
+    }
+
+    return 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ppu.h"
+
+/// Host pixel formats the framebuffer converts to, named by byte order in memory.
+typedef enum
+{
+    VideoFormat_RGBA8888,
+    VideoFormat_BGRA8888,
+    VideoFormat_RGB565, /// a uint16_t per pixel, red in the top bits.
+    VideoFormat_Count,
+} VideoFormat;
+
+/// Emphasis combinations, ppumask bits 5-7 (red, green, blue).
+#define VIDEO_EMPHASIS 8
+
+/// The 64 ppu colours in every format and emphasis combination, built once by video_init().
+typedef struct
+{
+    /// What a pixel is, 565 in the low 16 bits.
+    uint32_t colours[VideoFormat_Count][VIDEO_EMPHASIS][64];
+
+    /// The same split into its bytes, [n][index] is byte n of the pixel, for looking up 16 at a time with shuffles.
+    uint8_t bytes[VideoFormat_Count][VIDEO_EMPHASIS][4][64];
+} video_t;
+
+void video_init(video_t *video);
+
+uint32_t video_bytes_per_pixel(VideoFormat format);
+
+/// Converts the ppu's framebuffer into pixels, pitch bytes apart, with the emphasis each line was drawn with.
+/// Greyscale is already in the framebuffer, it is applied as each pixel is drawn.
+int video_convert(const video_t *video, const ppu_t *ppu, VideoFormat format, void *pixels, uint32_t pitch);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,380 @@
+/*
+*   TotalJustice
+*/
+
+/// Runs many roms at once, one nes per job, spread over a pool of worker threads.
+/// Usage: t-nes-runner <manifest> [threads]
+///
+/// The manifest is one job per line, "<rom> <frames> [input script|movie]",
+/// lines starting with '#' are ignored. See nes/input_script.h for the input script format,
+/// and nes/movie.h for movies (.tnm / .fm2).
+///
+/// Once every job is done, one line per job is printed in manifest order:
+/// "<rom> frames:<n> ram:<hash> frame:<hash> cycles:<n>", or "<rom> FAILED",
+/// where the hashes are fnv-1a 64 of the cpu ram and of the ppu memory + oam + framebuffer at the end of the run,
+/// so two runs (or two builds) can be diffed. Anything else (timing, rom info, errors) goes to stderr.
+/// Set T_NES_JIT=1 to run every job with the recompiler, see nes/jit.h.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "nes/nes.h"
+#include "nes/input_script.h"
+#include "nes/movie.h"
+
+#define MAX_THREADS 256
+
+typedef struct
+{
+    char rom[256];
+    char input[256];
+    uint32_t frames;
+
+    /// results, ret stays -1 if no worker ever ran it.
+    int ret;
+    uint64_t ram_hash;
+    uint64_t frame_hash;
+    uint64_t cycles;
+} job_t;
+
+/// Each worker owns a deque of job indexes, it pops from the bottom of its own,
+/// and when that is empty it steals from the top of someone elses.
+/// The jobs are whole emulator runs, so a lock per deque is nowhere near contended.
+typedef struct
+{
+    pthread_mutex_t lock;
+    uint32_t *jobs;
+    uint32_t top;
+    uint32_t bottom;
+} deque_t;
+
+typedef struct
+{
+    job_t *jobs;
+    deque_t *deques;
+    uint32_t count;
+} pool_t;
+
+typedef struct
+{
+    pool_t *pool;
+    uint32_t id;
+    int ret; /// -1 if the worker couldn't create its emulator.
+} worker_t;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= p[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+#define FNV1A_SEED 0xCBF29CE484222325ULL
+
+static bool deque_pop(deque_t *deque, uint32_t *job)
+{
+    bool found = false;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom != deque->top)
+    {
+        *job = deque->jobs[--deque->bottom];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static bool deque_steal(deque_t *deque, uint32_t *job)
+{
+    bool found = false;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom != deque->top)
+    {
+        *job = deque->jobs[deque->top++];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static void run_job(nes_t *nes, job_t *job, bool jit)
+{
+    input_script_t script = {0};
+    movie_t movie = {0};
+    const bool playback = job->input[0] != '\0' && movie_path(job->input);
+    if (playback ? movie_load(&movie, job->input) != 0 :
+        job->input[0] != '\0' && input_script_load(&script, job->input) != 0)
+    {
+        job->ret = -1;
+        return;
+    }
+
+    /// reset everything so no state leaks from the last job on this worker.
+    mapper_exit(nes);
+    cart_exit(nes);
+    cpu_exit(nes);
+    cpu_init(nes);
+    ppu_init(&nes->ppu);
+    apu_init(&nes->apu);
+    cart_init(nes);
+    joypad_init(&nes->joypad);
+    mapper_init(nes);
+
+    job->ret = jit ? cpu_set_jit(nes, true) : 0;
+    if (job->ret == 0)
+    {
+        job->ret = nes_loadrom(nes, job->rom);
+    }
+    if (job->ret == 0)
+    {
+        job->ret = movie_check_rom(&movie, nes);
+    }
+    for (uint32_t frame = 0; job->ret == 0 && frame < job->frames; frame++)
+    {
+        if (playback)
+        {
+            movie_apply(&movie, nes, frame);
+        }
+        else
+        {
+            input_script_apply(&script, nes, frame);
+        }
+        job->ret = nes_run(nes);
+    }
+
+    job->cycles = nes->cpu.cycle_total;
+    job->ram_hash = fnv1a(FNV1A_SEED, nes->cpu.internal_ram, sizeof(nes->cpu.internal_ram));
+    job->frame_hash = fnv1a(FNV1A_SEED, &nes->ppu.mem, sizeof(nes->ppu.mem));
+    job->frame_hash = fnv1a(job->frame_hash, nes->ppu.oam, sizeof(nes->ppu.oam));
+    job->frame_hash = fnv1a(job->frame_hash, nes->ppu.framebuffer, sizeof(nes->ppu.framebuffer));
+
+    input_script_free(&script);
+    movie_free(&movie);
+}
+
+static void *worker_thread(void *user)
+{
+    worker_t *worker = user;
+    pool_t *pool = worker->pool;
+
+    /// its jobs are left for the other workers to steal.
+    nes_t *nes = nes_init();
+    if (!nes)
+    {
+        fprintf(stderr, "Failed to create an emulator for worker %u\n", worker->id);
+        worker->ret = -1;
+        return NULL;
+    }
+
+    const char *jit = getenv("T_NES_JIT");
+    const bool use_jit = jit && strcmp(jit, "1") == 0;
+
+    uint32_t job = 0;
+    for (;;)
+    {
+        if (!deque_pop(&pool->deques[worker->id], &job))
+        {
+            /// nothing left in ours, go round the others once, starting with our neighbour.
+            /// no new jobs are ever added, so if every deque is empty we are done.
+            bool stolen = false;
+            for (uint32_t i = 1; i < pool->count && !stolen; i++)
+            {
+                stolen = deque_steal(&pool->deques[(worker->id + i) % pool->count], &job);
+            }
+
+            if (!stolen)
+            {
+                break;
+            }
+        }
+
+        run_job(nes, &pool->jobs[job], use_jit);
+    }
+
+    nes_exit(nes);
+    return NULL;
+}
+
+static int load_manifest(const char *path, job_t **out_jobs, uint32_t *out_count)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        fprintf(stderr, "Failed to open manifest: %s\n", path);
+        return -1;
+    }
+
+    job_t *jobs = NULL;
+    uint32_t count = 0;
+    uint32_t cap = 0;
+    char line[1024];
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        job_t job = { .ret = -1 };
+
+        if (line[0] == '#' || line[0] == '\n')
+        {
+            continue;
+        }
+
+        if (sscanf(line, "%255s %u %255s", job.rom, &job.frames, job.input) < 2)
+        {
+            fprintf(stderr, "Bad manifest line: %s", line);
+            free(jobs);
+            fclose(fp);
+            return -1;
+        }
+
+        if (count == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            job_t *new_jobs = realloc(jobs, cap * sizeof(job_t));
+            if (!new_jobs)
+            {
+                fprintf(stderr, "Failed to alloc jobs\n");
+                free(jobs);
+                fclose(fp);
+                return -1;
+            }
+            jobs = new_jobs;
+        }
+
+        jobs[count++] = job;
+    }
+
+    fclose(fp);
+
+    *out_jobs = jobs;
+    *out_count = count;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <manifest> [threads]\n", argv[0]);
+        return -1;
+    }
+
+    job_t *jobs = NULL;
+    uint32_t job_count = 0;
+    if (load_manifest(argv[1], &jobs, &job_count) != 0)
+    {
+        return -1;
+    }
+
+    uint32_t thread_count = argc > 2 ? strtoul(argv[2], NULL, 0) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_count == 0)
+    {
+        thread_count = 1;
+    }
+    if (thread_count > MAX_THREADS)
+    {
+        thread_count = MAX_THREADS;
+    }
+    if (thread_count > job_count && job_count > 0)
+    {
+        thread_count = job_count;
+    }
+
+    /// deal the jobs out round robin, stealing evens out whatever is left.
+    pool_t pool = { .jobs = jobs, .count = thread_count };
+    pool.deques = calloc(thread_count, sizeof(deque_t));
+    uint32_t *slots = calloc(job_count ? job_count : 1, sizeof(uint32_t));
+    if (!pool.deques || !slots)
+    {
+        fprintf(stderr, "Failed to alloc deques\n");
+        free(pool.deques);
+        free(slots);
+        free(jobs);
+        return -1;
+    }
+
+    uint32_t slot = 0;
+    for (uint32_t i = 0; i < thread_count; i++)
+    {
+        deque_t *deque = &pool.deques[i];
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->jobs = &slots[slot];
+        /// pushed in reverse, so popping from the bottom runs them in manifest order.
+        for (uint32_t j = job_count; j-- > 0;)
+        {
+            if (j % thread_count == i)
+            {
+                deque->jobs[deque->bottom++] = j;
+            }
+        }
+        slot += deque->bottom;
+    }
+
+    worker_t workers[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    bool started[MAX_THREADS];
+    int ret = 0;
+
+    /// a worker that doesn't start leaves its jobs to be stolen, or unrun (and failed) if none start.
+    const double start = now();
+    for (uint32_t i = 0; i < thread_count; i++)
+    {
+        workers[i] = (worker_t){ .pool = &pool, .id = i };
+        started[i] = pthread_create(&threads[i], NULL, worker_thread, &workers[i]) == 0;
+        if (!started[i])
+        {
+            fprintf(stderr, "Failed to start worker %u\n", i);
+            ret = -1;
+        }
+    }
+    for (uint32_t i = 0; i < thread_count; i++)
+    {
+        if (started[i])
+        {
+            pthread_join(threads[i], NULL);
+            ret |= workers[i].ret;
+        }
+    }
+    const double elapsed = now() - start;
+
+    for (uint32_t i = 0; i < job_count; i++)
+    {
+        const job_t *job = &jobs[i];
+        if (job->ret != 0)
+        {
+            printf("%s FAILED\n", job->rom);
+            ret = -1;
+            continue;
+        }
+
+        printf("%s frames:%u ram:%016lX frame:%016lX cycles:%lu\n",
+            job->rom, job->frames, job->ram_hash, job->frame_hash, job->cycles);
+    }
+    fprintf(stderr, "jobs: %u threads: %u time: %.3fs\n", job_count, thread_count, elapsed);
+
+    for (uint32_t i = 0; i < thread_count; i++)
+    {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+    }
+    free(pool.deques);
+    free(slots);
+    free(jobs);
+
+    return ret;
+}
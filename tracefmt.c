@@ -0,0 +1,155 @@
+/*
+*   TotalJustice
+*/
+
+/// Formats a binary cpu trace (see nes/trace.h) as nestest log text.
+/// Usage: t-nes-tracefmt <trace> [out]
+///
+/// Memory isn't in the trace, so unlike nestest.log there is no "= XX" after operands,
+/// and the ppu position is worked out from the cycle, assuming no odd frame skip.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nes/cpu.h"
+#include "nes/cpu_opcodes.h"
+#include "nes/ppu.h"
+#include "nes/trace.h"
+
+#define OPCODE_NAME_ENTRY(code, mode, ins) [code] = #ins,
+#define OPCODE_MODE_ENTRY(code, mode, ins) [code] = AddrType_##mode,
+
+static const char *const opcode_names[0x100] =
+{
+    CPU_OPCODE_LIST(OPCODE_NAME_ENTRY)
+};
+
+static const uint8_t opcode_modes[0x100] =
+{
+    [0x00 ... 0xFF] = AddrType_Imp,
+    CPU_OPCODE_LIST(OPCODE_MODE_ENTRY)
+};
+
+static uint8_t mode_length(AddrType mode)
+{
+    switch (mode)
+    {
+        case AddrType_Acc: case AddrType_Imp:
+            return 1;
+        case AddrType_Abs: case AddrType_AbsX: case AddrType_AbsY: case AddrType_Ind:
+            return 3;
+        default:
+            return 2;
+    }
+}
+
+static void format_operand(char *out, size_t size, const trace_record_t *r, AddrType mode)
+{
+    const uint8_t lo = r->operand[0];
+    const uint16_t abs = r->operand[0] | (r->operand[1] << 8);
+
+    switch (mode)
+    {
+        case AddrType_Acc:      snprintf(out, size, "A"); break;
+        case AddrType_Imp:      out[0] = '\0'; break;
+        case AddrType_Rel:      snprintf(out, size, "$%04X", (uint16_t)(r->PC + 2 + (int8_t)lo)); break;
+        case AddrType_Imm:      snprintf(out, size, "#$%02X", lo); break;
+        case AddrType_Abs:      snprintf(out, size, "$%04X", abs); break;
+        case AddrType_AbsX:     snprintf(out, size, "$%04X,X", abs); break;
+        case AddrType_AbsY:     snprintf(out, size, "$%04X,Y", abs); break;
+        case AddrType_ZP:       snprintf(out, size, "$%02X", lo); break;
+        case AddrType_ZPX:      snprintf(out, size, "$%02X,X", lo); break;
+        case AddrType_ZPY:      snprintf(out, size, "$%02X,Y", lo); break;
+        case AddrType_Ind:      snprintf(out, size, "($%04X)", abs); break;
+        case AddrType_IndZPX:   snprintf(out, size, "($%02X,X)", lo); break;
+        case AddrType_IndZPY:   snprintf(out, size, "($%02X),Y", lo); break;
+    }
+}
+
+static void format_record(FILE *out, const trace_record_t *r)
+{
+    const AddrType mode = opcode_modes[r->opcode];
+    const uint8_t length = opcode_names[r->opcode] ? mode_length(mode) : 1;
+
+    char bytes[16];
+    switch (length)
+    {
+        case 1: snprintf(bytes, sizeof(bytes), "%02X", r->opcode); break;
+        case 2: snprintf(bytes, sizeof(bytes), "%02X %02X", r->opcode, r->operand[0]); break;
+        case 3: snprintf(bytes, sizeof(bytes), "%02X %02X %02X", r->opcode, r->operand[0], r->operand[1]); break;
+    }
+
+    /// "ASL_A" -> "ASL A".
+    char text[40];
+    if (opcode_names[r->opcode])
+    {
+        char operand[16];
+        format_operand(operand, sizeof(operand), r, mode);
+        snprintf(text, sizeof(text), "%.3s %s", opcode_names[r->opcode], operand);
+    }
+    else
+    {
+        snprintf(text, sizeof(text), "???");
+    }
+
+    const uint64_t dots = r->cycle * PPU_DOTS_PER_CPU_CYCLE;
+    const uint32_t scanline = (dots / PPU_DOTS_PER_SCANLINE) % PPU_SCANLINES_PER_FRAME;
+    const uint32_t dot = dots % PPU_DOTS_PER_SCANLINE;
+
+    fprintf(out, "%04X  %-8s  %-32sA:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3u,%3u CYC:%lu\n",
+        r->PC, bytes, text, r->A, r->X, r->Y, r->P, r->SP, scanline, dot, r->cycle);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <trace> [out]\n", argv[0]);
+        return -1;
+    }
+
+    FILE *fp = fopen(argv[1], "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "Failed to open trace: %s\n", argv[1]);
+        return -1;
+    }
+
+    trace_header_t header = {0};
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != TRACE_MAGIC ||
+        header.version != TRACE_VERSION || header.record_size != sizeof(trace_record_t))
+    {
+        fprintf(stderr, "Not a trace from this version: %s\n", argv[1]);
+        fclose(fp);
+        return -1;
+    }
+
+    FILE *out = argc > 2 ? fopen(argv[2], "w") : stdout;
+    if (!out)
+    {
+        fprintf(stderr, "Failed to open out: %s\n", argv[2]);
+        fclose(fp);
+        return -1;
+    }
+
+    trace_record_t records[4096];
+    size_t count = 0;
+    while ((count = fread(records, sizeof(trace_record_t), 4096, fp)) > 0)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            format_record(out, &records[i]);
+        }
+    }
+
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    fclose(fp);
+
+    return 0;
+}
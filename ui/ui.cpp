@@ -66,14 +66,118 @@ void gfx_exit()
     SDL_Quit();
 }
 
+static nes_t *nes = NULL;
 static bool loaded_rom = false;
 
+/// Quick save is kept in memory, the slots are saved to disk as "t-nes.state<slot>".
+#define STATE_SLOTS 10
+static int state_slot = 0;
+static uint8_t *quick_state = NULL;
+static bool quick_state_valid = false;
+
+/// 4MiB is well over a minute of history, most frames delta down to a few hundred bytes.
+#define REWIND_BUFFER_SIZE (4 * 1024 * 1024)
+#define REWIND_MAX_FRAMES (60 * 60)
+static rewind_t rewind_history;
+static bool rewinding = false;
+
+static void quick_save()
+{
+    if (!quick_state)
+    {
+        quick_state = (uint8_t*)malloc(nes_state_size());
+        assert(quick_state);
+        if (!quick_state)
+        {
+            return;
+        }
+    }
+
+    quick_state_valid = nes_state_save(nes, quick_state, nes_state_size()) == 0;
+}
+
+static void quick_load()
+{
+    if (quick_state_valid)
+    {
+        nes_state_load(nes, quick_state, nes_state_size());
+        rewind_clear(&rewind_history);
+    }
+}
+
+static void state_path(char *path, size_t size)
+{
+    snprintf(path, size, "t-nes.state%d", state_slot);
+}
+
+static void save_state()
+{
+    const size_t size = nes_state_size();
+    uint8_t *buf = (uint8_t*)malloc(size);
+    assert(buf);
+    if (!buf)
+    {
+        return;
+    }
+
+    char path[32];
+    state_path(path, sizeof(path));
+
+    if (nes_state_save(nes, buf, size) == 0)
+    {
+        FILE *fp = fopen(path, "wb");
+        if (fp)
+        {
+            fwrite(buf, 1, size, fp);
+            fclose(fp);
+        }
+        else
+        {
+            fprintf(stderr, "Failed to open state: %s\n", path);
+        }
+    }
+
+    free(buf);
+}
+
+static void load_state()
+{
+    const size_t size = nes_state_size();
+    uint8_t *buf = (uint8_t*)malloc(size);
+    assert(buf);
+    if (!buf)
+    {
+        return;
+    }
+
+    char path[32];
+    state_path(path, sizeof(path));
+
+    FILE *fp = fopen(path, "rb");
+    if (fp)
+    {
+        const size_t read = fread(buf, 1, size, fp);
+        fclose(fp);
+        if (nes_state_load(nes, buf, read) == 0)
+        {
+            rewind_clear(&rewind_history);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Failed to open state: %s\n", path);
+    }
+
+    free(buf);
+}
+
 static void file_menu()
 {
     if (ImGui::MenuItem("Open", "Ctrl+O"))
     {
-        nes_loadrom("testroms/nestest.nes");
-        cpu_power_up();
+        nes_loadrom(nes, "testroms/nestest.nes");
+        cpu_power_up(nes);
+        rewind_clear(&rewind_history);
         loaded_rom = true;
     }
     if (ImGui::BeginMenu("Open Recent"))
@@ -92,21 +196,18 @@ static void file_menu()
 
     ImGui::Separator();
 
-    if (ImGui::MenuItem("Quick Save", "Ctrl+S", false, false)) {}
-    if (ImGui::MenuItem("Quick Load", "Ctrl+L", false, false)) {}
-    if (ImGui::MenuItem("Save State")) {}
-    if (ImGui::MenuItem("Load State")) {}
+    if (ImGui::MenuItem("Quick Save", "Ctrl+S", false, loaded_rom)) { quick_save(); }
+    if (ImGui::MenuItem("Quick Load", "Ctrl+L", false, loaded_rom)) { quick_load(); }
+    if (ImGui::MenuItem("Save State", NULL, false, loaded_rom)) { save_state(); }
+    if (ImGui::MenuItem("Load State", NULL, false, loaded_rom)) { load_state(); }
     if (ImGui::BeginMenu("Save State Slot"))
     {
-        ImGui::MenuItem("Slot 0");
-        ImGui::MenuItem("Slot 1");
-        ImGui::MenuItem("Slot 2");
-        ImGui::MenuItem("Slot 3");
-        ImGui::MenuItem("Slot 4");
-        ImGui::MenuItem("Slot 5");
-        ImGui::MenuItem("Slot 6");
-        ImGui::MenuItem("Slot 7");
-        ImGui::MenuItem("Slot 8");
+        for (int i = 0; i < STATE_SLOTS; i++)
+        {
+            char label[16];
+            snprintf(label, sizeof(label), "Slot %d", i);
+            if (ImGui::MenuItem(label, NULL, state_slot == i)) { state_slot = i; }
+        }
         ImGui::EndMenu();
     }
 
@@ -133,7 +234,7 @@ void gfx_menubar()
             ImGui::Separator();
 
             if (ImGui::MenuItem("Fast Forward")) {}
-            if (ImGui::MenuItem("Rewind")) {}
+            if (ImGui::MenuItem("Rewind", NULL, &rewinding)) {}
             ImGui::Separator();
 
             if (ImGui::MenuItem("Fullscreen")) {}
@@ -198,7 +299,7 @@ void gfx_debug()
     {
         static int breakpoint = 1;
         static bool run = false;
-        cpu_t *cpu = cpu_debug_get();
+        cpu_t *cpu = &nes->cpu;
 
         if (run)
         {
@@ -206,9 +307,18 @@ void gfx_debug()
             {
                 run = false;
             }
+            else if (rewinding)
+            {
+                /// step back a frame at a time until the history runs out.
+                if (rewind_pop(&rewind_history, nes) != 0)
+                {
+                    rewinding = false;
+                }
+            }
             else
             {
-                nes_run();
+                nes_run(nes);
+                rewind_push(&rewind_history, nes);
             }
         }
 
@@ -219,7 +329,7 @@ void gfx_debug()
         {
             for (int i = 0; i < breakpoint; i++)
             {
-                nes_step();
+                nes_step(nes);
             }
         }
 
@@ -250,9 +360,12 @@ void gfx_debug()
     ImGui::End();
 }
 
-void ui()
+void ui(nes_t *instance)
 {
+    nes = instance;
+
     gfx_init();
+    rewind_init(&rewind_history, REWIND_BUFFER_SIZE, REWIND_MAX_FRAMES);
 
     static bool quit = false;
 
@@ -268,6 +381,13 @@ void ui()
                 case SDL_QUIT:
                     quit = true;
                     break;
+                case SDL_KEYDOWN:
+                    if (loaded_rom && (event.key.keysym.mod & KMOD_CTRL))
+                    {
+                        if (event.key.keysym.sym == SDLK_s) { quick_save(); }
+                        else if (event.key.keysym.sym == SDLK_l) { quick_load(); }
+                    }
+                    break;
                 default:
                     break;
             }
@@ -281,4 +401,8 @@ void ui()
     }
 
     gfx_exit();
+
+    rewind_exit(&rewind_history);
+    free(quick_state);
+    quick_state = NULL;
 }
\ No newline at end of file
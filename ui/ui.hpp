@@ -4,7 +4,9 @@
 extern "C" {
 #endif
 
-void ui();
+#include "../nes/nes.h"
+
+void ui(nes_t *nes);
 
 #ifdef __cplusplus
 }